@@ -1,11 +1,13 @@
 
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
+#include "bundle.h"
 #include "header.h"
-#include "utils/byte_buffer.h"
 #include "utils/common.h"
+#include "utils/mapped_file.h"
 #include "vm.h"
 
 #ifdef _DEBUG
@@ -82,12 +84,23 @@ int main(int argc, const char* argv[])
                 extended_errors,
 #endif  // #if USING(EXTENDED_ERROR_REPORT)
                 code,
+                optimize,
                 disassemble,
                 step_debugging,
+                profile,
+                gc_stats,
+                threaded,
+                registers,
+                superinstructions,
+                jit,
+                jit_threshold,
+                cache_dir,
                 repl,
                 compile,
                 run,
                 output,
+                bundle,
+                bundle_vm,
             };
             Type        type;
             const char* params = nullptr;
@@ -104,18 +117,36 @@ int main(int argc, const char* argv[])
 #if USING(EXTENDED_ERROR_REPORT)
             ADD_PARAM_WITH_PARAMS(extended_errors, "Show extended error reporting", "<0 / 1>"),
 #endif  // #if USING(EXTENDED_ERROR_REPORT)
+            ADD_PARAM_WITH_PARAMS(optimize,
+                                  "Folded constants, peephole-optimized bytecode, no debug-only opcodes (default: 1)",
+                                  "<0 / 1>"),
             ADD_PARAM(disassemble, "Show disassembled code"),
             ADD_PARAM(step_debugging, "Step-by-step execution"),
+            ADD_PARAM(profile, "Shows per-instruction execution counts after running"),
+            ADD_PARAM(gc_stats, "Shows garbage collector and object allocator stats after running"),
+            ADD_PARAM(threaded, "Runs code pre-decoded into direct-threaded cells instead of bytecode (no JIT)"),
+            ADD_PARAM(registers, "Runs code translated into register instructions instead of bytecode (no JIT)"),
+            ADD_PARAM_WITH_PARAMS(superinstructions, "Runs frequent instruction sequences as one instruction (default: 1)",
+                                  "<0 / 1>"),
+            ADD_PARAM_WITH_PARAMS(jit, "Compiles hot code into machine code, x86-64 Linux only (default: 1)", "<0 / 1>"),
+            ADD_PARAM_WITH_PARAMS(jit_threshold, "Calls and loop iterations before compiling code (default: 100)",
+                                  "<count>"),
+            ADD_PARAM_WITH_PARAMS(cache_dir, "Caches the bytecode of the scripts run from files in <directory>",
+                                  "<directory>"),
             ADD_PARAM(repl, "Enters interactive mode(i.e. REPL)"),
             ADD_PARAM(compile, "Compiles into bytecode and outputs the result to console or the output_file defined"),
             ADD_PARAM_WITH_PARAMS(output, "Allows defining the output file for -compile", "<output_file>"),
+            ADD_PARAM_WITH_PARAMS(bundle, "Makes -compile output a self-contained executable (cloxvm + bytecode)",
+                                  "<output_file>"),
+            ADD_PARAM_WITH_PARAMS(bundle_vm, "VM executable used by -bundle (default: cloxvm next to this tool)",
+                                  "<cloxvm>"),
             ADD_PARAM(run, "Runs the input code through the VM"),
             ADD_PARAM_WITH_PARAMS(code, "Allows passing <source_code> as a character string", "<source_code>"),
         };
 #undef ADD_PARAM
         auto showHelpFunc = [&](std::ostream& ostr)
         {
-            ostr << "CLOX-variant tools (compiler / interpreter / REPL / VM) version " << VERSION << std::endl;
+            ostr << "CLOX-variant tools (compiler / interpreter / REPL / VM) version " << toString(VERSION) << std::endl;
             ostr << format("Usage: %s [arguments] [filepath]\n", argv[0]);
             size_t longerArg = 0;
             for (const Param& param : params)
@@ -159,6 +190,8 @@ int main(int argc, const char* argv[])
             bool          isCodeOrFile      = false;
             ExecutionMode mode              = ExecutionMode::Interpret;
             const char*   compileOutputPath = nullptr;
+            const char*   bundleOutputPath  = nullptr;
+            const char*   bundleVMPath      = nullptr;
         } config;
 
         auto        isArgFunc = [](const char* arg) { return (arg[0] == '-'); };
@@ -204,6 +237,23 @@ int main(int argc, const char* argv[])
                                 }
                                 break;
                             }
+                            case Param::Type::bundle:
+                            case Param::Type::bundle_vm:
+                            {
+                                if (config.mode != ExecutionMode::Compile)
+                                {
+                                    return errorReportWithHelpFunc(
+                                        format("Unexpected bundle parameter. Only used with -compile: %s", curArg)
+                                            .c_str());
+                                }
+                                if (*argvPtr == lastArg || isArgFunc(*(argvPtr + 1)))
+                                {
+                                    return errorReportWithHelpFunc(format("Missing parameter for %s", curArg).c_str());
+                                }
+                                (param.type == Param::Type::bundle ? config.bundleOutputPath : config.bundleVMPath) =
+                                    *(++argvPtr);
+                                break;
+                            }
                             case Param::Type::allow_dynamic_variables:
                                 compilerConfiguration.allowDynamicVariables = true;
                                 break;
@@ -218,6 +268,12 @@ int main(int argc, const char* argv[])
                                 }
                                 break;
 #endif  // #if USING(EXTENDED_ERROR_REPORT)
+                            case Param::Type::optimize:
+                                if (!isArgFunc(*(argvPtr + 1)))
+                                {
+                                    compilerConfiguration.optimize = **(++argvPtr) == '1';
+                                }
+                                break;
                             case Param::Type::repl: config.mode = ExecutionMode::REPL; break;
                             case Param::Type::help: config.hasToShowHelp = true; break;
                             case Param::Type::compile: config.mode = ExecutionMode::Compile; break;
@@ -227,6 +283,39 @@ int main(int argc, const char* argv[])
                                 break;
                             case Param::Type::disassemble: compilerConfiguration.disassemble = true; break;
                             case Param::Type::step_debugging: virtualMachineConfiguration.stepByStep = true; break;
+                            case Param::Type::profile: virtualMachineConfiguration.profile = true; break;
+                            case Param::Type::gc_stats: virtualMachineConfiguration.gcStats = true; break;
+                            case Param::Type::threaded: virtualMachineConfiguration.threaded = true; break;
+                            case Param::Type::registers: virtualMachineConfiguration.registers = true; break;
+                            case Param::Type::superinstructions:
+                                if (!isArgFunc(*(argvPtr + 1)))
+                                {
+                                    virtualMachineConfiguration.superinstructions = **(++argvPtr) == '1';
+                                }
+                                break;
+                            case Param::Type::jit:
+                                if (!isArgFunc(*(argvPtr + 1)))
+                                {
+                                    virtualMachineConfiguration.jit = **(++argvPtr) == '1';
+                                }
+                                break;
+                            case Param::Type::jit_threshold:
+                                if (*argvPtr == lastArg || isArgFunc(*(argvPtr + 1)))
+                                {
+                                    return errorReportWithHelpFunc(
+                                        format("Missing parameter for %s <count>", curArg).c_str());
+                                }
+                                virtualMachineConfiguration.jitThreshold =
+                                    static_cast<uint32_t>(strtoul(*(++argvPtr), nullptr, 10));
+                                break;
+                            case Param::Type::cache_dir:
+                                if (*argvPtr == lastArg || isArgFunc(*(argvPtr + 1)))
+                                {
+                                    return errorReportWithHelpFunc(
+                                        format("Missing parameter for %s <directory>", curArg).c_str());
+                                }
+                                virtualMachineConfiguration.cacheDirectory = *(++argvPtr);
+                                break;
                             default: validParam = false; break;
                         }
                     }
@@ -298,7 +387,30 @@ int main(int argc, const char* argv[])
                 }
                 ASSERT(function != nullptr);
 
-                if (config.compileOutputPath != nullptr)
+                serde::BufferWriter writer;
+                auto                serializeResult = function->serialize(writer);
+                if (!serializeResult.isOk())
+                {
+                    return errorReportFunc(
+                        format("Failed serializing: %s", serializeResult.error().message().c_str()).c_str());
+                }
+
+                if (config.bundleOutputPath != nullptr)
+                {
+                    const std::string vmPath =
+                        config.bundleVMPath != nullptr
+                            ? std::string(config.bundleVMPath)
+                            : (std::filesystem::path(bundle::getExecutablePath(argv[0])).parent_path() / "cloxvm")
+                                  .string();
+                    auto bundleResult =
+                        bundle::write(vmPath.c_str(), writer.getData(), writer.getSize(), config.bundleOutputPath);
+                    if (!bundleResult.isOk())
+                    {
+                        return errorReportFunc(
+                            format("Failed bundling: %s", bundleResult.error().message().c_str()).c_str());
+                    }
+                }
+                else if (config.compileOutputPath != nullptr)
                 {
                     std::ofstream ofs(config.compileOutputPath,
                                       std::ofstream::binary | std::ofstream::trunc | std::ofstream::out);
@@ -307,26 +419,24 @@ int main(int argc, const char* argv[])
                         return errorReportFunc(
                             format("Failed to open file '%s' for writing", config.compileOutputPath).c_str());
                     }
-                    auto serializeResult = function->serialize(ofs);
-                    if (!serializeResult.isOk())
+                    ofs.write(reinterpret_cast<const char*>(writer.getData()),
+                              static_cast<std::streamsize>(writer.getSize()));
+                    if (!ofs.good())
                     {
-                        return errorReportFunc(format("Failed serializing to file '%s': %s", config.compileOutputPath,
-                                                      serializeResult.error().message().c_str())
-                                                   .c_str());
+                        return errorReportFunc(
+                            format("Failed writing to file '%s'", config.compileOutputPath).c_str());
                     }
                 }
                 else
                 {
-                    auto serializeResult = function->serialize(std::cout);
-                    if (!serializeResult.isOk())
-                    {
-                        return errorReportFunc(
-                            format("Failed serializing: %s", serializeResult.error().message().c_str()).c_str());
-                    }
+                    std::cout.write(reinterpret_cast<const char*>(writer.getData()),
+                                    static_cast<std::streamsize>(writer.getSize()));
                 }
             }
             else
             {
+                MappedFile bytecodeFile;  // code and strings are used in place: unmapped once the VM is done
+
                 VirtualMachine VM;
                 VM.init(virtualMachineConfiguration);
                 ScopedCallback vmFinish([&VM] { VM.finish(); });
@@ -335,15 +445,14 @@ int main(int argc, const char* argv[])
                 {
                     ASSERT(config.isCodeOrFile == false);
 
-                    ObjectFunction* function = nullptr;
-                    function                 = ObjectFunction::Create(config.srcCodeOrFile);
-                    std::ifstream ifs(config.srcCodeOrFile, std::ifstream::binary);
-                    if (!ifs.is_open() || !ifs.good())
+                    auto openResult = bytecodeFile.open(config.srcCodeOrFile);
+                    if (!openResult.isOk())
                     {
-                        return errorReportFunc(
-                            format("Failed to open file '%s' for reading", config.srcCodeOrFile).c_str());
+                        return errorReportFunc(openResult.error().message().c_str());
                     }
-                    auto deserializeResult = function->deserialize(ifs);
+                    ObjectFunction* function = ObjectFunction::Create(config.srcCodeOrFile);
+                    auto            deserializeResult =
+                        function->deserializeInPlace(bytecodeFile.getData(), bytecodeFile.getSize());
                     if (!deserializeResult.isOk())
                     {
                         return errorReportFunc(
@@ -355,7 +464,7 @@ int main(int argc, const char* argv[])
                         disassemble(function->chunk, config.srcCodeOrFile);
                     }
 
-                    auto result = VM.runFromByteCode(function->chunk);
+                    auto result = VM.runFromByteCode(*function);
                     if (!result.isOk())
                     {
                         resultCode = -1;
@@ -2,7 +2,6 @@
 #include <iostream>
 #include <sstream>
 
-#include "utils/byte_buffer.h"
 #include "utils/common.h"
 #include "vm.h"
 
@@ -25,12 +24,16 @@ int main(int argc, const char* argv[])
     };
 
     {
-        const char codeStr[] = {
+        char codeStr[] = {  // writable, the code is used in place and quickened
             // -> CODE
             0x19, 0x53, 0x4f, 0x55, 0x52, 0x43, 0x45, 0x00, 0x5f, 0x43, 0x4f, 0x44, 0x45, 0x34,
-            0x32, 0x5f, 0x00, 0x00, 0x01, 0x61, 0x2e, 0x44, 0x41, 0x54, 0x41, 0x01, 0x04, 0x00,
-            0x3d, 0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x77, 0x6f, 0x72, 0x6c, 0x64, 0x21, 0x20,
-            0x3a, 0x29, 0x2e, 0x43, 0x4f, 0x44, 0x45, 0x04, 0x00, 0x01, 0x00, 0x0f, 0x00,
+            0x32, 0x5f, 0x00, 0x06, 0x00, 0x61, 0x2e, 0x53, 0x54, 0x52, 0x49, 0x4e, 0x47, 0x53,
+            0x10, 0x00, 0x00, 0x00, 0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x77, 0x6f, 0x72, 0x6c,
+            0x64, 0x21, 0x20, 0x3a, 0x29, 0x00, 0x2e, 0x44, 0x41, 0x54, 0x41, 0x01, 0x00, 0x00,
+            0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x2e, 0x47, 0x4c,
+            0x4f, 0x42, 0x41, 0x4c, 0x53, 0x00, 0x00, 0x00, 0x00, 0x2e, 0x43, 0x4f, 0x44, 0x45,
+            0x05, 0x00, 0x00, 0x00, 0x01, 0x00, 0x12, 0x02, 0x00, 0x2e, 0x4c, 0x49, 0x4e, 0x45,
+            0x53, 0x01, 0x00, 0x00,
         };
 
         auto isCarFunc = [](char a) { return (a >= '0' && a <= 'z') || a == ' ' || a == '.'; };
@@ -52,18 +55,20 @@ int main(int argc, const char* argv[])
         VM.init(virtualMachineConfiguration);
         ScopedCallback vmFinish([&VM] { VM.finish(); });
 
-        ObjectFunction*       function  = ObjectFunction::Create("LOADER");
-        const volatile char*  codeBegin = codeStr;
-        const volatile size_t codeLen   = sizeof(codeStr);
-        ByteStream            istr((const uint8_t*)codeBegin, codeLen);
-        auto                  deserializeResult = function->deserialize(istr);
-        ASSERT(deserializeResult.isOk());
+        ObjectFunction*       function          = ObjectFunction::Create("LOADER");
+        const volatile char*  codeBegin         = codeStr;
+        const volatile size_t codeLen           = sizeof(codeStr);
+        auto                  deserializeResult = function->deserializeInPlace((const uint8_t*)codeBegin, codeLen);
+        if (!deserializeResult.isOk())
+        {
+            return errorReportFunc(deserializeResult.error().message().c_str());
+        }
         if (argc > 1 && (nullptr != strstr(argv[1], "disassemble")))
         {
             disassemble(function->chunk, "VM");
         }
 
-        auto result = VM.runFromByteCode(function->chunk);
+        auto result = VM.runFromByteCode(*function);
         if (!result.isOk())
         {
             return errorReportFunc(result.error().message().c_str());
@@ -1,10 +1,7 @@
-#include <fstream>
-#include <iostream>
-#include <sstream>
-
+#include "bundle.h"
 #include "header.h"
-#include "utils/byte_buffer.h"
 #include "utils/common.h"
+#include "utils/mapped_file.h"
 #include "vm.h"
 
 int main(int argc, const char* argv[])
@@ -51,10 +48,10 @@ int main(int argc, const char* argv[])
 #endif  // #if USING(EXTENDED_ERROR_REPORT)
     };
 #undef ADD_PARAM
-    auto showHelpFunc = [&](std::ostream& ostr)
+    auto showHelpFunc = [&](FILE* out)
     {
-        ostr << "CLOX-variant VirtualMachine version " << VERSION << std::endl;
-        ostr << format("Usage: %s [arguments] [filepath]\n", argv[0]);
+        fprintf(out, "CLOX-variant VirtualMachine version %s\n", toString(VERSION).c_str());
+        fprintf(out, "Usage: %s [arguments] [filepath]\n", argv[0]);
         size_t longerArg = 0;
         for (const Param& param : params)
         {
@@ -63,14 +60,14 @@ int main(int argc, const char* argv[])
         for (const Param& param : params)
         {
             const size_t spaceCount = longerArg - (strlen(param.arg) + (param.params ? strlen(param.params) + 1 : 0));
-            ostr << format("\t-%s%s%s", param.arg, param.params ? " " : "", param.params ? param.params : "");
-            ostr << format("%*s\t%s\n", (int)spaceCount, " ", param.desc);
+            fprintf(out, "\t-%s%s%s", param.arg, param.params ? " " : "", param.params ? param.params : "");
+            fprintf(out, "%*s\t%s\n", (int)spaceCount, " ", param.desc);
         }
     };
     auto errorReportWithHelpFunc = [&](const char* msg, int32_t errCode = -1)
     {
         auto result = errorReportFunc(msg, errCode);
-        showHelpFunc(std::cerr);
+        showHelpFunc(stderr);
         return result;
     };
 
@@ -117,38 +114,53 @@ int main(int argc, const char* argv[])
         }
     }
 
+    // a bundled executable (see cloxc -bundle) runs the bytecode appended to itself
+    MappedFile      bytecodeFile;  // code and strings are used in place: unmapped once the VM is done
+    bundle::Payload bytecode;
+    if (!config.hasToShowHelp && config.filepath == nullptr)
+    {
+        const std::string executablePath = bundle::getExecutablePath(argv[0]);
+        if (bytecodeFile.open(executablePath.c_str()).isOk())
+        {
+            bytecode = bundle::find(bytecodeFile);
+        }
+    }
+
     if (config.hasToShowHelp)
     {
-        showHelpFunc(std::cout);
+        showHelpFunc(stdout);
     }
     else
     {
-        if (config.filepath == nullptr)
+        if (config.filepath == nullptr && bytecode.data == nullptr)
         {
             return errorReportWithHelpFunc(format("Missing binary filepath").c_str());
         }
         else
         {
+            if (config.filepath != nullptr)
+            {
+                auto openResult = bytecodeFile.open(config.filepath);
+                if (!openResult.isOk())
+                {
+                    return errorReportFunc(openResult.error().message().c_str());
+                }
+                bytecode = bundle::Payload{bytecodeFile.getData(), bytecodeFile.getSize()};
+            }
+
             VirtualMachine VM;
             VM.init(virtualMachineConfiguration);
             ScopedCallback vmFinish([&VM] { VM.finish(); });
 
-            ObjectFunction* function = ObjectFunction::Create(config.filepath);
+            ObjectFunction* function          = ObjectFunction::Create(config.filepath ? config.filepath : argv[0]);
+            auto            deserializeResult = function->deserializeInPlace(bytecode.data, bytecode.size);
+            if (!deserializeResult.isOk())
             {
-                std::ifstream ifs(config.filepath, std::ifstream::binary);
-                if (!ifs.is_open() || !ifs.good())
-                {
-                    return errorReportFunc(format("Failed to open file '%s' for reading", config.filepath).c_str());
-                }
-                auto deserializeResult = function->deserialize(ifs);
-                if (!deserializeResult.isOk())
-                {
-                    return errorReportFunc(
-                        format("Failed loading bytecode: %s", deserializeResult.error().message().c_str()).c_str());
-                }
+                return errorReportFunc(
+                    format("Failed loading bytecode: %s", deserializeResult.error().message().c_str()).c_str());
             }
 
-            auto result = VM.runFromByteCode(function->chunk);
+            auto result = VM.runFromByteCode(*function);
             if (!result.isOk())
             {
                 resultCode = -1;
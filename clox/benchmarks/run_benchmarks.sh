@@ -0,0 +1,55 @@
+#!/bin/bash
+# Builds the VM for every variant and reports the best wall time of each benchmark script.
+#   usage: run_benchmarks.sh [benchmark.clox ...]
+# RUNS=<n> sets the number of runs per benchmark (default 5)
+
+SOURCE_PATH=$(cd "$(dirname "$0")/.." && pwd)
+BENCH_PATH=${SOURCE_PATH}/benchmarks
+BUILD_PATH=${SOURCE_PATH}/build/bench
+RUNS=${RUNS:-5}
+
+# <name>:<cmake options>
+VARIANTS=(
+    "computed_goto:-DCLOX_SWITCH_DISPATCH=OFF"
+    "interpreter:-DCLOX_SWITCH_DISPATCH=OFF -DCLOX_JIT=OFF"
+    "switch:-DCLOX_SWITCH_DISPATCH=ON"
+    "nan_boxing:-DCLOX_SWITCH_DISPATCH=OFF -DCLOX_NAN_BOXING=ON"
+)
+
+BENCHMARKS=("$@")
+if [ ${#BENCHMARKS[@]} -eq 0 ]; then
+    BENCHMARKS=("${BENCH_PATH}"/*.clox)
+fi
+
+best_time() # <command...>
+{
+    local best=""
+    for ((i = 0; i < RUNS; ++i)); do
+        local start=$(date +%s%N)
+        "$@" > /dev/null || return 1
+        local elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+        if [ -z "${best}" ] || [ ${elapsed} -lt ${best} ]; then
+            best=${elapsed}
+        fi
+    done
+    echo ${best}
+}
+
+for variant in "${VARIANTS[@]}"; do
+    name=${variant%%:*}
+    options=${variant#*:}
+    variant_path=${BUILD_PATH}/${name}
+
+    # binaries and libraries are output to the variant build, leaving the default ones in ${SOURCE_PATH}/bin untouched
+    cmake -B "${variant_path}" -S "${SOURCE_PATH}" -DCMAKE_BUILD_TYPE=Release -DBUILD_TESTING=OFF \
+        -DCMAKE_RUNTIME_OUTPUT_DIRECTORY="${variant_path}" -DCMAKE_LIBRARY_OUTPUT_DIRECTORY="${variant_path}/lib" \
+        -DCMAKE_ARCHIVE_OUTPUT_DIRECTORY="${variant_path}/lib" ${options} > /dev/null || exit 1
+    cmake --build "${variant_path}" --target cloxc cloxvm > /dev/null 2>&1 || exit 1
+
+    for benchmark in "${BENCHMARKS[@]}"; do
+        bytecode=${variant_path}/$(basename "${benchmark}" .clox).cloxbin
+        "${variant_path}/cloxc" -compile "${benchmark}" -output "${bytecode}" || exit 1
+        elapsed=$(best_time "${variant_path}/cloxvm" "${bytecode}") || exit 1
+        printf "%-16s %-24s %6d ms\n" "${name}" "$(basename "${benchmark}")" "${elapsed}"
+    done
+done
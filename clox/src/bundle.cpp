@@ -0,0 +1,95 @@
+#include "bundle.h"
+
+#include <cstring>
+#include <filesystem>
+
+namespace
+{
+struct Footer
+{
+    static constexpr char kMagic[8] = {'_', 'B', 'U', 'N', 'D', 'L', 'E', '_'};
+
+    uint64_t payloadOffset = 0;
+    uint64_t payloadSize   = 0;
+    char     magic[8]      = {};
+};
+}  // namespace
+
+namespace bundle
+{
+Result<void> write(const char *vmPath, const uint8_t *payload, size_t size, const char *outputPath)
+{
+    MappedFile vm;
+    auto       openResult = vm.open(vmPath);
+    if (!openResult.isOk())
+    {
+        return openResult.error();
+    }
+    if (find(vm).data != nullptr)
+    {
+        return Error<>(format("'%s' already has a bundled payload", vmPath));
+    }
+
+    FILE *file = nullptr;
+    fopen_s(&file, outputPath, "wb");
+    if (file == nullptr)
+    {
+        return Error<>(format("Failed to open file '%s' for writing", outputPath));
+    }
+
+    Footer footer;
+    footer.payloadOffset = vm.getSize();
+    footer.payloadSize   = size;
+    memcpy(footer.magic, Footer::kMagic, sizeof(footer.magic));
+
+    bool written = fwrite(vm.getData(), 1, vm.getSize(), file) == vm.getSize();
+    written      = written && fwrite(payload, 1, size, file) == size;
+    written      = written && fwrite(&footer, sizeof(footer), 1, file) == 1;
+    if (fclose(file) != 0 || !written)
+    {
+        return Error<>(format("Failed writing to file '%s'", outputPath));
+    }
+
+    std::error_code errorCode;
+    std::filesystem::permissions(outputPath,
+                                 std::filesystem::perms::owner_exec | std::filesystem::perms::group_exec |
+                                     std::filesystem::perms::others_exec,
+                                 std::filesystem::perm_options::add, errorCode);
+    if (errorCode)
+    {
+        return Error<>(format("Failed making '%s' executable", outputPath));
+    }
+    return Result<void>();
+}
+
+Payload find(const MappedFile &executable)
+{
+    if (executable.getSize() < sizeof(Footer))
+    {
+        return Payload{};
+    }
+
+    Footer footer;
+    memcpy(&footer, executable.getData() + executable.getSize() - sizeof(Footer), sizeof(Footer));
+    const uint64_t payloadEnd = executable.getSize() - sizeof(Footer);
+    if (0 != memcmp(footer.magic, Footer::kMagic, sizeof(footer.magic)) || footer.payloadOffset > payloadEnd ||
+        footer.payloadSize != payloadEnd - footer.payloadOffset)
+    {
+        return Payload{};
+    }
+    return Payload{executable.getData() + footer.payloadOffset, static_cast<size_t>(footer.payloadSize)};
+}
+
+std::string getExecutablePath(const char *argv0)
+{
+#if defined(LINUX_OS)
+    std::error_code       errorCode;
+    std::filesystem::path path = std::filesystem::read_symlink("/proc/self/exe", errorCode);
+    if (!errorCode)
+    {
+        return path.string();
+    }
+#endif  // #if defined(LINUX_OS)
+    return argv0;
+}
+}  // namespace bundle
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+#include "utils/common.h"
+#include "utils/mapped_file.h"
+
+// Self-contained executables: a serialized function appended to a copy of the cloxvm binary, followed by a footer
+// locating it. The loader ignores trailing bytes, so the result is still a valid executable, which finds its payload
+// by mapping itself at startup.
+namespace bundle
+{
+struct Payload
+{
+    const uint8_t *data = nullptr;
+    size_t         size = 0;
+};
+
+// writes vmPath + payload + footer into outputPath, made executable
+Result<void> write(const char *vmPath, const uint8_t *payload, size_t size, const char *outputPath);
+
+// payload appended to the mapped executable, empty if there is none
+Payload find(const MappedFile &executable);
+
+// path of the running executable (argv0 where the OS doesn't expose it)
+std::string getExecutablePath(const char *argv0);
+}  // namespace bundle
@@ -0,0 +1,108 @@
+#include "bytecode_cache.h"
+
+#include <filesystem>
+#include <random>
+
+#include "header.h"
+#include "object.h"
+#include "utils/mapped_file.h"
+#include "utils/serde.h"
+
+namespace
+{
+// FNV-1a, 64 bits: collisions between cached scripts are not a concern
+struct KeyHash
+{
+    uint64_t value = 0xcbf29ce484222325ull;
+
+    void add(const void *data, size_t length)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < length; ++i)
+        {
+            value = (value ^ bytes[i]) * 0x100000001b3ull;
+        }
+    }
+    void add(bool flag) { add(&flag, sizeof(flag)); }
+};
+}  // namespace
+
+std::string BytecodeCache::getEntryPath(const char *source, size_t length,
+                                        const Compiler::Configuration &configuration) const
+{
+    KeyHash hash;
+    hash.add(Header::magic, sizeof(Header::magic));
+    hash.add(&VERSION, sizeof(VERSION));
+    // only the settings changing the generated bytecode (the others print or report errors)
+    hash.add(configuration.isREPL);
+    hash.add(configuration.allowDynamicVariables);
+    hash.add(configuration.defaultConstVariables);
+    hash.add(configuration.optimize);
+    hash.add(source, length);
+    return format("%s/%016llx.cloxbin", _directory.c_str(), static_cast<unsigned long long>(hash.value));
+}
+
+Result<ObjectFunction *> BytecodeCache::load(const std::string &entryPath, const char *sourcePath) const
+{
+    MappedFile entry;
+    auto       openResult = entry.open(entryPath.c_str());
+    if (!openResult.isOk())
+    {
+        return openResult.error();
+    }
+
+    // copied out of the mapping, which is released right away
+    ObjectFunction     *function = ObjectFunction::Create(sourcePath);
+    serde::BufferReader reader(entry.getData(), entry.getSize());
+    auto                deserializeResult = function->deserialize(reader);
+    if (!deserializeResult.isOk())
+    {
+        return deserializeResult.error();
+    }
+    auto globalsResult = function->chunk.validateGlobalSlots(function->chunk.getGlobalNames().size());
+    if (!globalsResult.isOk())
+    {
+        return globalsResult.error();
+    }
+    return function;
+}
+
+Result<void> BytecodeCache::store(const std::string &entryPath, const ObjectFunction &function) const
+{
+    serde::BufferWriter writer;
+    auto                serializeResult = function.serialize(writer);
+    if (!serializeResult.isOk())
+    {
+        return serializeResult.error();
+    }
+
+    std::error_code errorCode;
+    std::filesystem::create_directories(_directory, errorCode);
+    if (errorCode)
+    {
+        return Error<>(format("Couldn't create the cache directory '%s'", _directory.c_str()));
+    }
+
+    const std::string tempPath =
+        format("%s.%08x.tmp", entryPath.c_str(), static_cast<unsigned int>(std::random_device()()));
+    FILE             *file     = nullptr;
+    fopen_s(&file, tempPath.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return Error<>(format("Couldn't open '%s' for writing", tempPath.c_str()));
+    }
+    const bool written = fwrite(writer.getData(), 1, writer.getSize(), file) == writer.getSize();
+    if (fclose(file) != 0 || !written)
+    {
+        std::filesystem::remove(tempPath, errorCode);
+        return Error<>(format("Couldn't write '%s'", tempPath.c_str()));
+    }
+
+    std::filesystem::rename(tempPath, entryPath, errorCode);
+    if (errorCode)
+    {
+        std::filesystem::remove(tempPath, errorCode);
+        return Error<>(format("Couldn't rename '%s' to '%s'", tempPath.c_str(), entryPath.c_str()));
+    }
+    return Result<void>();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+#include "compiler.h"
+#include "utils/common.h"
+
+// Disk cache of compiled scripts (similar to __pycache__): each entry is a serialized ObjectFunction named after a
+// hash of the source, the compiler configuration and the bytecode VERSION, so any change to them is a miss.
+// Entries are written to a temp file and renamed, so concurrent runs never read a partial entry.
+struct BytecodeCache
+{
+    explicit BytecodeCache(const char *directory) : _directory(directory) {}
+
+    std::string getEntryPath(const char *source, size_t length, const Compiler::Configuration &configuration) const;
+
+    // error on a miss, also when the entry is unreadable or from another VERSION
+    Result<ObjectFunction *> load(const std::string &entryPath, const char *sourcePath) const;
+    Result<void>             store(const std::string &entryPath, const ObjectFunction &function) const;
+
+   private:
+    std::string _directory;
+};
@@ -1,72 +1,473 @@
 #include "chunk.h"
 #include "header.h"
+#include "object.h"
 #include "utils/serde.h"
+#include <bit>
 #include <cstring>
 
 static const char* CODE_SEG = ".CODE";
 static const char* DATA_SEG = ".DATA";
+static const char* GLOBALS_SEG = ".GLOBALS";
+static const char* LINES_SEG = ".LINES";
+static const char* STRINGS_SEG = ".STRINGS";
 
-Result<void> Chunk::serialize(std::ostream& o_stream) const
+Result<void> Chunk::serialize(serde::BufferWriter& writer) const
 {
     ASSERT_MSG(serde::isLittleEndian(), "not supported, need reverting bytes");
 
-    auto headerResult = writeHeader(o_stream);
+    auto headerResult = writeHeader(writer);
     if (!headerResult.isOk())
     {
         return headerResult.error();
     }
 
-    serde::SerializeN(o_stream, DATA_SEG, strlen(DATA_SEG));
+    // strings first, so they can be pointed at while reading the values referencing them
+    StringPool stringPool;
+    for (const ValueArray* values : {&_constants, &_globalNames})
+    {
+        for (auto valueIt = values->cbegin(); valueIt != values->cend(); ++valueIt)
+        {
+            if (valueIt->is(Value::Type::Object) && valueIt->asObject()->type == Object::Type::String)
+            {
+                stringPool.add(*valueIt->asObject()->asString());
+            }
+        }
+    }
+    serde::SerializeN(writer, STRINGS_SEG, strlen(STRINGS_SEG));
+    serde::SerializeAs<serde::size_t>(writer, stringPool.getSize());
+    serde::SerializeN(writer, stringPool.getChars(), stringPool.getSize());
 
-    serde::SerializeAs<serde::constants_len_t>(o_stream, _constants.size());
+    serde::SerializeN(writer, DATA_SEG, strlen(DATA_SEG));
+
+    serde::SerializeAs<serde::constants_len_t>(writer, _constants.size());
     for (auto constantIt = _constants.cbegin(); constantIt != _constants.cend(); ++constantIt)
     {
-        constantIt->serialize(o_stream);
+        constantIt->serialize(writer, &stringPool);
+    }
+
+    serde::SerializeN(writer, GLOBALS_SEG, strlen(GLOBALS_SEG));
+    serde::SerializeAs<serde::constants_len_t>(writer, _globalNames.size());
+    for (auto globalIt = _globalNames.cbegin(); globalIt != _globalNames.cend(); ++globalIt)
+    {
+        globalIt->serialize(writer, &stringPool);
+    }
+
+    // quickened instructions depend on the values seen by a run, their generic variant is written instead
+    std::vector<opcode_t> code(getCode(), getCode() + getCodeSize());
+    for (codepos_t offset = 0; offset < code.size(); offset += 1 + getOperandBytes(OpCode(code[offset])))
+    {
+        code[offset] = static_cast<opcode_t>(getGenericOpCode(OpCode(code[offset])));
+    }
+    serde::SerializeN(writer, CODE_SEG, strlen(CODE_SEG));
+    serde::SerializeAs<serde::code_len_t>(writer, code.size());
+    if (!code.empty())
+    {
+        serde::SerializeN(writer, code.data(), code.size());
     }
 
-    serde::SerializeN(o_stream, CODE_SEG, strlen(CODE_SEG));
-    serde::SerializeAs<serde::code_len_t>(o_stream, _code.size());
-    if (!_code.empty())
+    // runs delta-encoded as varints: code offset from the previous run, line from the previous one (zig-zag)
+    serde::SerializeN(writer, LINES_SEG, strlen(LINES_SEG));
+    serde::SerializeVarint(writer, static_cast<uint32_t>(_lines.size()));
+    LineRun previous{0, 0};
+    for (const LineRun& run : _lines)
     {
-        serde::SerializeN(o_stream, _code.data(), _code.size());
+        serde::SerializeVarint(writer, run.start - previous.start);
+        serde::SerializeVarint(writer, serde::ZigZagEncode(static_cast<int32_t>(run.line - previous.line)));
+        previous = run;
     }
     return Result<void>();
 }
-Result<void> Chunk::deserialize(std::istream& i_stream)
+Result<void> Chunk::deserialize(serde::BufferReader& reader)
 {
     using len_t = serde::size_t;
     len_t len   = 0;
     char  tempStr[32];
 
-    auto headerResult = readHeader(i_stream);
+    auto headerResult = readHeader(reader);
     if (!headerResult.isOk())
     {
         return headerResult.error();
     }
 
-    serde::DeserializeN(i_stream, tempStr, strlen(DATA_SEG));
+    serde::DeserializeN(reader, tempStr, strlen(STRINGS_SEG));
+    if (0 != strncmp(STRINGS_SEG, tempStr, strlen(STRINGS_SEG)))
+    {
+        FAIL();
+        return Result<void>::error_t(format("STRINGS segment not present\n"));
+    }
+    serde::DeserializeAs<serde::size_t>(reader, len);
+    const char* strings = reinterpret_cast<const char*>(reader.readInPlace(len));
+    if (strings == nullptr)
+    {
+        return Result<void>::error_t(format("STRINGS segment truncated\n"));
+    }
+    // strings not in place are copied when creating their objects
+    const StringPool stringPool(strings, len, reader.isPersistent());
+
+    serde::DeserializeN(reader, tempStr, strlen(DATA_SEG));
     if (0 != strncmp(DATA_SEG, tempStr, strlen(DATA_SEG)))
     {
         FAIL();
         return Result<void>::error_t(format("DATA segment not present\n"));
     }
 
-    serde::DeserializeAs<serde::constants_len_t>(i_stream, len);
+    serde::DeserializeAs<serde::constants_len_t>(reader, len);
+    if (len > reader.getRemaining())
+    {  // values take a byte at least
+        return Result<void>::error_t(format("DATA segment invalid\n"));
+    }
     _constants.resize(len);
     for (auto constantIt = _constants.begin(); constantIt != _constants.end(); ++constantIt)
     {
-        constantIt->deserialize(i_stream);
+        auto constantResult = constantIt->deserialize(reader, &stringPool);
+        if (!constantResult.isOk())
+        {
+            return constantResult.error();
+        }
     }
+    if (!reader.isOk())
+    {
+        return Result<void>::error_t(format("DATA segment truncated\n"));
+    }
+    rebuildConstantIndices();
 
-    serde::DeserializeN(i_stream, tempStr, strlen(CODE_SEG));
+    serde::DeserializeN(reader, tempStr, strlen(GLOBALS_SEG));
+    if (0 != strncmp(GLOBALS_SEG, tempStr, strlen(GLOBALS_SEG)))
+    {
+        FAIL();
+        return Result<void>::error_t(format("GLOBALS segment not present\n"));
+    }
+    serde::DeserializeAs<serde::constants_len_t>(reader, len);
+    if (len > reader.getRemaining())
+    {  // values take a byte at least
+        return Result<void>::error_t(format("GLOBALS segment invalid\n"));
+    }
+    _globalNames.resize(len);
+    for (auto globalIt = _globalNames.begin(); globalIt != _globalNames.end(); ++globalIt)
+    {
+        auto globalResult = globalIt->deserialize(reader, &stringPool);
+        if (!globalResult.isOk())
+        {
+            return globalResult.error();
+        }
+    }
+    if (!reader.isOk())
+    {
+        return Result<void>::error_t(format("GLOBALS segment truncated\n"));
+    }
+    for (const Value& name : _globalNames)
+    {
+        if (!name.is(Value::Type::Object) || name.asObject()->type != Object::Type::String)
+        {
+            return Result<void>::error_t(format("GLOBALS segment invalid\n"));
+        }
+    }
+
+    serde::DeserializeN(reader, tempStr, strlen(CODE_SEG));
     if (0 != strncmp(CODE_SEG, tempStr, strlen(CODE_SEG)))
     {
         FAIL();
         return Result<void>::error_t(format("CODE segment not present\n"));
     }
-    serde::DeserializeAs<serde::code_len_t>(i_stream, len);
-    _code.resize(len);
-    serde::DeserializeN(i_stream, _code.data(), len);
+    serde::DeserializeAs<serde::code_len_t>(reader, len);
+    const opcode_t* code = reader.readInPlace(len);
+    if (code == nullptr)
+    {
+        return Result<void>::error_t(format("CODE segment truncated\n"));
+    }
+    if (reader.isPersistent())
+    {
+        _code.clear();
+        _codeInPlace     = code;
+        _codeInPlaceSize = len;
+    }
+    else
+    {
+        _code.assign(code, code + len);
+    }
+    auto codeResult = validateCode();
+    if (!codeResult.isOk())
+    {
+        return codeResult.error();
+    }
+
+    serde::DeserializeN(reader, tempStr, strlen(LINES_SEG));
+    if (0 != strncmp(LINES_SEG, tempStr, strlen(LINES_SEG)))
+    {
+        FAIL();
+        return Result<void>::error_t(format("LINES segment not present\n"));
+    }
+    const uint32_t runCount = serde::DeserializeVarint(reader);
+    if (runCount > getCodeSize())
+    {  // at most a run per instruction
+        return Result<void>::error_t(format("LINES segment invalid\n"));
+    }
+    _lines.resize(runCount);
+    LineRun previous{0, 0};
+    for (LineRun& run : _lines)
+    {
+        run.start = previous.start + serde::DeserializeVarint(reader);
+        run.line  = previous.line + static_cast<uint32_t>(serde::ZigZagDecode(serde::DeserializeVarint(reader)));
+        previous  = run;
+    }
+    if (!reader.isOk())
+    {
+        return Result<void>::error_t(format("LINES segment truncated\n"));
+    }
+
+    return Result<void>();
+}
+Result<void> Chunk::validateCode() const
+{
+    const opcode_t* code     = getCode();
+    const codepos_t codeSize = getCodeSize();
+
+    // instruction starts, the only offsets jumps can land on
+    std::vector<bool> starts(codeSize + 1, false);
+    for (codepos_t offset = 0; offset < codeSize;)
+    {
+        // the dispatch tables only cover the opcodes up to Undefined, and quickened ones are never written out
+        const OpCode op = OpCode(code[offset]);
+        if (op > OpCode::Undefined)
+        {
+            return Result<void>::error_t(format("Invalid opcode %u at %u\n", code[offset], offset));
+        }
+        if (getGenericOpCode(op) != op)
+        {
+            return Result<void>::error_t(format("Quickened opcode %s at %u\n", named_enum::name(op), offset));
+        }
+        const codepos_t next = offset + 1 + getOperandBytes(op);
+        if (next > codeSize)
+        {
+            return Result<void>::error_t(format("Truncated instruction at %u\n", offset));
+        }
+        starts[offset] = true;
+        offset         = next;
+    }
+    starts[codeSize] = true;
+
+    // operands are used unchecked by the VM, the JIT and the translated code
+    for (codepos_t offset = 0; offset < codeSize;)
+    {
+        const OpCode    op      = OpCode(code[offset]);
+        const uint8_t   bytes   = getOperandBytes(op);
+        const codepos_t next    = offset + 1 + bytes;
+        const uint32_t  operand = readOperand(code + offset + 1, bytes);
+        switch (getShortOpCode(op))
+        {
+            case OpCode::Constant:
+                if (operand >= _constants.size())
+                {
+                    return Result<void>::error_t(format("Constant out of range at %u\n", offset));
+                }
+                break;
+            case OpCode::GlobalVarDef:
+            case OpCode::GlobalVarSet:
+            case OpCode::GlobalVarGet:
+            case OpCode::Assignment:
+                if (operand >= _constants.size())
+                {
+                    return Result<void>::error_t(format("Constant out of range at %u\n", offset));
+                }
+                if (!_constants[operand].is(Value::Type::Object) ||
+                    _constants[operand].asObject()->type != Object::Type::String)
+                {
+                    return Result<void>::error_t(format("Variable name is not a string at %u\n", offset));
+                }
+                break;
+            case OpCode::LocalVarSet:
+            case OpCode::LocalVarGet:
+                if (operand >= limits::kMaxLocals)
+                {
+                    return Result<void>::error_t(format("Local out of range at %u\n", offset));
+                }
+                break;
+            case OpCode::Jump:
+            case OpCode::JumpIfFalse:
+            case OpCode::JumpIfTrue:
+            {
+                const int64_t target = static_cast<int64_t>(next) + readJumpOffset(code + offset + 1, bytes);
+                if (target < 0 || target > codeSize || !starts[static_cast<codepos_t>(target)])
+                {
+                    return Result<void>::error_t(format("Jump out of the code at %u\n", offset));
+                }
+                break;
+            }
+            default: break;
+        }
+        offset = next;
+    }
+    return Result<void>();
+}
 
+Result<void> Chunk::validateGlobalSlots(size_t globalCount) const
+{
+    const opcode_t* code     = getCode();
+    const codepos_t codeSize = getCodeSize();
+    for (codepos_t offset = 0; offset < codeSize;)
+    {
+        const OpCode  op    = OpCode(code[offset]);
+        const uint8_t bytes = getOperandBytes(op);
+        switch (getShortOpCode(getGenericOpCode(op)))
+        {
+            case OpCode::GlobalSlotDef:
+            case OpCode::GlobalSlotSet:
+            case OpCode::GlobalSlotGet:
+                if (readOperand(code + offset + 1, bytes) >= globalCount)
+                {
+                    return Result<void>::error_t(format("Global out of range at %u\n", offset));
+                }
+                break;
+            default: break;
+        }
+        offset += 1 + bytes;
+    }
+    for (auto constantIt = _constants.cbegin(); constantIt != _constants.cend(); ++constantIt)
+    {
+        if (constantIt->is(Value::Type::Object) && constantIt->asObject()->type == Object::Type::Function)
+        {
+            auto functionResult = constantIt->asObject()->asFunction()->chunk.validateGlobalSlots(globalCount);
+            if (!functionResult.isOk())
+            {
+                return functionResult.error();
+            }
+        }
+    }
     return Result<void>();
-}
\ No newline at end of file
+}
+
+void Chunk::rewriteCode(std::vector<opcode_t>&& code, const std::function<codepos_t(codepos_t)>& remapOffset)
+{
+    ASSERT(!isCodeInPlace());
+    // runs left empty (all their code removed) are dropped, neighbours ending up on the same line are merged
+    std::vector<LineRun> lines;
+    lines.reserve(_lines.size());
+    for (const LineRun& run : _lines)
+    {
+        const LineRun newRun{remapOffset(run.start), run.line};
+        while (!lines.empty() && lines.back().start == newRun.start)
+        {
+            lines.pop_back();
+        }
+        if (newRun.start < code.size() && (lines.empty() || lines.back().line != newRun.line))
+        {
+            lines.push_back(newRun);
+        }
+    }
+    _lines = std::move(lines);
+    _code  = std::move(code);
+}
+
+namespace
+{
+// instructions fused by a superinstruction, Undefined past the last one. Longest sequences first.
+struct Superinstruction
+{
+    OpCode op;
+    OpCode sequence[4];
+};
+
+constexpr Superinstruction kSuperinstructions[] = {
+    {OpCode::LocalVarGetConstantLessJumpIfFalse,
+     {OpCode::LocalVarGet, OpCode::Constant, OpCode::Less, OpCode::JumpIfFalse}},
+    {OpCode::LocalVarGetLocalVarGetLessJumpIfFalse,
+     {OpCode::LocalVarGet, OpCode::LocalVarGet, OpCode::Less, OpCode::JumpIfFalse}},
+    {OpCode::LocalVarGetConstantAdd, {OpCode::LocalVarGet, OpCode::Constant, OpCode::Add, OpCode::Undefined}},
+    {OpCode::GlobalSlotSetPop, {OpCode::GlobalSlotSet, OpCode::Pop, OpCode::Undefined, OpCode::Undefined}},
+    {OpCode::LocalVarSetPop, {OpCode::LocalVarSet, OpCode::Pop, OpCode::Undefined, OpCode::Undefined}},
+    {OpCode::PopJump, {OpCode::Pop, OpCode::Jump, OpCode::Undefined, OpCode::Undefined}},
+};
+
+// compact encodings only, the instructions after the first one may be quickened or fused already
+bool matches(const opcode_t* code, codepos_t codeSize, codepos_t offset, const Superinstruction& superinstruction)
+{
+    if (OpCode(code[offset]) != superinstruction.sequence[0])
+    {
+        return false;
+    }
+    codepos_t position = offset;
+    for (OpCode op : superinstruction.sequence)
+    {
+        if (op == OpCode::Undefined)
+        {
+            break;
+        }
+        if (position >= codeSize || getGenericOpCode(OpCode(code[position])) != op)
+        {
+            return false;
+        }
+        position += 1 + getOperandBytes(op);
+    }
+    ASSERT(position - offset == getSuperinstructionLength(superinstruction.op));
+    return position <= codeSize;
+}
+}  // namespace
+
+size_t Chunk::fuseSuperinstructions() const
+{
+    const opcode_t* code     = getCode();
+    const codepos_t codeSize = getCodeSize();
+
+    size_t fused = 0;
+    for (codepos_t offset = 0; offset < codeSize; offset += 1 + getOperandBytes(OpCode(code[offset])))
+    {
+        for (const Superinstruction& superinstruction : kSuperinstructions)
+        {
+            if (matches(code, codeSize, offset, superinstruction))
+            {
+                quicken(offset, superinstruction.op);
+                ++fused;
+                break;
+            }
+        }
+    }
+    return fused;
+}
+
+void Chunk::rebuildConstantIndices()
+{
+    _constantIndices.clear();
+    _constantIndices.reserve(_constants.size());
+    for (size_t i = 0; i < _constants.size(); ++i)
+    {
+        _constantIndices.try_emplace(_constants[i], static_cast<int>(i));
+    }
+}
+
+size_t Chunk::ConstantHash::operator()(const Value& value) const
+{
+    uint64_t payload = 0;
+    switch (value.getType())
+    {
+        case Value::Type::Bool: payload = value.asBool(); break;
+        case Value::Type::Number: payload = std::bit_cast<uint64_t>(value.asNumber()); break;
+        case Value::Type::Integer: payload = static_cast<uint64_t>(value.asInteger()); break;
+        case Value::Type::Object:
+            payload = value.asObject()->type == Object::Type::String
+                          ? value.asObject()->asString()->hash
+                          : reinterpret_cast<uintptr_t>(value.asObject());
+            break;
+        default: break;
+    }
+    // mix the type in and spread the payload bits (i.e., small integral doubles only differ in the high bits)
+    payload ^= static_cast<uint64_t>(value.getType()) << 56;
+    payload *= 0x9e3779b97f4a7c15ull;
+    return static_cast<size_t>(payload ^ (payload >> 32));
+}
+
+bool Chunk::ConstantEqual::operator()(const Value& a, const Value& b) const
+{
+    if (a.getType() != b.getType())
+    {
+        return false;
+    }
+    switch (a.getType())
+    {
+        case Value::Type::Bool: return a.asBool() == b.asBool();
+        case Value::Type::Number:
+            return std::bit_cast<uint64_t>(a.asNumber()) == std::bit_cast<uint64_t>(b.asNumber());
+        case Value::Type::Integer: return a.asInteger() == b.asInteger();
+        case Value::Type::Object: return a.asObject() == b.asObject();
+        default: return true;
+    }
+}
@@ -1,12 +1,28 @@
 #pragma once
 
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "third_party/named_enum.hpp"
 #include "utils/common.h"
 #include "value.h"
 
+namespace jit
+{
+struct Code;
+}  // namespace jit
+namespace threaded
+{
+struct Code;
+}  // namespace threaded
+namespace reg
+{
+struct Code;
+}  // namespace reg
+
 MAKE_NAMED_ENUM_CLASS_WITH_TYPE(OpCode, uint8_t, Return, Constant,
 
                                 // Literal ops
@@ -17,6 +33,8 @@ MAKE_NAMED_ENUM_CLASS_WITH_TYPE(OpCode, uint8_t, Return, Constant,
 
                                 // Binary ops
                                 Assignment, Equal, Greater, Less,
+                                // Fused comparisons (emitted by the peephole optimizer)
+                                NotEqual, GreaterEqual, LessEqual,
 
                                 // Arithmetic
                                 Add, Subtract, Multiply, Divide,
@@ -24,8 +42,10 @@ MAKE_NAMED_ENUM_CLASS_WITH_TYPE(OpCode, uint8_t, Return, Constant,
                                 // Core methods
                                 Print,
 
-                                // Global vars
+                                // Global vars (by name, for dynamic variables/REPL)
                                 GlobalVarDef, GlobalVarSet, GlobalVarGet,
+                                // Global vars (by slot in the module globals table)
+                                GlobalSlotDef, GlobalSlotSet, GlobalSlotGet,
                                 // Local vars
                                 LocalVarSet, LocalVarGet,
 
@@ -38,9 +58,191 @@ MAKE_NAMED_ENUM_CLASS_WITH_TYPE(OpCode, uint8_t, Return, Constant,
 
                                 ScopeBegin, ScopeEnd,
 
+                                // functions
+                                Call,
+
+                                // 24-bit index/32-bit offset variants, only emitted past the compact encoding limits
+                                ConstantLong, GlobalVarDefLong, GlobalVarSetLong, GlobalVarGetLong, GlobalSlotDefLong,
+                                GlobalSlotSetLong, GlobalSlotGetLong, LocalVarSetLong, LocalVarGetLong, JumpLong,
+                                JumpIfFalseLong, JumpIfTrueLong,
+
+                                // type-specialized variants, rewritten in place by the VM on first execution (quickening)
+                                // from the operand types seen, never serialized
+                                AddNumber, AddString, SubtractNumber, MultiplyNumber, DivideNumber, EqualNumber,
+                                NotEqualNumber, GreaterNumber, LessNumber, GreaterEqualNumber, LessEqualNumber,
+                                AddInteger, SubtractInteger, MultiplyInteger, EqualInteger, NotEqualInteger,
+                                GreaterInteger, LessInteger, GreaterEqualInteger, LessEqualInteger,
+
+                                // superinstructions, rewritten in place by the VM on load over the first instruction of
+                                // a frequent sequence, whose other instructions are kept (see
+                                // Chunk::fuseSuperinstructions), never serialized
+                                LocalVarGetConstantAdd, LocalVarGetConstantLessJumpIfFalse,
+                                LocalVarGetLocalVarGetLessJumpIfFalse, GlobalSlotSetPop, LocalVarSetPop, PopJump,
+
                                 Undefined  // = 0x0FF
 );
 
+// bytes following the opcode
+inline uint8_t getOperandBytes(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::Constant:
+        case OpCode::Assignment:
+        case OpCode::GlobalVarDef:
+        case OpCode::GlobalVarSet:
+        case OpCode::GlobalVarGet:
+        case OpCode::GlobalSlotDef:
+        case OpCode::GlobalSlotSet:
+        case OpCode::GlobalSlotGet:
+        case OpCode::LocalVarSet:
+        case OpCode::LocalVarGet:
+        case OpCode::Call:
+        case OpCode::LocalVarGetConstantAdd:
+        case OpCode::LocalVarGetConstantLessJumpIfFalse:
+        case OpCode::LocalVarGetLocalVarGetLessJumpIfFalse:
+        case OpCode::GlobalSlotSetPop:
+        case OpCode::LocalVarSetPop: return 1;
+        case OpCode::Jump:
+        case OpCode::JumpIfFalse:
+        case OpCode::JumpIfTrue: return sizeof(jump_t);
+        case OpCode::ConstantLong:
+        case OpCode::GlobalVarDefLong:
+        case OpCode::GlobalVarSetLong:
+        case OpCode::GlobalVarGetLong:
+        case OpCode::GlobalSlotDefLong:
+        case OpCode::GlobalSlotSetLong:
+        case OpCode::GlobalSlotGetLong:
+        case OpCode::LocalVarSetLong:
+        case OpCode::LocalVarGetLong: return limits::kLongOperandBytes;
+        case OpCode::JumpLong:
+        case OpCode::JumpIfFalseLong:
+        case OpCode::JumpIfTrueLong: return sizeof(jump_long_t);
+        default: return 0;
+    }
+}
+
+// *Long variant of an opcode with an operand, Undefined if there is none
+inline OpCode getLongOpCode(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::Constant: return OpCode::ConstantLong;
+        case OpCode::GlobalVarDef: return OpCode::GlobalVarDefLong;
+        case OpCode::GlobalVarSet: return OpCode::GlobalVarSetLong;
+        case OpCode::GlobalVarGet: return OpCode::GlobalVarGetLong;
+        case OpCode::GlobalSlotDef: return OpCode::GlobalSlotDefLong;
+        case OpCode::GlobalSlotSet: return OpCode::GlobalSlotSetLong;
+        case OpCode::GlobalSlotGet: return OpCode::GlobalSlotGetLong;
+        case OpCode::LocalVarSet: return OpCode::LocalVarSetLong;
+        case OpCode::LocalVarGet: return OpCode::LocalVarGetLong;
+        case OpCode::Jump: return OpCode::JumpLong;
+        case OpCode::JumpIfFalse: return OpCode::JumpIfFalseLong;
+        case OpCode::JumpIfTrue: return OpCode::JumpIfTrueLong;
+        default: return OpCode::Undefined;
+    }
+}
+
+// compact variant of a *Long opcode, the opcode itself otherwise
+inline OpCode getShortOpCode(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::ConstantLong: return OpCode::Constant;
+        case OpCode::GlobalVarDefLong: return OpCode::GlobalVarDef;
+        case OpCode::GlobalVarSetLong: return OpCode::GlobalVarSet;
+        case OpCode::GlobalVarGetLong: return OpCode::GlobalVarGet;
+        case OpCode::GlobalSlotDefLong: return OpCode::GlobalSlotDef;
+        case OpCode::GlobalSlotSetLong: return OpCode::GlobalSlotSet;
+        case OpCode::GlobalSlotGetLong: return OpCode::GlobalSlotGet;
+        case OpCode::LocalVarSetLong: return OpCode::LocalVarSet;
+        case OpCode::LocalVarGetLong: return OpCode::LocalVarGet;
+        case OpCode::JumpLong: return OpCode::Jump;
+        case OpCode::JumpIfFalseLong: return OpCode::JumpIfFalse;
+        case OpCode::JumpIfTrueLong: return OpCode::JumpIfTrue;
+        default: return op;
+    }
+}
+
+// generic instruction a quickened one was specialized from (first of the fused sequence for a superinstruction), the
+// opcode itself otherwise
+inline OpCode getGenericOpCode(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::AddNumber:
+        case OpCode::AddInteger:
+        case OpCode::AddString: return OpCode::Add;
+        case OpCode::SubtractNumber:
+        case OpCode::SubtractInteger: return OpCode::Subtract;
+        case OpCode::MultiplyNumber:
+        case OpCode::MultiplyInteger: return OpCode::Multiply;
+        case OpCode::DivideNumber: return OpCode::Divide;
+        case OpCode::EqualNumber:
+        case OpCode::EqualInteger: return OpCode::Equal;
+        case OpCode::NotEqualNumber:
+        case OpCode::NotEqualInteger: return OpCode::NotEqual;
+        case OpCode::GreaterNumber:
+        case OpCode::GreaterInteger: return OpCode::Greater;
+        case OpCode::LessNumber:
+        case OpCode::LessInteger: return OpCode::Less;
+        case OpCode::GreaterEqualNumber:
+        case OpCode::GreaterEqualInteger: return OpCode::GreaterEqual;
+        case OpCode::LessEqualNumber:
+        case OpCode::LessEqualInteger: return OpCode::LessEqual;
+        case OpCode::LocalVarGetConstantAdd:
+        case OpCode::LocalVarGetConstantLessJumpIfFalse:
+        case OpCode::LocalVarGetLocalVarGetLessJumpIfFalse: return OpCode::LocalVarGet;
+        case OpCode::GlobalSlotSetPop: return OpCode::GlobalSlotSet;
+        case OpCode::LocalVarSetPop: return OpCode::LocalVarSet;
+        case OpCode::PopJump: return OpCode::Pop;
+        default: return op;
+    }
+}
+
+// bytes of the sequence a superinstruction runs at once, from its opcode up to the next instruction, 0 for others
+inline uint8_t getSuperinstructionLength(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::LocalVarGetConstantAdd: return 5;                 // LocalVarGet; Constant; Add
+        case OpCode::LocalVarGetConstantLessJumpIfFalse: return 8;     // LocalVarGet; Constant; Less; JumpIfFalse
+        case OpCode::LocalVarGetLocalVarGetLessJumpIfFalse: return 8;  // LocalVarGet; LocalVarGet; Less; JumpIfFalse
+        case OpCode::GlobalSlotSetPop:                                  // GlobalSlotSet; Pop
+        case OpCode::LocalVarSetPop: return 3;                          // LocalVarSet; Pop
+        case OpCode::PopJump: return 4;                                 // Pop; Jump
+        default: return 0;
+    }
+}
+
+inline bool fitsShortJump(int64_t jump) { return jump >= INT16_MIN && jump <= INT16_MAX; }
+
+// operands are stored big-endian, jumps as two's complement
+inline uint32_t readOperand(const opcode_t* operand, uint8_t bytes)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bytes; ++i)
+    {
+        value = (value << 8) | operand[i];
+    }
+    return value;
+}
+
+inline void writeOperand(opcode_t* operand, uint8_t bytes, uint32_t value)
+{
+    for (uint8_t i = bytes; i > 0; --i)
+    {
+        operand[i - 1] = static_cast<opcode_t>(value & 0xff);
+        value >>= 8;
+    }
+}
+
+inline int32_t readJumpOffset(const opcode_t* operand, uint8_t bytes)
+{
+    const uint32_t value = readOperand(operand, bytes);
+    return bytes == sizeof(jump_t) ? static_cast<jump_t>(value) : static_cast<jump_long_t>(value);
+}
+
 struct Chunk
 {
     using ValueArray = RandomAccessContainer<Value>;
@@ -54,71 +256,144 @@ struct Chunk
     Chunk& operator=(Chunk&&)      = delete;
     Chunk& operator=(const Chunk&) = delete;
 
-    Result<void> serialize(std::ostream& o_stream) const;
-    Result<void> deserialize(std::istream& i_stream);
+    Result<void> serialize(serde::BufferWriter& writer) const;
+    // from a persistent reader the code and the strings are used in place instead of copied (the buffer has to
+    // outlive the chunk and its strings, and be writable for quickening)
+    Result<void> deserialize(serde::BufferReader& reader);
+    // the global slots of a function index the globals of the script it was compiled in, so they are only checked
+    // once the script is loaded, on it and the functions in its constants (recursively)
+    Result<void> validateGlobalSlots(size_t globalCount) const;
 
     const char* getSourcePath() const { return _sourcepath.c_str(); }
 
-    opcode_t* getCodeMut() { return _code.data(); }
+    opcode_t* getCodeMut()
+    {
+        ASSERT(!isCodeInPlace());
+        return _code.data();
+    }
 
-    const opcode_t* getCode() const { return _code.data(); }
+    const opcode_t* getCode() const { return _codeInPlace ? _codeInPlace : _code.data(); }
 
-    codepos_t getCodeSize() const { return static_cast<codepos_t>(_code.size()); }
+    codepos_t getCodeSize() const { return _codeInPlace ? _codeInPlaceSize : static_cast<codepos_t>(_code.size()); }
 
-    size_t getLine(codepos_t codePos) const
+    // code used from a deserialized image, only rewritten by quickening
+    bool isCodeInPlace() const { return _codeInPlace != nullptr; }
+
+    // replaces the opcode at codePos with a type-specialized variant or a superinstruction (see getGenericOpCode),
+    // taking the same operands and behaving the same. Allowed on const chunks and on code used in place (mapped
+    // copy-on-write).
+    void quicken(codepos_t codePos, OpCode op) const
     {
-        size_t line = 0;
-        if (_lines.empty())
-        {
-            return 0;
-        }
+        ASSERT(codePos < getCodeSize() && getGenericOpCode(op) == getGenericOpCode(OpCode(getCode()[codePos])));
+        const_cast<opcode_t*>(getCode())[codePos] = static_cast<opcode_t>(op);
+    }
 
-        while (_lines[line] < codePos)
-        {
-            ++line;
-        }
-        return line;
+    // rewrites the first instruction of the frequent sequences (picked from the n-grams of `cloxc -profile`) into the
+    // superinstruction running the whole sequence with a single dispatch, through quicken. The other instructions are
+    // kept, so jumps landing among them and the readers of the code going through getGenericOpCode (JIT, threaded and
+    // register code, serialization) still see the generic sequence. Returns the number of sequences fused.
+    size_t fuseSuperinstructions() const;
+
+    // machine code compiled by the VM once the chunk gets hot (see jit.h), like quickening allowed on const chunks
+    struct JitState
+    {
+        uint32_t                   hotness     = 0;  // calls and loop back-edges seen
+        bool                       failed      = false;
+        std::shared_ptr<jit::Code> code;
+        size_t                     globalCount = 0;  // size of the globals table the code was compiled for
+    };
+    JitState& getJitState() const { return _jitState; }
+
+    // pre-decoded code run by VirtualMachine::runThreaded, built on first entry (see threaded_code.h)
+    std::shared_ptr<threaded::Code>& getThreadedCode() const { return _threadedCode; }
+
+    // register code run by VirtualMachine::runRegisters, translated at load time (see register_code.h)
+    std::shared_ptr<reg::Code>& getRegisterCode() const { return _registerCode; }
+
+    // code from start up to the next run comes from the same source line
+    struct LineRun
+    {
+        codepos_t start;
+        uint32_t  line;
+    };
+
+    size_t getLine(codepos_t codePos) const
+    {
+        auto runIt = std::upper_bound(_lines.begin(), _lines.end(), codePos,
+                                      [](codepos_t pos, const LineRun& run) { return pos < run.start; });
+        return runIt == _lines.begin() ? 0 : std::prev(runIt)->line;
     }
 
+    // number of line runs, 0 if there is no line info
     size_t getLineCount() const { return _lines.size(); }
 
     const ValueArray& getConstants() const { return _constants; }
 
+    // module globals table: names of the globals resolved to slots at compile time
+    const ValueArray& getGlobalNames() const { return _globalNames; }
+
+    int addGlobal(const Value& name)
+    {
+        _globalNames.write(name);
+        return static_cast<int>(_globalNames.size()) - 1;
+    }
+
     void init()
     {
+        _codeInPlace     = nullptr;
+        _codeInPlaceSize = 0;
         _code.clear();
         _lines.clear();
+        _jitState = JitState{};
+        _threadedCode.reset();
+        _registerCode.reset();
     }
 
-    void write(OpCode code, size_t line) { write((uint8_t)code, line); }
+    void write(OpCode code, uint32_t line) { write((uint8_t)code, line); }
+
+    // replaces the code after a rewrite (i.e., optimization passes), remapOffset translates offsets in the old code
+    // into the new one to keep the lines in sync
+    void rewriteCode(std::vector<opcode_t>&& code, const std::function<codepos_t(codepos_t)>& remapOffset);
 
-    void write(uint8_t byte, size_t line)
+    // drops the code from codeSize on and the constants from constantCount on (i.e., replaced by a folded constant)
+    void truncate(codepos_t codeSize, size_t constantCount)
     {
-        _code.push_back(byte);
-        if (_lines.size() > line)
+        ASSERT(!isCodeInPlace() && codeSize <= _code.size() && constantCount <= _constants.size());
+        _code.resize(codeSize);
+        while (!_lines.empty() && _lines.back().start >= codeSize)
+        {
+            _lines.pop_back();
+        }
+        for (size_t i = constantCount; i < _constants.size(); ++i)
         {
-            _lines.back() = static_cast<uint16_t>(_code.size());
+            _constantIndices.erase(_constants[i]);
         }
-        else
+        _constants.resize(constantCount);
+    }
+
+    void write(uint8_t byte, uint32_t line)
+    {
+        ASSERT(!isCodeInPlace());
+        if (_lines.empty() || _lines.back().line != line)
         {
-            _lines.push_back(static_cast<uint16_t>(_code.size()));
+            _lines.push_back(LineRun{static_cast<codepos_t>(_code.size()), line});
         }
+        _code.push_back(byte);
     }
 
     int addConstant(const Value& value)
     {
-        ASSERT_MSG(_constants.size() <= MAX_OPCODE_VALUE,
-                   format("#constants(%d) > MaxConstants(%d)\n", _constants.size(), MAX_OPCODE_VALUE).c_str());
-        auto constantIt = std::find_if(_constants.begin(), _constants.end(),
-                                       [&value](const Value& constant) { return constant == value; });
-        if (constantIt != _constants.end())
+        ASSERT_MSG(_constants.size() <= limits::kMaxLongOperand,
+                   format("#constants(%zu) > MaxConstants(%zu)\n", _constants.size(), limits::kMaxLongOperand).c_str());
+        const int constantIndex     = static_cast<int>(_constants.size());
+        auto [constantIt, inserted] = _constantIndices.try_emplace(value, constantIndex);
+        if (!inserted)
         {
-            const ptrdiff_t constantIndex = std::distance(_constants.begin(), constantIt);
-            return static_cast<int>(constantIndex);
+            return constantIt->second;
         }
 
         _constants.write(value);
-        return static_cast<int>(_constants.size()) - 1;
+        return constantIndex;
     }
 
 #if DEBUG_TRACE_EXECUTION
@@ -143,8 +418,32 @@ struct Chunk
 #endif  // #if DEBUG_TRACE_EXECUTION
 
    protected:
-    std::string           _sourcepath;
-    std::vector<opcode_t> _code;
-    std::vector<uint16_t> _lines;
-    ValueArray            _constants;
+    // rejects code the VM cannot run as is: unknown or quickened opcodes, truncated instructions, constants and locals
+    // out of range, jumps not landing on an instruction
+    Result<void> validateCode() const;
+
+    void rebuildConstantIndices();
+
+    // constants are deduplicated by identity: type and payload bits (strings are interned, so their pointers)
+    struct ConstantHash
+    {
+        size_t operator()(const Value& value) const;
+    };
+    struct ConstantEqual
+    {
+        bool operator()(const Value& a, const Value& b) const;
+    };
+
+    std::string            _sourcepath;
+    std::vector<opcode_t>  _code;
+    const opcode_t*        _codeInPlace     = nullptr;
+    codepos_t              _codeInPlaceSize = 0;
+    std::vector<LineRun>   _lines;  // sorted by start
+    ValueArray             _constants;
+    ValueArray             _globalNames;
+    mutable JitState       _jitState;
+    mutable std::shared_ptr<threaded::Code> _threadedCode;
+    mutable std::shared_ptr<reg::Code>      _registerCode;
+
+    std::unordered_map<Value, int, ConstantHash, ConstantEqual> _constantIndices;  // constant -> index in _constants
 };
\ No newline at end of file
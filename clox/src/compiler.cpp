@@ -1,4 +1,7 @@
 #include "compiler.h"
+#include "optimizer.h"
+
+#include <cerrno>
 
 Compiler::result_t Compiler::compile(const char *source, const char *sourcePath,
                                      const Optional<Configuration> &optConfiguration)
@@ -12,13 +15,24 @@ Compiler::result_t Compiler::compile(const char *source, const char *sourcePath,
     _scanner.init(source);
     ScopedCallback onExit([&] { _scanner.finish(); });
 
-    _function = ObjectFunction::Create(sourcePath);
-    _functionType = FunctionType::Script;
+    _enclosingFunctions.clear();
+    beginFunction(ObjectFunction::Create(sourcePath), FunctionType::Script);
+    // the functions in progress (and the constants they reference) must survive collections while compiling
+    GarbageCollector::addRoots(this,
+                               [this]
+                               {
+                                   GarbageCollector::markObject(_function);
+                                   for (const FunctionState &enclosing : _enclosingFunctions)
+                                   {
+                                       GarbageCollector::markObject(enclosing.function);
+                                   }
+                               });
+    ScopedCallback removeRoots([this] { GarbageCollector::removeRoots(this); });
 
     _parser.optError.reset();
     _parser.panicMode = false;
     _parser.hadError  = false;
-    _localState       = LocalState{};
+    _globalSlots.clear();
 
     advance();
     while (!isAtEnd())
@@ -51,6 +65,10 @@ void Compiler::declaration()
     {
         variableDeclaration();
     }
+    else if (match(TokenType::Func))
+    {
+        functionDeclaration();
+    }
     else
     {
         statement();
@@ -88,11 +106,15 @@ void Compiler::statement()
     {
         forStatement();
     }
+    else if (match(TokenType::Return))
+    {
+        returnStatement();
+    }
     else if (match(TokenType::Break))
     {
         if (_loopContext.isInLoop())
         {
-            emitBytes(OpCode::ScopeEnd);
+            emitPopLocals(_loopContext.getScopeDepth());
             const codepos_t jump = emitJump(OpCode::Jump);
             _loopContext.addBreak(jump);
         }
@@ -105,7 +127,7 @@ void Compiler::statement()
     {
         if (_loopContext.isInLoop())
         {
-            emitBytes(OpCode::ScopeEnd);
+            emitPopLocals(_loopContext.getScopeDepth());
             const codepos_t jump = emitJump(OpCode::Jump);
             _loopContext.addContinue(jump);
         }
@@ -136,9 +158,8 @@ void Compiler::printStatement()
     emitBytes(OpCode::Print);
 }
 
-void Compiler::blockStatement()
+void Compiler::block()
 {
-    beginScope();
     while (!check(TokenType::RightBrace) && !isAtEnd())
     {
         declaration();
@@ -146,6 +167,12 @@ void Compiler::blockStatement()
 
     consume(TokenType::RightBrace, "Expect '}' after value");
     CMP_DEBUGPRINT_PARSE(3);
+}
+
+void Compiler::blockStatement()
+{
+    beginScope();
+    block();
     endScope();
 }
 
@@ -174,7 +201,7 @@ void Compiler::ifStatement()
 void Compiler::whileStatement()
 {
     const codepos_t loopStart = currentChunk().getCodeSize();
-    _loopContext.loopStart(loopStart);
+    _loopContext.loopStart(loopStart, _localState.scopeDepth);
 
     consume(TokenType::LeftParen, "Expected '(' after 'while'.");
     expression();
@@ -195,7 +222,7 @@ void Compiler::whileStatement()
 
 void Compiler::dowhileStatement()
 {
-    _loopContext.loopStart(codepos_t(-1));
+    _loopContext.loopStart(codepos_t(-1), _localState.scopeDepth);
 
     const codepos_t doJump = emitJump(OpCode::Jump);
 
@@ -260,7 +287,7 @@ void Compiler::forStatement()
         patchJump(bodyJump);
     }
 
-    _loopContext.loopStart(loopStart);
+    _loopContext.loopStart(loopStart, _localState.scopeDepth);
 
     //> body
     statement();
@@ -273,7 +300,7 @@ void Compiler::forStatement()
     }
 
     _loopContext.setLoopEnd(currentChunk().getCodeSize());
-    _loopContext.loopEnd(std::bind(&Compiler::patchJump, this, std::placeholders::_1));
+    _loopContext.loopEnd(std::bind(&Compiler::patchJumpEx, this, std::placeholders::_1, std::placeholders::_2));
 
     endScope();
 }
@@ -285,6 +312,24 @@ void Compiler::expressionStatement()
     emitBytes(OpCode::Pop);
 }
 
+void Compiler::returnStatement()
+{
+    if (_functionType == FunctionType::Script)
+    {
+        error("Can't return from top-level code.");
+    }
+
+    if (match(TokenType::Semicolon))
+    {
+        emitReturn();
+        return;
+    }
+    expression();
+    consume(TokenType::Semicolon, "Expected ';' after return value.");
+    // locals don't need popping, the frame is discarded as a whole
+    emitBytes(OpCode::Return);
+}
+
 /////////////////////////////////////////////////////////////////////////////////
 
 void Compiler::expression()
@@ -321,7 +366,13 @@ void Compiler::namedVariable(const Token &name, bool canAssign)
     int    varId     = resolveLocalVariable(name);
     OpCode setOpCode = OpCode::LocalVarSet;
     OpCode getOpCode = OpCode::LocalVarGet;
-    if (varId == -1)
+    if (varId == -1 && useGlobalSlots())
+    {
+        varId     = resolveGlobalVariable(name);
+        setOpCode = OpCode::GlobalSlotSet;
+        getOpCode = OpCode::GlobalSlotGet;
+    }
+    else if (varId == -1)
     {
         varId     = identifierConstant(name);
         setOpCode = OpCode::GlobalVarSet;
@@ -332,11 +383,11 @@ void Compiler::namedVariable(const Token &name, bool canAssign)
     if (canAssign && match(TokenType::Equal))
     {
         expression();
-        emitBytes(setOpCode, static_cast<uint8_t>(varId));
+        emitInstruction(setOpCode, static_cast<uint32_t>(varId));
     }
     else
     {
-        emitBytes(getOpCode, static_cast<uint8_t>(varId));
+        emitInstruction(getOpCode, static_cast<uint32_t>(varId));
     }
 }
 
@@ -346,9 +397,9 @@ void Compiler::literal()
 
     switch (_parser.previous.type)
     {
-        case TokenType::Null: emitBytes(OpCode::Null); break;
-        case TokenType::False: emitBytes(OpCode::False); break;
-        case TokenType::True: emitBytes(OpCode::True); break;
+        case TokenType::Null: emitConstantExpression(Value::Create(Value::Null)); break;
+        case TokenType::False: emitConstantExpression(Value::Create(false)); break;
+        case TokenType::True: emitConstantExpression(Value::Create(true)); break;
         default: ASSERT(false); return;
     }
 }
@@ -357,20 +408,86 @@ void Compiler::number()
 {
     CMP_DEBUGPRINT_PARSE(3);
 
-    const Value value = Value::Create(strtod(_parser.previous.start, nullptr));
-    emitConstant(value);
+    // integer literals too large for an Integer become a Number, like the results of integer arithmetic
+    if (_parser.previous.type == TokenType::Number)
+    {
+        errno                = 0;
+        const int64_t number = strtoll(_parser.previous.start, nullptr, 10);
+        if (errno != ERANGE && Value::fitsInteger(number))
+        {
+            emitConstantExpression(Value::Create(number));
+            return;
+        }
+    }
+    emitConstantExpression(Value::Create(strtod(_parser.previous.start, nullptr)));
 }
 
-void Compiler::string() { emitConstant(Value::CreateByCopy(_parser.previous.start, _parser.previous.length)); }
+void Compiler::string()
+{
+    emitConstantExpression(Value::CreateByCopy(_parser.previous.start, _parser.previous.length));
+}
+
+namespace
+{
+bool isString(const Value &value)
+{
+    return value.is(Value::Type::Object) && value.asObject()->type == Object::Type::String;
+}
+
+// result of the operator at compile time, Undefined when it has to be left to the runtime (i.e., it would fail)
+Value foldUnary(TokenType operatorType, const Value &value)
+{
+    switch (operatorType)
+    {
+        case TokenType::Minus: return value.isNumber() ? -value : Value::Create();
+        case TokenType::Bang: return Value::Create(value.isFalsey());
+        default: return Value::Create();
+    }
+}
+
+Value foldBinary(TokenType operatorType, const Value &a, const Value &b)
+{
+    const bool numbers   = a.isNumber() && b.isNumber();
+    const bool strings   = isString(a) && isString(b);
+    const bool orderable = numbers || strings;
+    switch (operatorType)
+    {
+        case TokenType::Plus: return orderable ? a + b : Value::Create();
+        case TokenType::Minus: return numbers ? a - b : Value::Create();
+        case TokenType::Star: return numbers ? a * b : Value::Create();
+        case TokenType::Slash: return numbers ? a / b : Value::Create();
+
+        case TokenType::BangEqual: return Value::Create(!(a == b));
+        case TokenType::EqualEqual: return Value::Create(a == b);
+        case TokenType::Greater: return orderable ? Value::Create(a > b) : Value::Create();
+        case TokenType::GreaterEqual: return orderable ? Value::Create(!(a < b)) : Value::Create();
+        case TokenType::Less: return orderable ? Value::Create(a < b) : Value::Create();
+        case TokenType::LessEqual: return orderable ? Value::Create(!(a > b)) : Value::Create();
+        default: return Value::Create();
+    }
+}
+}  // namespace
 
 void Compiler::unary()
 {
     CMP_DEBUGPRINT_PARSE(3);
     const TokenType operatorType = _parser.previous.type;
+    const codepos_t operandStart = currentChunk().getCodeSize();
 
     // parse expression
     parsePrecedence(Precedence::UNARY);
 
+    ConstantExpression operand;
+    if (canFoldConstants() && getTrailingConstant(operand) && operand.start == operandStart)
+    {
+        const Value folded = foldUnary(operatorType, operand.value);
+        if (!folded.is(Value::Type::Undefined))
+        {
+            replaceWithConstant(operand, folded);
+            return;
+        }
+    }
+
     // Emit the operator instruction.
     switch (operatorType)
     {
@@ -388,10 +505,25 @@ void Compiler::binary()
 
     const TokenType operatorType = _parser.previous.type;
     const ParseRule parseRule    = getParseRule(operatorType);
+
+    ConstantExpression left;
+    const bool         isLeftConstant = canFoldConstants() && getTrailingConstant(left);
+
     // left-associative: 1+2+3+4 = ((1 + 2) + 3) + 4
     // right-associative: a=b=c=d -> a = (b = (c = d))
     parsePrecedence(Precedence(static_cast<uint8_t>(parseRule.precedence) + 1));
 
+    ConstantExpression right;
+    if (isLeftConstant && getTrailingConstant(right) && right.start == left.end)
+    {
+        const Value folded = foldBinary(operatorType, left.value, right.value);
+        if (!folded.is(Value::Type::Undefined))
+        {
+            replaceWithConstant(left, folded);
+            return;
+        }
+    }
+
     switch (operatorType)
     {
         case TokenType::Plus: emitBytes(OpCode::Add); break;
@@ -402,7 +534,7 @@ void Compiler::binary()
         case TokenType::BangEqual: emitBytes(OpCode::Equal, OpCode::Not); break;
         case TokenType::EqualEqual: emitBytes(OpCode::Equal); break;
         case TokenType::Greater: emitBytes(OpCode::Greater); break;
-        case TokenType::GreaterEqual: emitBytes(OpCode::Equal, OpCode::Not); break;
+        case TokenType::GreaterEqual: emitBytes(OpCode::Less, OpCode::Not); break;
         case TokenType::Less: emitBytes(OpCode::Less); break;
         case TokenType::LessEqual: emitBytes(OpCode::Greater, OpCode::Not); break;
         case TokenType::Equal: emitBytes(OpCode::Assignment); break;
@@ -412,11 +544,49 @@ void Compiler::binary()
     }
 }
 
+void Compiler::logical(OpCode jumpOpCode, Precedence precedence)
+{
+    CMP_DEBUGPRINT_PARSE(3);
+
+    // a constant left operand decides at compile time which operand is the result
+    ConstantExpression left;
+    if (canFoldConstants() && getTrailingConstant(left))
+    {
+        const bool shortCircuits = left.value.isFalsey() == (jumpOpCode == OpCode::JumpIfFalse);
+        if (!shortCircuits)
+        {
+            truncateCode(left.start, left.constantCount);
+            parsePrecedence(precedence);
+            return;
+        }
+        // the right operand is parsed and dropped, unless it declares locals that need their stack slots
+        const size_t    constantCount = currentChunk().getConstants().size();
+        const int       localCount    = _localState.localCount;
+        const codepos_t endJump       = emitJump(jumpOpCode);
+        emitBytes(OpCode::Pop);
+        parsePrecedence(precedence);
+        if (_localState.localCount == localCount)
+        {
+            truncateCode(left.end, constantCount);
+            _lastConstant    = left;
+            _hasLastConstant = true;
+            return;
+        }
+        patchJump(endJump);
+        return;
+    }
+
+    const codepos_t endJump = emitJump(jumpOpCode);
+    emitBytes(OpCode::Pop);
+    parsePrecedence(precedence);
+    patchJump(endJump);
+}
+
 void Compiler::variableDeclaration()
 {
     CMP_DEBUGPRINT_PARSE(3);
 
-    const uint8_t varId = parseVariable("Expected variable name.");
+    const uint32_t varId = parseVariable("Expected variable name.");
     if (match(TokenType::Equal))
     {
         expression();
@@ -430,6 +600,45 @@ void Compiler::variableDeclaration()
     defineVariable(varId);
 }
 
+void Compiler::functionDeclaration()
+{
+    CMP_DEBUGPRINT_PARSE(3);
+
+    const uint32_t varId = parseVariable("Expected function name.");
+    if (_localState.scopeDepth > 0)
+    {  // a local function can refer to itself (recursion) before being fully defined
+        initializeLocalVariable();
+    }
+    function(FunctionType::Function);
+    defineVariable(varId);
+}
+
+void Compiler::call()
+{
+    CMP_DEBUGPRINT_PARSE(3);
+    const uint8_t argCount = argumentList();
+    emitBytes(OpCode::Call, argCount);
+}
+
+uint8_t Compiler::argumentList()
+{
+    size_t argCount = 0;
+    if (!check(TokenType::RightParen))
+    {
+        do
+        {
+            expression();
+            if (argCount == limits::kMaxParameters)
+            {
+                error(format("Can't have more than %zu arguments.", limits::kMaxParameters).c_str());
+            }
+            ++argCount;
+        } while (match(TokenType::Comma));
+    }
+    consume(TokenType::RightParen, "Expected ')' after arguments.");
+    return static_cast<uint8_t>(argCount);
+}
+
 void Compiler::parsePrecedence(Precedence precedence)
 {
     advance();
@@ -456,7 +665,7 @@ void Compiler::parsePrecedence(Precedence precedence)
     }
 }
 
-uint8_t Compiler::parseVariable(const char *errorMessage)
+uint32_t Compiler::parseVariable(const char *errorMessage)
 {
     consume(TokenType::Identifier, errorMessage);
 
@@ -466,6 +675,10 @@ uint8_t Compiler::parseVariable(const char *errorMessage)
         return 0;
     }
 
+    if (useGlobalSlots())
+    {
+        return resolveGlobalVariable(_parser.previous);
+    }
     return identifierConstant(_parser.previous);
 }
 
@@ -498,102 +711,281 @@ void Compiler::declareVariable()
     addLocalVariable(name);
 }
 
-void Compiler::defineVariable(uint8_t id)
+void Compiler::defineVariable(uint32_t id)
 {
     if (_localState.scopeDepth > 0)
     {
         initializeLocalVariable();
         return;
     }
-    emitBytes(OpCode::GlobalVarDef, id);
+    emitInstruction(useGlobalSlots() ? OpCode::GlobalSlotDef : OpCode::GlobalVarDef, id);
 }
 
-uint8_t Compiler::identifierConstant(const Token &token)
+uint32_t Compiler::identifierConstant(const Token &token)
 {
     CMP_DEBUGPRINT_PARSE(3);
     return makeConstant(Value::CreateByCopy(token.start, token.length));
 }
 
+uint32_t Compiler::resolveGlobalVariable(const Token &name)
+{
+    CMP_DEBUGPRINT(2, "resolveGlobalVariable: %.*s", name.length, name.start);
+
+    // globals may be used before their declaration, those still get a slot and fail at runtime if never defined
+    const std::string varName(name.start, name.length);
+    auto              slotIt = _globalSlots.find(varName);
+    if (slotIt != _globalSlots.end())
+    {
+        return slotIt->second;
+    }
+
+    Chunk    &chunk = scriptChunk();
+    const int slot  = chunk.addGlobal(Value::CreateByCopy(name.start, name.length));
+    if (static_cast<size_t>(slot) > limits::kMaxLongOperand)
+    {
+        error("Too many global variables.");
+        return 0;
+    }
+    _globalSlots.insert({varName, static_cast<uint32_t>(slot)});
+    return static_cast<uint32_t>(slot);
+}
+
+// Scopes only exist at compile time: locals live in stack slots and are popped when leaving their scope.
+// ScopeBegin/ScopeEnd are no-ops for the VM, kept in non-optimized builds as markers for the disassembler.
 void Compiler::beginScope()
 {
     ++_localState.scopeDepth;
-    emitBytes(OpCode::ScopeBegin);
+    if (!_configuration.optimize)
+    {
+        emitBytes(OpCode::ScopeBegin);
+    }
 }
 
 void Compiler::endScope()
 {
-    emitBytes(OpCode::ScopeEnd);
+    if (!_configuration.optimize)
+    {
+        emitBytes(OpCode::ScopeEnd);
+    }
     ASSERT(_localState.scopeDepth > 0);
     --_localState.scopeDepth;
 
-    const int currentScopeDepth = _localState.scopeDepth;
-    while (_localState.localCount > 0 &&
-           _localState.locals[_localState.localCount - 1].declarationDepth > currentScopeDepth)
+    _localState.localCount -= emitPopLocals(_localState.scopeDepth);
+}
+
+int Compiler::emitPopLocals(int scopeDepth)
+{
+    int popCount = 0;
+    for (int i = _localState.localCount - 1; i >= 0 && _localState.locals[i].declarationDepth > scopeDepth; --i)
     {
         emitBytes(OpCode::Pop);
-        --_localState.localCount;
+        ++popCount;
     }
+    return popCount;
 }
 
 /////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////
 
+// The function body is compiled with its own locals, loops and chunk, the enclosing function state is restored once it
+// is done. The finished function is a constant of the enclosing chunk.
+void Compiler::function(FunctionType type)
+{
+    const Token name = _parser.previous;
+
+    _enclosingFunctions.push_back(FunctionState{_function, _functionType, std::move(_localState), _lastConstant,
+                                                _hasLastConstant, std::move(_loopContext)});
+    beginFunction(ObjectFunction::Create(std::string(name.start, name.length).c_str()), type);
+
+    beginScope();
+    consume(TokenType::LeftParen, "Expected '(' after function name.");
+    if (!check(TokenType::RightParen))
+    {
+        do
+        {
+            if (_function->arity == limits::kMaxParameters)
+            {
+                errorAtCurrent(format("Can't have more than %zu parameters.", limits::kMaxParameters).c_str());
+            }
+            else
+            {
+                ++_function->arity;
+            }
+            const uint32_t paramId = parseVariable("Expected parameter name.");
+            defineVariable(paramId);
+        } while (match(TokenType::Comma));
+    }
+    consume(TokenType::RightParen, "Expected ')' after parameters.");
+    consume(TokenType::LeftBrace, "Expected '{' before function body.");
+    block();
+    // no endScope: returning discards the frame with its locals
+
+    finishCompilation();
+    ObjectFunction *function = _function;
+
+    FunctionState &enclosing = _enclosingFunctions.back();
+    _function                = enclosing.function;
+    _functionType            = enclosing.type;
+    _localState              = std::move(enclosing.localState);
+    _lastConstant            = enclosing.lastConstant;
+    _hasLastConstant         = enclosing.hasLastConstant;
+    _loopContext             = std::move(enclosing.loopContext);
+    // rooted as a constant from now on
+    emitConstant(Value::Create(function));
+    _enclosingFunctions.pop_back();
+}
+
+void Compiler::beginFunction(ObjectFunction *function, FunctionType type)
+{
+    _function        = function;
+    _functionType    = type;
+    _localState      = LocalState{};
+    _hasLastConstant = false;
+    _loopContext     = LoopContext{};
+
+    // slot 0 holds the function being called, the unnamed local can't be resolved
+    addLocalVariable(Token{});
+    initializeLocalVariable();
+}
+
 void Compiler::finishCompilation()
 {
     emitReturn();
+    if (_configuration.optimize && !_parser.hadError)
+    {
+        peepholeOptimize(currentChunk());
+    }
+    else if (!_parser.hadError)
+    {
+        relaxJumps(currentChunk());
+    }
 #if USING(DEBUG_PRINT_CODE)
     if (_configuration.disassemble && !_parser.hadError)
     {
         ASSERT(_function);
-        disassemble(currentChunk(), "code");
+        disassemble(currentChunk(), _functionType == FunctionType::Script ? "code" : _function->name->chars);
     }
 #endif  // #if USING(DEBUG_PRINT_CODE)
 }
 
-uint8_t Compiler::makeConstant(const Value &value)
+uint32_t Compiler::makeConstant(const Value &value)
 {
     Chunk &chunk = currentChunk();
 
-    const int constantId = chunk.addConstant(value);
-    ASSERT(constantId < UINT8_MAX);
-    if (constantId > UINT8_MAX)
+    if (chunk.getConstants().size() > limits::kMaxLongOperand)
     {
-        error(format("Max constants per chunk exceeded: %s", UINT8_MAX).c_str());
+        error(format("Max constants per chunk exceeded: %zu", limits::kMaxLongOperand).c_str());
+        return 0;
     }
+    const int constantId = chunk.addConstant(value);
 #if USING(DEBUG_TRACE_EXECUTION)
     if (_configuration.debugPrintConstants)
     {
         chunk.printConstants();
     }
 #endif  // #if USING(DEBUG_TRACE_EXECUTION)
-    return static_cast<uint8_t>(constantId);
+    return static_cast<uint32_t>(constantId);
 }
 
-void Compiler::emitConstant(const Value &value) { emitBytes(OpCode::Constant, makeConstant(value)); }
+void Compiler::emitConstant(const Value &value) { emitInstruction(OpCode::Constant, makeConstant(value)); }
+
+void Compiler::emitConstantExpression(const Value &value)
+{
+    Chunk &chunk = currentChunk();
 
-void Compiler::emitReturn() { emitBytes(OpCode::Return); }
+    ConstantExpression constant;
+    constant.start         = chunk.getCodeSize();
+    constant.constantCount = chunk.getConstants().size();
+    constant.value         = value;
 
-uint16_t Compiler::emitJump(OpCode op, codepos_t jumpOffset)
+    if (value.is(Value::Type::Null))
+    {
+        emitBytes(OpCode::Null);
+    }
+    else if (value.is(Value::Type::Bool))
+    {
+        emitBytes(value.asBool() ? OpCode::True : OpCode::False);
+    }
+    else
+    {
+        emitConstant(value);
+    }
+
+    constant.end     = chunk.getCodeSize();
+    _lastConstant    = constant;
+    _hasLastConstant = true;
+}
+
+bool Compiler::getTrailingConstant(ConstantExpression &constant)
 {
-    constexpr size_t jumpBytes = sizeof(jump_t);
-    emitBytes(op);
-    Chunk          &chunk      = currentChunk();
-    const codepos_t codeOffset = chunk.getCodeSize();
-    ASSERT(static_cast<size_t>(chunk.getCodeSize() - jumpOffset) < limits::kMaxJumpLength);
+    if (!_hasLastConstant || _lastConstant.end != currentChunk().getCodeSize())
+    {
+        return false;
+    }
+    constant = _lastConstant;
+    return true;
+}
 
-    const jump_t jump = jumpOffset - codeOffset - jumpBytes;
+void Compiler::truncateCode(codepos_t codeSize, size_t constantCount)
+{
+    currentChunk().truncate(codeSize, constantCount);
+    _hasLastConstant = false;
+}
+
+void Compiler::replaceWithConstant(const ConstantExpression &from, const Value &value)
+{
+    // the value is already computed, the operands can go (strings are interned, the result doesn't reference them)
+    truncateCode(from.start, from.constantCount);
+    emitConstantExpression(value);
+}
+
+// implicit return value
+void Compiler::emitReturn() { emitBytes(OpCode::Null, OpCode::Return); }
 
-    emitBytes(static_cast<uint16_t>(jump));
+void Compiler::emitInstruction(OpCode op, uint32_t operand)
+{
+    ASSERT(operand <= limits::kMaxLongOperand);
+    if (operand <= limits::kMaxShortOperand)
+    {
+        emitBytes(op, static_cast<uint8_t>(operand));
+        return;
+    }
+
+    emitBytes(getLongOpCode(op));
+    for (size_t i = limits::kLongOperandBytes; i > 0; --i)
+    {
+        emitBytes(static_cast<uint8_t>((operand >> (8 * (i - 1))) & 0xff));
+    }
+}
+
+// backward jump, the offset is known so the long encoding is only used when needed
+codepos_t Compiler::emitJump(OpCode op, codepos_t jumpOffset)
+{
+    const int64_t shortJump = static_cast<int64_t>(jumpOffset) - currentChunk().getCodeSize() - 1 - sizeof(jump_t);
+    const bool    isLong    = !fitsShortJump(shortJump);
+    emitBytes(isLong ? getLongOpCode(op) : op);
+    const codepos_t codeOffset = currentChunk().getCodeSize();
+
+    const uint8_t jumpBytes = isLong ? sizeof(jump_long_t) : sizeof(jump_t);
+    const int64_t jump      = static_cast<int64_t>(jumpOffset) - codeOffset - jumpBytes;
+    for (uint8_t i = jumpBytes; i > 0; --i)
+    {
+        emitBytes(static_cast<uint8_t>((jump >> (8 * (i - 1))) & 0xff));
+    }
     return codeOffset;
 }
 
-uint16_t Compiler::emitJump(OpCode op)
+// forward jump, the target isn't known yet: the long encoding is reserved and the jump is shrunk to the compact one
+// when the chunk is finished (see relaxJumps)
+codepos_t Compiler::emitJump(OpCode op)
 {
-    emitBytes(op);
+    emitBytes(getLongOpCode(op));
     const codepos_t codeOffset = currentChunk().getCodeSize();
     // placeholder
-    emitBytes((uint8_t)0xff);
-    emitBytes((uint8_t)0xff);
+    for (size_t i = 0; i < sizeof(jump_long_t); ++i)
+    {
+        emitBytes((uint8_t)0xff);
+    }
     return codeOffset;
 }
 
@@ -604,28 +996,21 @@ void Compiler::patchJump(codepos_t jumpPos)
 
 void Compiler::patchJumpEx(codepos_t jumpPos, codepos_t jumpTargetPos)
 {
-    constexpr size_t jumpBytes = sizeof(jump_t);
-    Chunk           &chunk     = currentChunk();
-    ASSERT(static_cast<size_t>(jumpTargetPos - jumpPos) < limits::kMaxJumpLength);
-    const jump_t jumpLen = jumpTargetPos - jumpPos - jumpBytes;
+    Chunk        &chunk     = currentChunk();
+    uint8_t      *code      = chunk.getCodeMut();
+    const uint8_t jumpBytes = getOperandBytes(static_cast<OpCode>(code[jumpPos - 1]));
+    const int64_t jumpLen   = static_cast<int64_t>(jumpTargetPos) - jumpPos - jumpBytes;
+    ASSERT(jumpBytes == sizeof(jump_long_t) || fitsShortJump(jumpLen));
 
-    uint8_t *code     = chunk.getCodeMut();
-    code[jumpPos]     = static_cast<uint8_t>((jumpLen >> 8) & 0xff);
-    code[jumpPos + 1] = static_cast<uint8_t>(jumpLen & 0xff);
-}
+    writeOperand(code + jumpPos, jumpBytes, static_cast<uint32_t>(jumpLen));
 
-void Compiler::emitBytes(uint8_t byte)
-{
-    Chunk &chunk = currentChunk();
-    chunk.write(byte, static_cast<uint16_t>(_lastExpressionLine));
+    // code being jumped into can't be folded away
+    _hasLastConstant = false;
 }
 
-void Compiler::emitBytes(uint16_t word)
+void Compiler::emitBytes(uint8_t byte)
 {
     Chunk &chunk = currentChunk();
-    uint8_t byte = static_cast<uint8_t>((word >> 8) & 0xFF);
-    chunk.write(byte, _lastExpressionLine);
-    byte = static_cast<uint8_t>(word & 0xFF);
     chunk.write(byte, _lastExpressionLine);
 }
 
@@ -643,12 +1028,15 @@ void Compiler::addLocalVariable(const Token &name)
 {
     CMP_DEBUGPRINT(2, "addLocalVariable: %.*s", name.length, name.start);
 
-    if (_localState.localCount == ARRAY_COUNT(_localState.locals))
+    if (static_cast<size_t>(_localState.localCount) == limits::kMaxLocals)
     {
         error("Too many local variables in function.");
         return;
     }
-    ASSERT(static_cast<uint32_t>(_localState.localCount) < ARRAY_COUNT(_localState.locals));
+    if (static_cast<size_t>(_localState.localCount) == _localState.locals.size())
+    {
+        _localState.locals.emplace_back();
+    }
     LocalState::Local *local = &_localState.locals[_localState.localCount++];
     local->name              = name;
     local->declarationDepth  = -1;  // uninitialized
@@ -795,22 +1183,11 @@ void Compiler::populateParseRules()
     auto unaryFunc      = [&](bool /*canAssign*/) { unary(); };
     auto varFunc        = [&](bool /*canAssign*/) { variableDeclaration(); };
     auto identifierFunc = [&](bool canAssign) { variable(canAssign); };
-    auto andFunc        = [&](bool /*canAssign*/)
-    {
-        const uint16_t endJump = emitJump(OpCode::JumpIfFalse);
-        emitBytes(OpCode::Pop);
-        parsePrecedence(Precedence::AND);
-        patchJump(endJump);
-    };
-    auto orFunc = [&](bool /*canAssign*/)
-    {
-        const uint16_t endJump = emitJump(OpCode::JumpIfTrue);
-        emitBytes(OpCode::Pop);
-        parsePrecedence(Precedence::OR);
-        patchJump(endJump);
-    };
+    auto andFunc        = [&](bool /*canAssign*/) { logical(OpCode::JumpIfFalse, Precedence::AND); };
+    auto orFunc         = [&](bool /*canAssign*/) { logical(OpCode::JumpIfTrue, Precedence::OR); };
+    auto callFunc       = [&](bool /*canAssign*/) { call(); };
 
-    _parseRules[(size_t)TokenType::LeftParen]    = {groupingFunc, NULL, Precedence::NONE};
+    _parseRules[(size_t)TokenType::LeftParen]    = {groupingFunc, callFunc, Precedence::CALL};
     _parseRules[(size_t)TokenType::RightParen]   = {NULL, NULL, Precedence::NONE};
     _parseRules[(size_t)TokenType::LeftBrace]    = {NULL, NULL, Precedence::NONE};
     _parseRules[(size_t)TokenType::RightBrace]   = {NULL, NULL, Precedence::NONE};
@@ -5,6 +5,7 @@
 #include "object.h"
 #include "utils/common.h"
 #include <functional>
+#include <unordered_map>
 
 #if USING(DEBUG_PRINT_CODE)
 #include "debug.h"
@@ -89,6 +90,7 @@ struct Compiler
         bool allowDynamicVariables = false;  // no need to declare with <var>
         bool defaultConstVariables = false;  // <mut> allows modifying variables
         bool disassemble           = false;
+        bool optimize              = true;  // constant folding, peephole pass, no debugging-only opcodes (scopes)
 #if USING(DEBUG_TRACE_EXECUTION)
         bool debugPrintConstants = false;  // print constants on every new one
         bool debugPrintVariables = false;  // print variables on every new one
@@ -113,12 +115,14 @@ struct Compiler
     void declaration();
     void statement();
     void printStatement();
+    void block();
     void blockStatement();
     void ifStatement();
     void whileStatement();
     void dowhileStatement();
     void forStatement();
     void expressionStatement();
+    void returnStatement();
 
     /////////////////////////////////////////////////////////////////////////////////
    protected:
@@ -132,32 +136,48 @@ struct Compiler
     void string();
     void unary();
     void binary();
+    void logical(OpCode jumpOpCode, Precedence precedence);
     void variableDeclaration();
+    void functionDeclaration();
+    void call();
+    uint8_t argumentList();
 
     const ParseRule &getParseRule(TokenType type) const { return _parseRules[(size_t)type]; }
 
     void    parsePrecedence(Precedence precedence);
-    uint8_t parseVariable(const char *errorMessage);
-    void    declareVariable();
-    void    defineVariable(uint8_t id);
-    uint8_t identifierConstant(const Token &token);
-    void    beginScope();
-    void    endScope();
+    uint32_t parseVariable(const char *errorMessage);
+    void     declareVariable();
+    void     defineVariable(uint32_t id);
+    uint32_t identifierConstant(const Token &token);
+    uint32_t resolveGlobalVariable(const Token &name);
+    void     beginScope();
+    void     endScope();
+    int      emitPopLocals(int scopeDepth);
 
    protected:
+    enum class FunctionType : uint8_t
+    {
+        Function,
+        Script,  // main entry
+        COUNT = uint8_t(-1)
+    };
+
+    void function(FunctionType type);
+    void beginFunction(ObjectFunction *function, FunctionType type);
     void finishCompilation();
 
-    uint8_t makeConstant(const Value &value);
+    uint32_t makeConstant(const Value &value);
 
-    void     emitConstant(const Value &value);
-    void     emitReturn();
-    uint16_t emitJump(OpCode op, codepos_t jumpOffset);
-    uint16_t emitJump(OpCode op);
-    void     patchJump(codepos_t jumpPos);
-    void     patchJumpEx(codepos_t jumpPos, codepos_t jumpTargetPos);
-    void     emitBytes(uint8_t byte);
-    void     emitBytes(uint16_t word);
-    void     emitBytes(OpCode code);
+    void      emitConstant(const Value &value);
+    void      emitConstantExpression(const Value &value);
+    void      emitReturn();
+    void      emitInstruction(OpCode op, uint32_t operand);  // *Long variant past the compact operand range
+    codepos_t emitJump(OpCode op, codepos_t jumpOffset);
+    codepos_t emitJump(OpCode op);
+    void      patchJump(codepos_t jumpPos);
+    void      patchJumpEx(codepos_t jumpPos, codepos_t jumpTargetPos);
+    void      emitBytes(uint8_t byte);
+    void      emitBytes(OpCode code);
 
     template <typename T, typename... Args>
     void emitBytes(T byte, Args... args)
@@ -166,6 +186,26 @@ struct Compiler
         emitBytes(args...);
     }
 
+   protected:  // constant folding
+    // last constant expression emitted (literal or folded), it can be folded into the enclosing expression as long as
+    // nothing was emitted after it
+    struct ConstantExpression
+    {
+        codepos_t start         = 0;
+        codepos_t end           = 0;
+        size_t    constantCount = 0;  // constants in the pool before it, the ones added later are only used by it
+        Value     value;
+    };
+
+    bool canFoldConstants() const { return _configuration.optimize; }
+    bool getTrailingConstant(ConstantExpression &constant);
+    void truncateCode(codepos_t codeSize, size_t constantCount);
+    void replaceWithConstant(const ConstantExpression &from, const Value &value);
+
+   protected:  // global variables
+    // globals are resolved to slots in the module globals table unless they have to be looked up by name
+    bool useGlobalSlots() const { return !_configuration.allowDynamicVariables && !_configuration.isREPL; }
+
    protected:  // local variables
     void addLocalVariable(const Token &name);
     void initializeLocalVariable();
@@ -212,11 +252,6 @@ struct Compiler
     uint32_t _lastExpressionLine = uint32_t(-1);
 
     ObjectFunction* _function = nullptr;
-    enum class FunctionType : uint8_t {
-        Function,
-        Script, // main entry
-        COUNT = uint8_t(-1)
-    };
     FunctionType _functionType = FunctionType::COUNT;
 
     ParseRule _parseRules[(size_t)TokenType::COUNT];
@@ -229,27 +264,34 @@ struct Compiler
             int   declarationDepth = 0;
         };
 
-        Local locals[MAX_U8_COUNT];
-        int   localCount = 0;
-        int   scopeDepth = 0;
+        std::vector<Local> locals;  // grown on demand, up to limits::kMaxLocals
+        int                localCount = 0;
+        int                scopeDepth = 0;
     };
 
     LocalState _localState;
 
+    ConstantExpression _lastConstant;
+    bool               _hasLastConstant = false;
+
+    std::unordered_map<std::string, uint32_t> _globalSlots;  // name -> slot in the module globals table
+
     struct LoopContext
     {
         struct Data
         {
             codepos_t breakJump;
             codepos_t continueJump;
+            int       scopeDepth;  // locals declared deeper are popped by break/continue
             std::vector<codepos_t> breakJumpsToPatch;
             std::vector<codepos_t> continueJumpsToPatch;
         };
 
-        void loopStart(codepos_t loopStart)
+        void loopStart(codepos_t loopStart, int scopeDepth)
         {
             _loops.push_back({});
             _loops.back().continueJump = loopStart;
+            _loops.back().scopeDepth   = scopeDepth;
         }
         void setLoopStart(codepos_t loopStart) { _loops.back().continueJump = loopStart; }
 
@@ -283,8 +325,33 @@ struct Compiler
 
         bool isInLoop() const { return !_loops.empty(); }
 
+        int getScopeDepth() const
+        {
+            ASSERT(isInLoop());
+            return _loops.back().scopeDepth;
+        }
+
         std::vector<Data> _loops;
     };
 
     LoopContext _loopContext;
+
+    // state of the functions enclosing the one being compiled, restored once it is finished
+    struct FunctionState
+    {
+        ObjectFunction    *function = nullptr;
+        FunctionType       type     = FunctionType::COUNT;
+        LocalState         localState;
+        ConstantExpression lastConstant;
+        bool               hasLastConstant = false;
+        LoopContext        loopContext;
+    };
+
+    std::vector<FunctionState> _enclosingFunctions;
+
+    // globals are shared by every function of the script, their names are kept in the script chunk
+    Chunk &scriptChunk()
+    {
+        return _enclosingFunctions.empty() ? currentChunk() : _enclosingFunctions.front().function->chunk;
+    }
 };
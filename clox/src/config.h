@@ -85,3 +85,30 @@ static_assert(!USING(TOOL_BUILD) && !USING(PE_BUILD));
 #define MACHINE_BITS 8
 #define MAX_OPCODE_BITS MACHINE_BITS
 #define MAX_OPCODE_VALUE ((1L << MAX_OPCODE_BITS) - 1)
+
+////////////////////////////////////////////////////////////////////////////////
+// VM dispatch: threaded code through a label table relies on the GCC/Clang
+// labels-as-values extension, switch dispatch is kept as the portable fallback
+#if defined(VM_SWITCH_DISPATCH) || defined(_MSC_VER)
+#define VM_COMPUTED_GOTO NOT_IN_USE
+#else  // #if defined(VM_SWITCH_DISPATCH) || defined(_MSC_VER)
+#define VM_COMPUTED_GOTO IN_USE
+#endif  // #else // #if defined(VM_SWITCH_DISPATCH) || defined(_MSC_VER)
+
+////////////////////////////////////////////////////////////////////////////////
+// Value representation: NaN-boxing packs doubles, immediates and Object pointers
+// in 64 bits (assumes 48-bit user-space pointers), the tagged union is the default
+#if defined(VALUE_NAN_BOXING)
+#define NAN_BOXING IN_USE
+#else  // #if defined(VALUE_NAN_BOXING)
+#define NAN_BOXING NOT_IN_USE
+#endif  // #else // #if defined(VALUE_NAN_BOXING)
+
+////////////////////////////////////////////////////////////////////////////////
+// Baseline JIT: hot chunks are translated into machine code (see jit.h), only
+// x86-64 Linux with the tagged union Values, the interpreter runs everything else
+#if defined(VM_JIT) && defined(__linux__) && defined(__x86_64__) && !defined(VALUE_NAN_BOXING)
+#define JIT IN_USE
+#else  // #if defined(VM_JIT) && defined(__linux__) && defined(__x86_64__) && !defined(VALUE_NAN_BOXING)
+#define JIT NOT_IN_USE
+#endif  // #else // #if defined(VM_JIT) && defined(__linux__) && defined(__x86_64__) && !defined(VALUE_NAN_BOXING)
@@ -11,32 +11,42 @@ codepos_t simpleInstruction(const char* name, codepos_t offset)
 }
 codepos_t byteInstruction(const char* name, const Chunk& chunk, codepos_t offset)
 {
-    const uint8_t* code          = chunk.getCode();
-    const uint8_t  slot = code[offset + 1];
-    printf("%-16s [%04d]='\n", name, slot);
+    const uint8_t  operandBytes = getOperandBytes(OpCode(chunk.getCode()[offset]));
+    const uint32_t slot         = readOperand(chunk.getCode() + offset + 1, operandBytes);
+    printf("%-16s [%04u]='\n", name, slot);
 
-    return offset + 2;
+    return offset + 1 + operandBytes;
 }
 codepos_t constantInstruction(const char* name, const Chunk& chunk, codepos_t offset)
 {
-    const uint8_t* code          = chunk.getCode();
-    const uint8_t  constantIndex = code[offset + 1];
-    printf("%-16s [%04d]='", name, constantIndex);
+    const uint8_t  operandBytes  = getOperandBytes(OpCode(chunk.getCode()[offset]));
+    const uint32_t constantIndex = readOperand(chunk.getCode() + offset + 1, operandBytes);
+    printf("%-16s [%04u]='", name, constantIndex);
     printValueDebug(chunk.getConstants().getValue(constantIndex));
     printf("'\n");
 
-    return offset + 2;
+    return offset + 1 + operandBytes;
+}
+codepos_t globalInstruction(const char* name, const Chunk& chunk, codepos_t offset)
+{
+    const uint8_t  operandBytes = getOperandBytes(OpCode(chunk.getCode()[offset]));
+    const uint32_t slot         = readOperand(chunk.getCode() + offset + 1, operandBytes);
+    printf("%-16s [%04u]='", name, slot);
+    printValueDebug(chunk.getGlobalNames().getValue(slot));
+    printf("'\n");
+
+    return offset + 1 + operandBytes;
 }
 codepos_t jumpInstruction(const char* name, const Chunk& chunk, codepos_t codePos)
 {
-    const uint8_t* code       = chunk.getCode();
-    jump_t         jumpOffset = (uint16_t)(code[codePos + 1] << 8);
-    jumpOffset |= code[codePos + 2];
+    const uint8_t jumpBytes  = getOperandBytes(OpCode(chunk.getCode()[codePos]));
+    const int32_t jumpOffset = readJumpOffset(chunk.getCode() + codePos + 1, jumpBytes);
+    const int64_t target     = static_cast<int64_t>(codePos) + 1 + jumpBytes + jumpOffset;
 
-    printf("%-16s %4d -> %d\n", name, codePos, codePos + 3 + jumpOffset);
-    return codePos + 3;
+    printf("%-16s %4u -> %lld\n", name, codePos, static_cast<long long>(target));
+    return codePos + 1 + jumpBytes;
 }
-codepos_t scopeInstruction(const char* name, const Chunk& /*chunk*/, uint16_t offset)
+codepos_t scopeInstruction(const char* name, const Chunk& /*chunk*/, codepos_t offset)
 {
     printf("%s\n", name);
     return offset + 1;
@@ -52,7 +62,7 @@ codepos_t disassembleInstruction(const Chunk& chunk, codepos_t offset, bool line
         *o_op = instruction;
     }
 
-    printf("%04d ", offset);
+    printf("%04u ", offset);
     if (instruction == OpCode::ScopeEnd)
     {
         if (*scopeCount > 0)
@@ -95,12 +105,18 @@ codepos_t disassembleInstruction(const Chunk& chunk, codepos_t offset, bool line
         case OpCode::Equal: return simpleInstruction("OP_EQUAL", offset);
         case OpCode::Greater: return simpleInstruction("OP_GREATER", offset);
         case OpCode::Less: return simpleInstruction("OP_LESS", offset);
+        case OpCode::NotEqual: return simpleInstruction("OP_NOT_EQUAL", offset);
+        case OpCode::GreaterEqual: return simpleInstruction("OP_GREATER_EQUAL", offset);
+        case OpCode::LessEqual: return simpleInstruction("OP_LESS_EQUAL", offset);
         case OpCode::Print: return simpleInstruction("OP_PRINT", offset);
         case OpCode::Pop: return simpleInstruction("OP_POP", offset);
         case OpCode::Constant: return constantInstruction("OP_CONSTANT", chunk, offset);
         case OpCode::GlobalVarDef: return constantInstruction("OP_GLOBAL_VAR_DEFINE", chunk, offset);
-        case OpCode::GlobalVarSet: return constantInstruction("OP_LOCAL_VAR_SET", chunk, offset);
+        case OpCode::GlobalVarSet: return constantInstruction("OP_GLOBAL_VAR_SET", chunk, offset);
         case OpCode::GlobalVarGet: return constantInstruction("OP_GLOBAL_VAR_GET", chunk, offset);
+        case OpCode::GlobalSlotDef: return globalInstruction("OP_GLOBAL_SLOT_DEFINE", chunk, offset);
+        case OpCode::GlobalSlotSet: return globalInstruction("OP_GLOBAL_SLOT_SET", chunk, offset);
+        case OpCode::GlobalSlotGet: return globalInstruction("OP_GLOBAL_SLOT_GET", chunk, offset);
         case OpCode::LocalVarSet: return byteInstruction("OP_LOCAL_VAR_SET", chunk, offset);
         case OpCode::LocalVarGet: return byteInstruction("OP_LOCAL_VAR_GET", chunk, offset);
         case OpCode::Jump: return jumpInstruction("OP_JUMP", chunk, offset);
@@ -108,6 +124,48 @@ codepos_t disassembleInstruction(const Chunk& chunk, codepos_t offset, bool line
         case OpCode::JumpIfTrue: return jumpInstruction("OP_JUMP_IF_TRUE", chunk, offset);
         case OpCode::ScopeBegin: ++(*scopeCount); return scopeInstruction("OP_SCOPE_BEGIN", chunk, offset);
         case OpCode::ScopeEnd: return scopeInstruction("OP_SCOPE_END", chunk, offset);
+        case OpCode::Call: return byteInstruction("OP_CALL", chunk, offset);
+        case OpCode::ConstantLong: return constantInstruction("OP_CONSTANT_LONG", chunk, offset);
+        case OpCode::GlobalVarDefLong: return constantInstruction("OP_GLOBAL_VAR_DEFINE_LONG", chunk, offset);
+        case OpCode::GlobalVarSetLong: return constantInstruction("OP_GLOBAL_VAR_SET_LONG", chunk, offset);
+        case OpCode::GlobalVarGetLong: return constantInstruction("OP_GLOBAL_VAR_GET_LONG", chunk, offset);
+        case OpCode::GlobalSlotDefLong: return globalInstruction("OP_GLOBAL_SLOT_DEFINE_LONG", chunk, offset);
+        case OpCode::GlobalSlotSetLong: return globalInstruction("OP_GLOBAL_SLOT_SET_LONG", chunk, offset);
+        case OpCode::GlobalSlotGetLong: return globalInstruction("OP_GLOBAL_SLOT_GET_LONG", chunk, offset);
+        case OpCode::LocalVarSetLong: return byteInstruction("OP_LOCAL_VAR_SET_LONG", chunk, offset);
+        case OpCode::LocalVarGetLong: return byteInstruction("OP_LOCAL_VAR_GET_LONG", chunk, offset);
+        case OpCode::JumpLong: return jumpInstruction("OP_JUMP_LONG", chunk, offset);
+        case OpCode::JumpIfFalseLong: return jumpInstruction("OP_JUMP_IF_FALSE_LONG", chunk, offset);
+        case OpCode::JumpIfTrueLong: return jumpInstruction("OP_JUMP_IF_TRUE_LONG", chunk, offset);
+        case OpCode::AddNumber: return simpleInstruction("OP_ADD_NUMBER", offset);
+        case OpCode::AddString: return simpleInstruction("OP_ADD_STRING", offset);
+        case OpCode::SubtractNumber: return simpleInstruction("OP_SUBTRACT_NUMBER", offset);
+        case OpCode::MultiplyNumber: return simpleInstruction("OP_MULTIPLY_NUMBER", offset);
+        case OpCode::DivideNumber: return simpleInstruction("OP_DIVIDE_NUMBER", offset);
+        case OpCode::EqualNumber: return simpleInstruction("OP_EQUAL_NUMBER", offset);
+        case OpCode::NotEqualNumber: return simpleInstruction("OP_NOT_EQUAL_NUMBER", offset);
+        case OpCode::GreaterNumber: return simpleInstruction("OP_GREATER_NUMBER", offset);
+        case OpCode::LessNumber: return simpleInstruction("OP_LESS_NUMBER", offset);
+        case OpCode::GreaterEqualNumber: return simpleInstruction("OP_GREATER_EQUAL_NUMBER", offset);
+        case OpCode::LessEqualNumber: return simpleInstruction("OP_LESS_EQUAL_NUMBER", offset);
+        case OpCode::AddInteger: return simpleInstruction("OP_ADD_INTEGER", offset);
+        case OpCode::SubtractInteger: return simpleInstruction("OP_SUBTRACT_INTEGER", offset);
+        case OpCode::MultiplyInteger: return simpleInstruction("OP_MULTIPLY_INTEGER", offset);
+        case OpCode::EqualInteger: return simpleInstruction("OP_EQUAL_INTEGER", offset);
+        case OpCode::NotEqualInteger: return simpleInstruction("OP_NOT_EQUAL_INTEGER", offset);
+        case OpCode::GreaterInteger: return simpleInstruction("OP_GREATER_INTEGER", offset);
+        case OpCode::LessInteger: return simpleInstruction("OP_LESS_INTEGER", offset);
+        case OpCode::GreaterEqualInteger: return simpleInstruction("OP_GREATER_EQUAL_INTEGER", offset);
+        case OpCode::LessEqualInteger: return simpleInstruction("OP_LESS_EQUAL_INTEGER", offset);
+        // superinstructions: the other instructions of their sequence follow, listed as usual
+        case OpCode::LocalVarGetConstantAdd: return byteInstruction("OP_LOCAL_VAR_GET_CONSTANT_ADD", chunk, offset);
+        case OpCode::LocalVarGetConstantLessJumpIfFalse:
+            return byteInstruction("OP_LOCAL_VAR_GET_CONSTANT_LESS_JUMP_IF_FALSE", chunk, offset);
+        case OpCode::LocalVarGetLocalVarGetLessJumpIfFalse:
+            return byteInstruction("OP_LOCAL_VAR_GET_LOCAL_VAR_GET_LESS_JUMP_IF_FALSE", chunk, offset);
+        case OpCode::GlobalSlotSetPop: return globalInstruction("OP_GLOBAL_SLOT_SET_POP", chunk, offset);
+        case OpCode::LocalVarSetPop: return byteInstruction("OP_LOCAL_VAR_SET_POP", chunk, offset);
+        case OpCode::PopJump: return simpleInstruction("OP_POP_JUMP", offset);
         default: printf("Unknown opcode %d\n", (int)instruction); return offset + 1;
     }
 }
@@ -120,7 +178,6 @@ void disassemble(const Chunk& chunk, const char* name)
     uint16_t   scopeCount     = 0;
     for (codepos_t offset = 0; offset < chunk.getCodeSize();)
     {
-        offset = static_cast<codepos_t>(
-            disassembleInstruction(chunk, static_cast<uint16_t>(offset), linesAvailable, &scopeCount));
+        offset = disassembleInstruction(chunk, offset, linesAvailable, &scopeCount);
     }
 }
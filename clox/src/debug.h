@@ -4,6 +4,7 @@
 #include "chunk.h"
 #include "utils/common.h"
 
-uint16_t disassembleInstruction(const Chunk& chunk, uint16_t offset, bool linesAvailable, uint16_t* scopeCount, OpCode* o_op = nullptr);
+codepos_t disassembleInstruction(const Chunk& chunk, codepos_t offset, bool linesAvailable, uint16_t* scopeCount,
+                                 OpCode* o_op = nullptr);
 
 void disassemble(const Chunk& chunk, const char* name);
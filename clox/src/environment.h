@@ -1,6 +1,7 @@
 #pragma once
 
 #include "utils/common.h"
+#include "object.h"
 #include "value.h"
 
 struct Environment
@@ -24,13 +25,13 @@ struct Environment
     size_t getVariableCount() const {
         return _dict.size();
     }
-    Value *addVariable(const char *varName)
+    Value *addVariable(const ObjectString *varName)
     {
         auto itPair = _dict.insert({varName, Value{}});
-        ASSERT_MSG(itPair.second == true, "Trying to add variable(%s) twice", varName);
+        ASSERT_MSG(itPair.second == true, "Trying to add variable(%s) twice", varName->chars);
         return &(itPair.first->second);
     }
-    bool removeVariable(const char *varName)
+    bool removeVariable(const ObjectString *varName)
     {
         auto varIt = _dict.find(varName);
         if (varIt != _dict.end())
@@ -39,10 +40,10 @@ struct Environment
             return true;
         }
 
-        FAIL_MSG("Variable '%s' not defined in this environment", varName);
+        FAIL_MSG("Variable '%s' not defined in this environment", varName->chars);
         return false;
     }
-    Value *findVariable(const char *varName)
+    Value *findVariable(const ObjectString *varName)
     {
         auto varIt = _dict.find(varName);
         if (varIt != _dict.end())
@@ -55,17 +56,30 @@ struct Environment
         }
         return nullptr;
     }
+    void markVariables() const
+    {
+        for (const auto &it : _dict)
+        {
+            GarbageCollector::markObject(it.first);
+            GarbageCollector::markValue(it.second);
+        }
+    }
     void print() const
     {
         for (const auto &it : _dict)
         {
-            printf("%s=[", it.first.c_str());
+            printf("%s=[", it.first->chars);
             printValueDebug(it.second);
             printf("]");
         }
         printf("\n");
     }
 
-    std::unordered_map<std::string, Value> _dict;
-    Environment                           *_parentEnvironment = nullptr;
+    // names are interned, so they are keyed by pointer using the cached string hash
+    struct NameHash
+    {
+        size_t operator()(const ObjectString *name) const { return name->hash; }
+    };
+    std::unordered_map<const ObjectString *, Value, NameHash> _dict;
+    Environment                                              *_parentEnvironment = nullptr;
 };
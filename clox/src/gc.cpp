@@ -0,0 +1,171 @@
+#include "gc.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "object.h"
+#include "value.h"
+
+std::vector<std::pair<const void *, GarbageCollector::mark_roots_t>> GarbageCollector::s_roots;
+std::vector<const Object *>                                          GarbageCollector::s_grayStack;
+
+GarbageCollector::Stats GarbageCollector::s_stats;
+size_t                  GarbageCollector::s_nextCollection = GarbageCollector::kInitialThreshold;
+int                     GarbageCollector::s_pauseCount     = 0;
+
+void GarbageCollector::addRoots(const void *owner, mark_roots_t markRoots)
+{
+    ASSERT(std::none_of(s_roots.begin(), s_roots.end(), [owner](const auto &it) { return it.first == owner; }));
+    s_roots.push_back({owner, std::move(markRoots)});
+}
+
+void GarbageCollector::removeRoots(const void *owner)
+{
+    auto it = std::find_if(s_roots.begin(), s_roots.end(), [owner](const auto &it) { return it.first == owner; });
+    if (it != s_roots.end())
+    {
+        s_roots.erase(it);
+    }
+}
+
+void GarbageCollector::markObject(const Object *object)
+{
+    if (object == nullptr || object->isMarked)
+    {
+        return;
+    }
+    object->isMarked = true;
+    s_grayStack.push_back(object);
+}
+
+void GarbageCollector::markValue(const Value &value)
+{
+    if (value.is(Value::Type::Object))
+    {
+        markObject(value.asObject());
+    }
+}
+
+void GarbageCollector::onAllocate(size_t size)
+{
+    s_stats.bytesAllocated += size;
+    if (s_pauseCount > 0)
+    {
+        return;
+    }
+#if USING(DEBUG_STRESS_GC)
+    collect();
+#else   // #if USING(DEBUG_STRESS_GC)
+    if (s_stats.bytesAllocated > s_nextCollection)
+    {
+        collect();
+    }
+#endif  // #else // #if USING(DEBUG_STRESS_GC)
+}
+
+void GarbageCollector::onFree(size_t size)
+{
+    ASSERT(s_stats.bytesAllocated >= size);
+    s_stats.bytesAllocated -= size;
+}
+
+void GarbageCollector::collect()
+{
+    const auto   start        = std::chrono::steady_clock::now();
+    const size_t bytesAtStart = s_stats.bytesAllocated;
+
+    markRoots();
+    traceReferences();
+    sweep();
+
+    s_nextCollection = std::max(s_stats.bytesAllocated * kHeapGrowFactor, kInitialThreshold);
+
+    const uint64_t pauseNs = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    ++s_stats.collections;
+    s_stats.bytesFreed += bytesAtStart - s_stats.bytesAllocated;
+    s_stats.totalPauseNs += pauseNs;
+    s_stats.maxPauseNs = std::max(s_stats.maxPauseNs, pauseNs);
+}
+
+void GarbageCollector::printStats()
+{
+    printf("== GC: %zu collection(s), %zu byte(s) freed, %zu byte(s) alive, pause total %.3f ms / max %.3f ms ==\n",
+           s_stats.collections, s_stats.bytesFreed, s_stats.bytesAllocated, s_stats.totalPauseNs / 1e6,
+           s_stats.maxPauseNs / 1e6);
+}
+
+void GarbageCollector::markRoots()
+{
+    for (const auto &it : s_roots)
+    {
+        it.second();
+    }
+}
+
+void GarbageCollector::traceReferences()
+{
+    while (!s_grayStack.empty())
+    {
+        const Object *object = s_grayStack.back();
+        s_grayStack.pop_back();
+        blackenObject(object);
+    }
+}
+
+void GarbageCollector::blackenObject(const Object *object)
+{
+    switch (object->type)
+    {
+        case Object::Type::String: break;
+        case Object::Type::Function:
+        {
+            const ObjectFunction *function = object->asFunction();
+            markObject(function->name);
+            const Chunk::ValueArray &constants = function->chunk.getConstants();
+            for (const Value *constant = constants.cbegin(); constant != constants.cend(); ++constant)
+            {
+                markValue(*constant);
+            }
+            const Chunk::ValueArray &globalNames = function->chunk.getGlobalNames();
+            for (const Value *name = globalNames.cbegin(); name != globalNames.cend(); ++name)
+            {
+                markValue(*name);
+            }
+            break;
+        }
+        case Object::Type::Native: markObject(object->asNative()->name); break;
+        default: FAIL_MSG("Unsupported type: %d", object->type);
+    }
+}
+
+void GarbageCollector::sweep()
+{
+    // the intern table holds weak references
+    ObjectString::s_interned.removeIf([](const ObjectString &str) { return !str.isMarked; });
+
+    Object *previous = nullptr;
+    Object *object   = Object::s_allocatedList;
+    while (object != nullptr)
+    {
+        if (object->isMarked)
+        {
+            object->isMarked = false;
+            previous         = object;
+            object           = object->_allocatedNext;
+            continue;
+        }
+
+        Object *unreached = object;
+        object            = object->_allocatedNext;
+        if (previous != nullptr)
+        {
+            previous->_allocatedNext = object;
+        }
+        else
+        {
+            Object::s_allocatedList = object;
+        }
+        Object::FreeObject(unreached);
+    }
+}
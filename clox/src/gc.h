@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include "utils/common.h"
+
+struct Object;
+struct Value;
+
+// Tracing mark-and-sweep collector over the Object allocation list.
+// Collections are triggered from Object::allocate once the allocated bytes go past a threshold that grows with the
+// live heap. Roots are provided by their owners (VM, compiler) through callbacks marking what they reference.
+struct GarbageCollector
+{
+    struct Stats
+    {
+        size_t   collections    = 0;
+        size_t   bytesAllocated = 0;  // currently alive (or not yet collected)
+        size_t   bytesFreed     = 0;  // total
+        uint64_t totalPauseNs   = 0;
+        uint64_t maxPauseNs     = 0;
+    };
+
+    using mark_roots_t = std::function<void()>;
+
+    static void addRoots(const void *owner, mark_roots_t markRoots);
+    static void removeRoots(const void *owner);
+
+    static void markObject(const Object *object);
+    static void markValue(const Value &value);
+
+    static void onAllocate(size_t size);
+    static void onFree(size_t size);
+
+    static void collect();
+
+    static const Stats &getStats() { return s_stats; }
+    static void         printStats();
+
+    // allocations don't trigger collections within this scope (i.e., objects under construction not rooted yet)
+    struct ScopedPause
+    {
+        ScopedPause() { ++s_pauseCount; }
+        ~ScopedPause() { --s_pauseCount; }
+    };
+
+   private:
+    static void markRoots();
+    static void traceReferences();
+    static void blackenObject(const Object *object);
+    static void sweep();
+
+    static constexpr size_t kInitialThreshold = 1024 * 1024;
+    static constexpr size_t kHeapGrowFactor   = 2;
+
+    static std::vector<std::pair<const void *, mark_roots_t>> s_roots;
+    static std::vector<const Object *>                        s_grayStack;
+
+    static Stats  s_stats;
+    static size_t s_nextCollection;
+    static int    s_pauseCount;
+};
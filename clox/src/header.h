@@ -23,14 +23,12 @@ struct Version
     }
 };
 
-[[maybe_unused]] static std::ostream& operator<<(std::ostream& os, const Version& v)
+[[maybe_unused]] static std::string toString(const Version& v)
 {
-    using write_t = int;
-    os << (write_t)v.major << "." << (write_t)v.minor << v.tag << (write_t)v.build;
-    return os;
+    return format("%d.%d%c%d", v.major, v.minor, v.tag, v.build);
 }
 
-static constexpr Version VERSION{0, 0, 1, 'a'};
+static constexpr Version VERSION{0, 6, 1, 'a'};
 
 struct Header
 {
@@ -38,33 +36,34 @@ struct Header
     static constexpr Version version  = VERSION;
 };
 
-static Result<void> writeHeader(std::ostream& o_stream)
+[[maybe_unused]] static Result<void> writeHeader(serde::BufferWriter& writer)
 {
     ASSERT_MSG(serde::isLittleEndian(), "not supported, need reverting bytes");
 
-    serde::SerializeN(o_stream, Header::magic, ARRAY_COUNT(Header::magic));
-    serde::Serialize(o_stream, Header::version);
+    serde::SerializeN(writer, Header::magic, ARRAY_COUNT(Header::magic));
+    serde::Serialize(writer, Header::version);
     return Result<void>();
 }
 
-static Result<void> readHeader(std::istream& i_stream)
+[[maybe_unused]] static Result<void> readHeader(serde::BufferReader& reader)
 {
     ASSERT_MSG(serde::isLittleEndian(), "not supported, need reverting bytes");
 
-    char   tempStr[32];
-    serde::DeserializeN(i_stream, tempStr, ARRAY_COUNT(Header::magic));
+    char tempStr[32] = {};
+    serde::DeserializeN(reader, tempStr, ARRAY_COUNT(Header::magic));
     if (0 != strncmp(Header::magic, tempStr, ARRAY_COUNT(Header::magic)))
     {
         FAIL();
-        return Result<void>::error_t(format("Invalid MagicID: %s != %s\n", tempStr, Header::magic));
+        return Result<void>::error_t(format("Invalid MagicID: %.8s != %.8s\n", tempStr, Header::magic));
     }
 
     Version version;
-    serde::Deserialize(i_stream, version);
+    serde::Deserialize(reader, version);
     if (Header::version != version)
     {
         FAIL();
-        return Result<void>::error_t(format("Invalid version %d.%d != %d.%d expected\n", version, Header::version));
+        return Result<void>::error_t(format("Invalid version %d.%d != %d.%d expected\n", version.major, version.minor,
+                                            Header::version.major, Header::version.minor));
     }
 
     //LOG_INFO("Code ver: ");
@@ -0,0 +1,765 @@
+#include "jit.h"
+
+#if USING(JIT)
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstring>
+
+#include "object.h"
+
+// the generated code reads and writes Values directly
+struct ValueLayout
+{
+    static constexpr int32_t kPayload = offsetof(Value, _as);
+    static constexpr int32_t kType    = offsetof(Value, _type);
+};
+static_assert(sizeof(Value) == 16 && sizeof(Value::Type) == 1, "Value layout expected by the JIT templates");
+
+namespace jit
+{
+Code::~Code()
+{
+    if (memory != nullptr)
+    {
+        munmap(memory, size);
+    }
+}
+
+namespace
+{
+enum Reg : uint8_t
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15,
+};
+
+// callee-saved, so they survive the calls to the slow paths
+constexpr Reg kStackTop = RBX;
+constexpr Reg kSlots    = R12;
+constexpr Reg kGlobals  = R13;
+constexpr Reg kFrame    = R14;
+
+constexpr int32_t kValueSize = sizeof(Value);
+// operands on top of the stack, relative to the stack top
+constexpr int32_t kTop    = -kValueSize;
+constexpr int32_t kSecond = -2 * kValueSize;
+
+enum class Cond : uint8_t
+{
+    Overflow     = 0x0,
+    Equal        = 0x4,
+    NotEqual     = 0x5,
+    Less         = 0xC,
+    GreaterEqual = 0xD,
+    LessEqual    = 0xE,
+    Greater      = 0xF,
+};
+
+// just the x86-64 encodings used by the templates, memory operands always take a 32-bit displacement
+struct Assembler
+{
+    using label_t = size_t;
+
+    std::vector<uint8_t> bytes;
+
+    size_t getPosition() const { return bytes.size(); }
+
+    void emit(uint8_t byte) { bytes.push_back(byte); }
+    void emit32(uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i, value >>= 8)
+        {
+            emit(static_cast<uint8_t>(value));
+        }
+    }
+    void emit64(uint64_t value)
+    {
+        emit32(static_cast<uint32_t>(value));
+        emit32(static_cast<uint32_t>(value >> 32));
+    }
+
+    void rex(bool wide, uint8_t reg, uint8_t base)
+    {
+        const uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg >> 3) << 2) | (base >> 3);
+        if (prefix != 0x40)
+        {
+            emit(prefix);
+        }
+    }
+    void modrmMemory(uint8_t reg, uint8_t base, int32_t disp)
+    {
+        emit(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP)
+        {
+            emit(0x24);  // SIB: no index
+        }
+        emit32(static_cast<uint32_t>(disp));
+    }
+    void modrmRegister(uint8_t reg, uint8_t rm) { emit(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+    void push(Reg reg)
+    {
+        rex(false, 0, reg);
+        emit(0x50 + (reg & 7));
+    }
+    void pop(Reg reg)
+    {
+        rex(false, 0, reg);
+        emit(0x58 + (reg & 7));
+    }
+    void ret() { emit(0xC3); }
+
+    void mov(Reg dst, Reg src)
+    {
+        rex(true, src, dst);
+        emit(0x89);
+        modrmRegister(src, dst);
+    }
+    void load(Reg dst, Reg base, int32_t disp)
+    {
+        rex(true, dst, base);
+        emit(0x8B);
+        modrmMemory(dst, base, disp);
+    }
+    void store(Reg base, int32_t disp, Reg src)
+    {
+        rex(true, src, base);
+        emit(0x89);
+        modrmMemory(src, base, disp);
+    }
+    void movImm64(Reg dst, uint64_t value)
+    {
+        rex(true, 0, dst);
+        emit(0xB8 + (dst & 7));
+        emit64(value);
+    }
+    void movImm32(Reg dst, uint32_t value)  // zero-extended
+    {
+        rex(false, 0, dst);
+        emit(0xB8 + (dst & 7));
+        emit32(value);
+    }
+    void addImm(Reg dst, int32_t value)
+    {
+        rex(true, 0, dst);
+        emit(0x81);
+        modrmRegister(0, dst);
+        emit32(static_cast<uint32_t>(value));
+    }
+    void subImm(Reg dst, int32_t value)
+    {
+        rex(true, 0, dst);
+        emit(0x81);
+        modrmRegister(5, dst);
+        emit32(static_cast<uint32_t>(value));
+    }
+
+    // dst <op>= [base + disp]
+    void addLoad(Reg dst, Reg base, int32_t disp)
+    {
+        rex(true, dst, base);
+        emit(0x03);
+        modrmMemory(dst, base, disp);
+    }
+    void subLoad(Reg dst, Reg base, int32_t disp)
+    {
+        rex(true, dst, base);
+        emit(0x2B);
+        modrmMemory(dst, base, disp);
+    }
+    void imulLoad(Reg dst, Reg base, int32_t disp)
+    {
+        rex(true, dst, base);
+        emit(0x0F);
+        emit(0xAF);
+        modrmMemory(dst, base, disp);
+    }
+    void cmpLoad(Reg dst, Reg base, int32_t disp)
+    {
+        rex(true, dst, base);
+        emit(0x3B);
+        modrmMemory(dst, base, disp);
+    }
+
+    void cmpByte(Reg base, int32_t disp, uint8_t value)
+    {
+        rex(false, 0, base);
+        emit(0x80);
+        modrmMemory(7, base, disp);
+        emit(value);
+    }
+    void movByte(Reg base, int32_t disp, uint8_t value)
+    {
+        rex(false, 0, base);
+        emit(0xC6);
+        modrmMemory(0, base, disp);
+        emit(value);
+    }
+    void storeAL(Reg base, int32_t disp)
+    {
+        rex(false, RAX, base);
+        emit(0x88);
+        modrmMemory(RAX, base, disp);
+    }
+    void loadByteEAX(Reg base, int32_t disp)  // movzx
+    {
+        rex(false, RAX, base);
+        emit(0x0F);
+        emit(0xB6);
+        modrmMemory(RAX, base, disp);
+    }
+    void cmpAL(uint8_t value)
+    {
+        emit(0x3C);
+        emit(value);
+    }
+    void testAL()
+    {
+        emit(0x84);
+        emit(0xC0);
+    }
+    void setAL(Cond cond)
+    {
+        emit(0x0F);
+        emit(0x90 | static_cast<uint8_t>(cond));
+        emit(0xC0);
+    }
+
+    // Values are copied as two 64-bit halves through rcx and rdx: the templates store payloads and type tags
+    // separately, a single 16-byte load right after them couldn't be forwarded from those stores and would stall
+    void copyValue(Reg dstBase, int32_t dstDisp, Reg srcBase, int32_t srcDisp)
+    {
+        load(RCX, srcBase, srcDisp);
+        load(RDX, srcBase, srcDisp + kValueSize / 2);
+        store(dstBase, dstDisp, RCX);
+        store(dstBase, dstDisp + kValueSize / 2, RDX);
+    }
+
+    void call(const void *function)
+    {
+        movImm64(RAX, reinterpret_cast<uint64_t>(function));
+        emit(0xFF);
+        modrmRegister(2, RAX);
+    }
+    void jmp(Reg reg)
+    {
+        rex(false, 0, reg);
+        emit(0xFF);
+        modrmRegister(4, reg);
+    }
+
+    // labels: rel32 jumps patched once every label is bound
+    label_t newLabel()
+    {
+        _labels.push_back(kUnbound);
+        return _labels.size() - 1;
+    }
+    void bind(label_t label) { _labels[label] = getPosition(); }
+    void jmp(label_t label)
+    {
+        emit(0xE9);
+        addFixup(label);
+    }
+    void jcc(Cond cond, label_t label)
+    {
+        emit(0x0F);
+        emit(0x80 | static_cast<uint8_t>(cond));
+        addFixup(label);
+    }
+    // false if a jump goes to an unbound label (i.e., a bytecode jump not landing on an instruction)
+    bool resolveLabels()
+    {
+        for (const auto &[position, label] : _fixups)
+        {
+            if (_labels[label] == kUnbound)
+            {
+                return false;
+            }
+            const int64_t rel = static_cast<int64_t>(_labels[label]) - static_cast<int64_t>(position + 4);
+            const auto    rel32 = static_cast<uint32_t>(static_cast<int32_t>(rel));
+            memcpy(&bytes[position], &rel32, sizeof(rel32));
+        }
+        return true;
+    }
+
+   private:
+    static constexpr size_t kUnbound = SIZE_MAX;
+
+    void addFixup(label_t label)
+    {
+        _fixups.emplace_back(getPosition(), label);
+        emit32(0);
+    }
+
+    std::vector<size_t>                      _labels;
+    std::vector<std::pair<size_t, label_t>> _fixups;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// slow paths: the operands on top of the stack are replaced by the result, false when the interpreter has to execute
+// the instruction instead (operands it reports as a runtime error)
+
+bool isString(const Value &value)
+{
+    return value.is(Value::Type::Object) && value.asObject()->type == Object::Type::String;
+}
+
+bool bothNumbers(const Value *top) { return top[-2].isNumber() && top[-1].isNumber(); }
+
+bool orderable(const Value *top) { return bothNumbers(top) || (isString(top[-2]) && isString(top[-1])); }
+
+template <OpCode OP>
+bool binaryOp(Value *top)
+{
+    const Value &a = top[-2];
+    const Value &b = top[-1];
+    Value        result;
+    switch (OP)
+    {
+        // strings are allocated with the operands still on the stack (rooted)
+        case OpCode::Add: result = orderable(top) ? a + b : Value::Create(); break;
+        case OpCode::Subtract: result = bothNumbers(top) ? a - b : Value::Create(); break;
+        case OpCode::Multiply: result = bothNumbers(top) ? a * b : Value::Create(); break;
+        case OpCode::Divide: result = bothNumbers(top) ? a / b : Value::Create(); break;
+        case OpCode::Equal: result = Value::Create(a == b); break;
+        case OpCode::NotEqual: result = Value::Create(!(a == b)); break;
+        case OpCode::Greater: result = orderable(top) ? Value::Create(a > b) : Value::Create(); break;
+        case OpCode::Less: result = orderable(top) ? Value::Create(a < b) : Value::Create(); break;
+        case OpCode::GreaterEqual: result = orderable(top) ? Value::Create(!(a < b)) : Value::Create(); break;
+        case OpCode::LessEqual: result = orderable(top) ? Value::Create(!(a > b)) : Value::Create(); break;
+        default: break;
+    }
+    if (result.is(Value::Type::Undefined))
+    {
+        return false;
+    }
+    top[-2] = result;
+    return true;
+}
+
+bool negateOp(Value *top)
+{
+    if (!top[-1].isNumber())
+    {
+        return false;
+    }
+    top[-1] = -top[-1];
+    return true;
+}
+
+bool notOp(Value *top)
+{
+    top[-1] = Value::Create(top[-1].isFalsey());
+    return true;
+}
+
+bool printOp(Value *top)
+{
+    printValue(top[-1]);
+    return true;
+}
+
+using slow_path_t = bool (*)(Value *top);
+
+slow_path_t getBinarySlowPath(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::Add: return &binaryOp<OpCode::Add>;
+        case OpCode::Subtract: return &binaryOp<OpCode::Subtract>;
+        case OpCode::Multiply: return &binaryOp<OpCode::Multiply>;
+        case OpCode::Divide: return &binaryOp<OpCode::Divide>;
+        case OpCode::Equal: return &binaryOp<OpCode::Equal>;
+        case OpCode::NotEqual: return &binaryOp<OpCode::NotEqual>;
+        case OpCode::Greater: return &binaryOp<OpCode::Greater>;
+        case OpCode::Less: return &binaryOp<OpCode::Less>;
+        case OpCode::GreaterEqual: return &binaryOp<OpCode::GreaterEqual>;
+        case OpCode::LessEqual: return &binaryOp<OpCode::LessEqual>;
+        default: return nullptr;
+    }
+}
+
+Cond getComparison(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::Equal: return Cond::Equal;
+        case OpCode::NotEqual: return Cond::NotEqual;
+        case OpCode::Greater: return Cond::Greater;
+        case OpCode::Less: return Cond::Less;
+        case OpCode::GreaterEqual: return Cond::GreaterEqual;
+        default: return Cond::LessEqual;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct Translator
+{
+    const Chunk &chunk;
+    const size_t globalCount;
+    Assembler    as;
+
+    std::vector<Assembler::label_t>                       instructionLabels;  // by code offset
+    std::vector<std::pair<Assembler::label_t, codepos_t>> exits;              // out of line exit stubs
+    Assembler::label_t                                    epilogue = 0;
+
+    Translator(const Chunk &chunk, size_t globalCount) : chunk(chunk), globalCount(globalCount) {}
+
+    // leaves the instruction at codePos to the interpreter
+    void exitTo(codepos_t codePos)
+    {
+        as.movImm32(RAX, codePos);
+        as.jmp(epilogue);
+    }
+    Assembler::label_t newExit(codepos_t codePos)
+    {
+        const Assembler::label_t label = as.newLabel();
+        exits.emplace_back(label, codePos);
+        return label;
+    }
+
+    void pushValue(Reg base, int32_t disp)
+    {
+        as.copyValue(kStackTop, 0, base, disp);
+        as.addImm(kStackTop, kValueSize);
+    }
+
+    // the collector marks the VM stack up to its stack top, which has to be up to date before allocating
+    void syncStackTop()
+    {
+        as.load(RCX, kFrame, offsetof(Frame, stackTop));
+        as.store(RCX, 0, kStackTop);
+    }
+
+    // calls the slow path on the stack top, leaving the instruction to the interpreter if it fails
+    void callSlowPath(slow_path_t slowPath, codepos_t codePos, int32_t popped)
+    {
+        as.mov(RDI, kStackTop);
+        as.call(reinterpret_cast<const void *>(slowPath));
+        as.testAL();
+        as.jcc(Cond::Equal, newExit(codePos));
+        if (popped > 0)
+        {
+            as.subImm(kStackTop, popped * kValueSize);
+        }
+    }
+
+    void guardIntegers(Assembler::label_t slowPath)
+    {
+        as.cmpByte(kStackTop, kSecond + ValueLayout::kType, static_cast<uint8_t>(Value::Type::Integer));
+        as.jcc(Cond::NotEqual, slowPath);
+        as.cmpByte(kStackTop, kTop + ValueLayout::kType, static_cast<uint8_t>(Value::Type::Integer));
+        as.jcc(Cond::NotEqual, slowPath);
+    }
+
+    // Add/Subtract/Multiply: integers inline (overflows promote in the slow path), the rest through Value operators
+    void arithmetic(OpCode op, codepos_t codePos)
+    {
+        const Assembler::label_t slowPath = as.newLabel();
+        const Assembler::label_t done     = as.newLabel();
+        if (op != OpCode::Divide)
+        {
+            guardIntegers(slowPath);
+            as.load(RAX, kStackTop, kSecond + ValueLayout::kPayload);
+            switch (op)
+            {
+                case OpCode::Add: as.addLoad(RAX, kStackTop, kTop + ValueLayout::kPayload); break;
+                case OpCode::Subtract: as.subLoad(RAX, kStackTop, kTop + ValueLayout::kPayload); break;
+                default: as.imulLoad(RAX, kStackTop, kTop + ValueLayout::kPayload); break;
+            }
+            as.jcc(Cond::Overflow, slowPath);
+            as.store(kStackTop, kSecond + ValueLayout::kPayload, RAX);
+            as.subImm(kStackTop, kValueSize);
+            as.jmp(done);
+        }
+        as.bind(slowPath);
+        if (op == OpCode::Add)
+        {
+            syncStackTop();
+        }
+        callSlowPath(getBinarySlowPath(op), codePos, 1);
+        as.bind(done);
+    }
+
+    void comparison(OpCode op, codepos_t codePos)
+    {
+        const Assembler::label_t slowPath = as.newLabel();
+        const Assembler::label_t done     = as.newLabel();
+        guardIntegers(slowPath);
+        as.load(RAX, kStackTop, kSecond + ValueLayout::kPayload);
+        as.cmpLoad(RAX, kStackTop, kTop + ValueLayout::kPayload);
+        as.setAL(getComparison(op));
+        as.storeAL(kStackTop, kSecond + ValueLayout::kPayload);
+        as.movByte(kStackTop, kSecond + ValueLayout::kType, static_cast<uint8_t>(Value::Type::Bool));
+        as.subImm(kStackTop, kValueSize);
+        as.jmp(done);
+        as.bind(slowPath);
+        callSlowPath(getBinarySlowPath(op), codePos, 1);
+        as.bind(done);
+    }
+
+    // the condition stays on the stack, falsey: null or false
+    void conditionalJump(bool jumpIfFalse, Assembler::label_t target)
+    {
+        const Assembler::label_t next = as.newLabel();
+        as.loadByteEAX(kStackTop, kTop + ValueLayout::kType);
+        as.cmpAL(static_cast<uint8_t>(Value::Type::Null));
+        as.jcc(Cond::Equal, jumpIfFalse ? target : next);
+        as.cmpAL(static_cast<uint8_t>(Value::Type::Bool));
+        as.jcc(Cond::NotEqual, jumpIfFalse ? next : target);
+        as.cmpByte(kStackTop, kTop + ValueLayout::kPayload, 0);
+        as.jcc(jumpIfFalse ? Cond::Equal : Cond::NotEqual, target);
+        as.bind(next);
+    }
+
+    void prologue()
+    {
+        as.push(RBX);
+        as.push(R12);
+        as.push(R13);
+        as.push(R14);
+        as.push(R15);  // keeps the stack 16-byte aligned for the calls
+        as.mov(kFrame, RDI);
+        as.load(RAX, RDI, offsetof(Frame, stackTop));
+        as.load(kStackTop, RAX, 0);
+        as.load(kSlots, RDI, offsetof(Frame, slots));
+        as.load(kGlobals, RDI, offsetof(Frame, globals));
+        as.load(RAX, RDI, offsetof(Frame, entry));
+        as.jmp(RAX);
+    }
+
+    // eax: position of the instruction left to the interpreter
+    void emitEpilogue()
+    {
+        as.bind(epilogue);
+        as.load(RCX, kFrame, offsetof(Frame, stackTop));
+        as.store(RCX, 0, kStackTop);
+        as.pop(R15);
+        as.pop(R14);
+        as.pop(R13);
+        as.pop(R12);
+        as.pop(RBX);
+        as.ret();
+    }
+
+    Result<void> translate(std::vector<uint32_t> &o_entries)
+    {
+        const opcode_t *code     = chunk.getCode();
+        const codepos_t codeSize = chunk.getCodeSize();
+        const Value    *constants = chunk.getConstants().data();
+
+        epilogue = as.newLabel();
+        instructionLabels.resize(codeSize + 1);  // + the end of the code
+        for (Assembler::label_t &label : instructionLabels)
+        {
+            label = as.newLabel();
+        }
+        o_entries.assign(codeSize, kNoEntry);
+
+        prologue();
+
+        for (codepos_t offset = 0; offset < codeSize;)
+        {
+            const OpCode    op    = OpCode(code[offset]);
+            const uint8_t   bytes = getOperandBytes(op);
+            const codepos_t next  = offset + 1 + bytes;
+            if (next > codeSize)
+            {
+                return Error<>(format("Truncated instruction at %u", offset));
+            }
+            const uint32_t operand = readOperand(code + offset + 1, bytes);
+            as.bind(instructionLabels[offset]);
+            o_entries[offset] = static_cast<uint32_t>(as.getPosition());
+
+            // operands become addresses in the machine code, checked even though loading bytecode checks them too
+            const OpCode generic = getShortOpCode(getGenericOpCode(op));
+            switch (generic)
+            {
+                case OpCode::Constant:
+                    if (operand >= chunk.getConstants().size())
+                    {
+                        return Error<>(format("Constant out of range at %u", offset));
+                    }
+                    break;
+                case OpCode::LocalVarGet:
+                case OpCode::LocalVarSet:
+                    if (operand >= limits::kMaxLocals)
+                    {
+                        return Error<>(format("Local out of range at %u", offset));
+                    }
+                    break;
+                case OpCode::GlobalSlotDef:
+                case OpCode::GlobalSlotGet:
+                case OpCode::GlobalSlotSet:
+                    if (operand >= globalCount)
+                    {
+                        return Error<>(format("Global out of range at %u", offset));
+                    }
+                    break;
+                default: break;
+            }
+            switch (generic)
+            {
+                case OpCode::Constant:
+                    as.movImm64(RAX, reinterpret_cast<uint64_t>(constants + operand));
+                    pushValue(RAX, 0);
+                    break;
+                case OpCode::Null:
+                    as.movByte(kStackTop, ValueLayout::kType, static_cast<uint8_t>(Value::Type::Null));
+                    as.addImm(kStackTop, kValueSize);
+                    break;
+                case OpCode::True:
+                case OpCode::False:
+                    as.movByte(kStackTop, ValueLayout::kPayload, generic == OpCode::True ? 1 : 0);
+                    as.movByte(kStackTop, ValueLayout::kType, static_cast<uint8_t>(Value::Type::Bool));
+                    as.addImm(kStackTop, kValueSize);
+                    break;
+                case OpCode::Pop: as.subImm(kStackTop, kValueSize); break;
+
+                case OpCode::LocalVarGet: pushValue(kSlots, static_cast<int32_t>(operand) * kValueSize); break;
+                case OpCode::LocalVarSet:
+                    as.copyValue(kSlots, static_cast<int32_t>(operand) * kValueSize, kStackTop, kTop);
+                    break;
+
+                // reading or writing an undeclared/undefined global is a runtime error left to the interpreter
+                case OpCode::GlobalSlotDef:
+                    as.subImm(kStackTop, kValueSize);
+                    as.copyValue(kGlobals, static_cast<int32_t>(operand) * kValueSize, kStackTop, 0);
+                    break;
+                case OpCode::GlobalSlotGet:
+                {
+                    const int32_t          global = static_cast<int32_t>(operand) * kValueSize;
+                    const Assembler::label_t fail = newExit(offset);
+                    as.cmpByte(kGlobals, global + ValueLayout::kType, static_cast<uint8_t>(Value::Type::Undefined));
+                    as.jcc(Cond::Equal, fail);
+                    as.cmpByte(kGlobals, global + ValueLayout::kType, static_cast<uint8_t>(Value::Type::Null));
+                    as.jcc(Cond::Equal, fail);
+                    pushValue(kGlobals, global);
+                    break;
+                }
+                case OpCode::GlobalSlotSet:
+                {
+                    const int32_t global = static_cast<int32_t>(operand) * kValueSize;
+                    as.cmpByte(kGlobals, global + ValueLayout::kType, static_cast<uint8_t>(Value::Type::Undefined));
+                    as.jcc(Cond::Equal, newExit(offset));
+                    as.copyValue(kGlobals, global, kStackTop, kTop);
+                    break;
+                }
+
+                case OpCode::Add:
+                case OpCode::Subtract:
+                case OpCode::Multiply:
+                case OpCode::Divide: arithmetic(generic, offset); break;
+                case OpCode::Equal:
+                case OpCode::NotEqual:
+                case OpCode::Greater:
+                case OpCode::Less:
+                case OpCode::GreaterEqual:
+                case OpCode::LessEqual: comparison(generic, offset); break;
+                case OpCode::Negate: callSlowPath(&negateOp, offset, 0); break;
+                case OpCode::Not: callSlowPath(&notOp, offset, 0); break;
+                case OpCode::Print: callSlowPath(&printOp, offset, 1); break;
+
+                case OpCode::Jump:
+                case OpCode::JumpIfFalse:
+                case OpCode::JumpIfTrue:
+                {
+                    const int64_t target = static_cast<int64_t>(next) + readJumpOffset(code + offset + 1, bytes);
+                    if (target < 0 || target > codeSize)
+                    {
+                        return Error<>(format("Jump out of the code at %u", offset));
+                    }
+                    const Assembler::label_t label = instructionLabels[static_cast<codepos_t>(target)];
+                    if (generic == OpCode::Jump)
+                    {
+                        as.jmp(label);
+                    }
+                    else
+                    {
+                        conditionalJump(generic == OpCode::JumpIfFalse, label);
+                    }
+                    break;
+                }
+
+                case OpCode::Skip:
+                case OpCode::ScopeBegin:
+                case OpCode::ScopeEnd: break;
+
+                // calls, returns and variables by name
+                default: exitTo(offset); break;
+            }
+            offset = next;
+        }
+        as.bind(instructionLabels[codeSize]);
+        exitTo(codeSize);
+
+        for (const auto &[label, codePos] : exits)
+        {
+            as.bind(label);
+            exitTo(codePos);
+        }
+        emitEpilogue();
+
+        if (!as.resolveLabels())
+        {
+            return Error<>("Jump not landing on an instruction");
+        }
+        return Result<void>();
+    }
+};
+}  // namespace
+
+Result<std::shared_ptr<Code>> compile(const Chunk &chunk, size_t globalCount)
+{
+    auto       code = std::make_shared<Code>();
+    Translator translator(chunk, globalCount);
+    auto       translateResult = translator.translate(code->entries);
+    if (!translateResult.isOk())
+    {
+        return translateResult.error();
+    }
+
+    // written while writable only, then executable only
+    const std::vector<uint8_t> &bytes = translator.as.bytes;
+    void *memory = mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        return Error<>("Failed to allocate memory for the machine code");
+    }
+    code->memory = static_cast<uint8_t *>(memory);
+    code->size   = bytes.size();
+    memcpy(code->memory, bytes.data(), bytes.size());
+    if (mprotect(code->memory, code->size, PROT_READ | PROT_EXEC) != 0)
+    {
+        return Error<>("Failed to make the machine code executable");
+    }
+    return code;
+}
+
+codepos_t run(const Code &code, Frame &frame, codepos_t codePos)
+{
+    ASSERT(codePos < code.entries.size() && code.entries[codePos] != kNoEntry);
+    using native_t = codepos_t (*)(Frame *);
+    native_t native;
+    static_assert(sizeof(native) == sizeof(code.memory), "Function and data pointers expected to be the same size");
+    memcpy(&native, &code.memory, sizeof(native));
+
+    frame.entry = code.memory + code.entries[codePos];
+    return native(&frame);
+}
+}  // namespace jit
+
+#endif  // #if USING(JIT)
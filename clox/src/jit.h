@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "chunk.h"
+#include "utils/common.h"
+
+namespace jit
+{
+// calls and loop back-edges of a chunk before it gets compiled
+constexpr uint32_t kDefaultThreshold = 100;
+}  // namespace jit
+
+#if USING(JIT)
+// Baseline template JIT: translates the bytecode of a hot chunk into x86-64 machine code, one template per opcode.
+// The VM stack top lives in a register, locals and globals are addressed directly and jumps become native jumps.
+// Slow paths (type guards failing, strings, printing) call back into the Value operators. Instructions it doesn't
+// translate (calls, returns, variables by name) and runtime errors exit to the interpreter, which executes them and
+// re-enters the machine code at the next call or loop back-edge (see VirtualMachine::runJit).
+namespace jit
+{
+// machine code of a chunk, it can be entered at any instruction
+struct Code
+{
+    Code() = default;
+    ~Code();
+
+    Code(const Code &)            = delete;
+    Code &operator=(const Code &) = delete;
+
+    uint8_t              *memory = nullptr;
+    size_t                size   = 0;
+    std::vector<uint32_t> entries;  // native offset by code offset, kNoEntry inside operands
+};
+constexpr uint32_t kNoEntry = UINT32_MAX;
+
+// interpreter state handed to the machine code, the stack top is written back when it exits
+struct Frame
+{
+    Value        **stackTop;
+    Value         *slots;
+    Value         *globals;
+    const uint8_t *entry;
+};
+
+// globalCount is the size of the globals table the code runs with (Frame::globals)
+Result<std::shared_ptr<Code>> compile(const Chunk &chunk, size_t globalCount);
+
+// runs from the instruction at codePos up to one left to the interpreter, returning its position
+codepos_t run(const Code &code, Frame &frame, codepos_t codePos);
+}  // namespace jit
+#endif  // #if USING(JIT)
@@ -0,0 +1,66 @@
+#include "natives.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "utils/mapped_file.h"
+
+namespace natives
+{
+namespace
+{
+bool isString(const Value &value)
+{
+    return value.is(Value::Type::Object) && value.asObject()->type == Object::Type::String;
+}
+
+bool clockNative(const Value * /*args*/, Value *o_result)
+{
+    using clock_t       = std::chrono::steady_clock;
+    const auto duration = std::chrono::duration<double>(clock_t::now().time_since_epoch());
+    *o_result           = Value::Create(duration.count());
+    return true;
+}
+
+bool sqrtNative(const Value *args, Value *o_result)
+{
+    if (!args[0].isNumber())
+    {
+        return error(o_result, "sqrt: argument must be a number.");
+    }
+    *o_result = Value::Create(std::sqrt(args[0].toDouble()));
+    return true;
+}
+
+bool readFileNative(const Value *args, Value *o_result)
+{
+    if (!isString(args[0]))
+    {
+        return error(o_result, "readFile: argument must be a path string.");
+    }
+    MappedFile file;
+    auto       openResult = file.open(args[0].asObject()->asString()->chars);
+    if (!openResult.isOk())
+    {
+        return error(o_result, format("readFile: %s", openResult.error().message().c_str()).c_str());
+    }
+    *o_result = Value::CreateByCopy(reinterpret_cast<const char *>(file.getData()), file.getSize());
+    return true;
+}
+
+const Definition kStandard[] = {
+    {"clock", clockNative, 0},
+    {"sqrt", sqrtNative, 1},
+    {"readFile", readFileNative, 1},
+};
+}  // namespace
+
+std::span<const Definition> getStandard() { return kStandard; }
+
+bool error(Value *o_result, const char *message)
+{
+    *o_result = Value::CreateByCopy(message, strlen(message));
+    return false;
+}
+}  // namespace natives
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <span>
+
+#include "object.h"
+
+// Host functions available to every script, registered as globals by VirtualMachine::init (see defineNative)
+namespace natives
+{
+struct Definition
+{
+    const char *name;
+    NativeFn    function;
+    uint8_t     arity;
+};
+
+// clock():        seconds from an arbitrary start, high resolution (timing benchmarks)
+// sqrt(x):        square root of a number
+// readFile(path): whole file contents as a string
+std::span<const Definition> getStandard();
+
+// error message returned by a native, see NativeFn
+bool error(Value *o_result, const char *message);
+}  // namespace natives
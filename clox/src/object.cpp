@@ -5,37 +5,41 @@
 #include "utils/memory.h"
 #include "utils/serde.h"
 
-Object *Object::s_allocatedList = nullptr;
+Object       *Object::s_allocatedList = nullptr;
+SlabAllocator Object::s_allocator;
 
 const char *Object::getTypeName(Type type)
 {
     switch (type)
     {
         case Type::String: return "String";
+        case Type::Function: return "Function";
+        case Type::Native: return "Native";
         default: return "Undefined type";
     }
 }
 
-Result<void> Object::serialize(std::ostream &o_stream) const
+Result<void> Object::serialize(serde::BufferWriter &writer, StringPool *pool) const
 {
-    serde::Serialize(o_stream, type);
+    serde::Serialize(writer, type);
     switch (type)
     {
-        case Type::String: return asString()->serialize(o_stream);
+        case Type::String: return asString()->serialize(writer, pool);
+        case Type::Function: return asFunction()->serialize(writer);  // nested chunk, with its own string pool
         default: FAIL();
     }
     return Error<>(format("Unsupported type: %d\n", type));
 }
 
-Result<Object *> Object::deserialize(std::istream &i_stream)
+Result<Object *> Object::deserialize(serde::BufferReader &reader, const StringPool *pool)
 {
     Object::Type type;
-    serde::Deserialize(i_stream, type);
+    serde::Deserialize(reader, type);
     switch (type)
     {
         case Type::String:
         {
-            auto result = ObjectString::deserialize(i_stream);
+            auto result = ObjectString::deserialize(reader, pool);
             if (result.isOk())
             {
                 return result.extract();
@@ -45,7 +49,11 @@ Result<Object *> Object::deserialize(std::istream &i_stream)
         case Type::Function:
         {
             ObjectFunction *newFunction = ObjectFunction::Create();
-            newFunction->deserialize(i_stream);
+            auto            result      = newFunction->deserialize(reader);
+            if (!result.isOk())
+            {
+                return result.error();
+            }
             return newFunction;
         }
         default: FAIL();
@@ -59,15 +67,24 @@ void Object::FreeObject(Object *obj)
     {
         case Type::String:
         {
-            ObjectString *str = obj->asString();
-            DEALLOCATE(ObjectString, str);
+            ObjectString *str  = obj->asString();
+            const size_t  size = sizeof(ObjectString) + (str->hasInlineChars() ? str->length + 1 : 0);
+            GarbageCollector::onFree(size);
+            s_allocator.deallocate(str, size);
             break;
         }
         case Type::Function:
         {
             ObjectFunction *func = obj->asFunction();
+            GarbageCollector::onFree(sizeof(ObjectFunction));
             func->chunk.~Chunk();
-            DEALLOCATE(ObjectFunction, func);
+            s_allocator.deallocate(func, sizeof(ObjectFunction));
+            break;
+        }
+        case Type::Native:
+        {
+            GarbageCollector::onFree(sizeof(ObjectNative));
+            s_allocator.deallocate(obj, sizeof(ObjectNative));
             break;
         }
         default: FAIL_MSG("Unsupported type: %d", obj->type);
@@ -76,6 +93,8 @@ void Object::FreeObject(Object *obj)
 
 void Object::FreeObjects()
 {
+    ObjectString::FreeInterned();
+
     Object *object = s_allocatedList;
     while (object)
     {
@@ -83,6 +102,8 @@ void Object::FreeObjects()
         FreeObject(object);
         object = next;
     }
+    s_allocatedList = nullptr;
+    s_allocator.releaseSlabs();
 }
 
 Object *Object::operator+(const Object &other) const
@@ -145,138 +166,250 @@ void printObject(const Object &object)
             printf(">");
             break;
         }
+        case Object::Type::Native:
+        {
+            printf("<native fn ");
+            printObject(*object.asNative()->name);
+            printf(">");
+            break;
+        }
         default: FAIL_MSG("UNDEFINED OBJECT TYPE(%d)", object.type);
     }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Result<void> ObjectString::serialize(std::ostream &o_stream) const
+Result<void> ObjectString::serialize(serde::BufferWriter &writer, StringPool *pool) const
 {
+    if (pool != nullptr)
+    {
+        serde::Serialize(writer, pool->add(*this));
+        serde::Serialize(writer, this->length);
+        return Result<void>();
+    }
+
     if ((this->length < ((1L << 6) - 1)))
     {
         const uint8_t len = static_cast<uint8_t>(length << 2) | 0x01;
-        serde::Serialize(o_stream, len);
+        serde::Serialize(writer, len);
     }
     else if ((this->length < ((1L << 14) - 1)))
     {
         const uint16_t len = static_cast<uint16_t>(length << 2) | 0x02;
-        serde::Serialize(o_stream, len);
+        serde::Serialize(writer, len);
     }
     else
     {
         const uint32_t len = static_cast<uint32_t>(length << 2) | 0x00;
-        serde::Serialize(o_stream, len);
+        serde::Serialize(writer, len);
     }
 
-    serde::SerializeN(o_stream, this->chars, this->length);
+    serde::SerializeN(writer, this->chars, this->length);
     return Result<void>();
 }
 
-Result<ObjectString *> ObjectString::deserialize(std::istream &i_stream)
+Result<ObjectString *> ObjectString::deserialize(serde::BufferReader &reader, const StringPool *pool)
 {
+    if (pool != nullptr)
+    {
+        uint32_t offset = 0;
+        uint32_t length = 0;
+        serde::Deserialize(reader, offset);
+        serde::Deserialize(reader, length);
+        return pool->get(offset, length);
+    }
+
     uint32_t length = 0;
 
     uint8_t byte;
-    serde::Deserialize(i_stream, byte);
+    serde::Deserialize(reader, byte);
     length = byte;
 
     if ((byte & 0x03) == 2)
     {
         length = byte;
-        serde::Deserialize(i_stream, byte);
+        serde::Deserialize(reader, byte);
         length = (byte << 8) | length;
     }
     else if ((byte & 0x03) == 0)
     {
         length = byte;
-        serde::Deserialize(i_stream, byte);
+        serde::Deserialize(reader, byte);
         length = (byte << 8) | length;
-        serde::Deserialize(i_stream, byte);
+        serde::Deserialize(reader, byte);
         length = (byte << 16) | length;
-        serde::Deserialize(i_stream, byte);
+        serde::Deserialize(reader, byte);
         length = (byte << 24) | length;
     }
     length >>= 2;
 
-    constexpr size_t kSmallStringSize = 256;
-    if (length < kSmallStringSize)
+    // copied straight from the buffer (not NUL-terminated, so never in place)
+    const char *chars = reinterpret_cast<const char *>(reader.readInPlace(length));
+    if (chars == nullptr)
     {
-        char tempStr[kSmallStringSize];
-        serde::DeserializeN(i_stream, tempStr, length);
-        return CreateByCopy(tempStr, length);
-    }
-    else
-    {
-        std::vector<char> tempStr(length);
-        serde::DeserializeN(i_stream, tempStr.data(), length);
-        return CreateByCopy(tempStr.data(), length);
+        return Error<>(format("String truncated, %u bytes expected\n", length));
     }
+    return CreateByCopy(chars, length);
 }
 
-ObjectString *ObjectString::Create()
+HashSet<ObjectString> ObjectString::s_interned;
+
+ObjectString *ObjectString::Allocate(size_t length, uint32_t hash)
 {
-    ObjectString *newStringObj = Object::allocate<ObjectString>();
-    newStringObj->chars        = nullptr;
-    newStringObj->length       = 0;
+    ObjectString *newStringObj  = Object::allocate<ObjectString>(length + 1);
+    newStringObj->chars         = ((char *)newStringObj) + sizeof(ObjectString);
+    newStringObj->length        = static_cast<decltype(ObjectString::length)>(length);
+    newStringObj->hash          = hash;
+    newStringObj->chars[length] = '\0';
     return newStringObj;
 }
 
+ObjectString *ObjectString::Create() { return CreateByCopy("", 0); }
+
 ObjectString *ObjectString::CreateConcat(const char *str1, size_t len1, const char *str2, size_t len2)
 {
-    const size_t  newLength    = len1 + len2;
-    ObjectString *newStringObj = Object::allocate<ObjectString>(newLength + 1);
-    newStringObj->chars        = ((char *)newStringObj) + sizeof(ObjectString);
+    const size_t   newLength = len1 + len2;
+    const uint32_t hash      = hashString(str2, len2, hashString(str1, len1));
+    ObjectString  *interned  = s_interned.find(hash, [&](const ObjectString &str) {
+        return str.length == newLength && 0 == memcmp(str.chars, str1, len1) && 0 == memcmp(str.chars + len1, str2, len2);
+    });
+    if (interned != nullptr)
+    {
+        return interned;
+    }
+
+    ObjectString *newStringObj = Allocate(newLength, hash);
     memcpy(newStringObj->chars, str1, len1);
     memcpy(newStringObj->chars + len1, str2, len2);
-    newStringObj->length           = static_cast<uint8_t>(newLength);
-    newStringObj->length           = static_cast<decltype(length)>(newLength);
-    newStringObj->chars[newLength] = '\0';
+    s_interned.insert(newStringObj, hash);
     return newStringObj;
 }
 
+ObjectString *ObjectString::FindInterned(const char *str, size_t length, uint32_t hash)
+{
+    return s_interned.find(
+        hash, [&](const ObjectString &other) { return other.length == length && 0 == memcmp(other.chars, str, length); });
+}
+
 ObjectString *ObjectString::CreateByCopy(const char *str, size_t length)
 {
-    ObjectString *newStringObj = Object::allocate<ObjectString>(length + 1);
-    newStringObj->chars        = ((char *)newStringObj) + sizeof(ObjectString);
-    newStringObj->length       = static_cast<uint8_t>(length);
+    const uint32_t hash     = hashString(str, length);
+    ObjectString  *interned = FindInterned(str, length, hash);
+    if (interned != nullptr)
+    {
+        return interned;
+    }
+
+    ObjectString *newStringObj = Allocate(length, hash);
     memcpy(newStringObj->chars, str, length);
-    newStringObj->chars[length] = '\0';
+    s_interned.insert(newStringObj, hash);
+    return newStringObj;
+}
+
+ObjectString *ObjectString::CreateInPlace(const char *str, size_t length)
+{
+    ASSERT(str[length] == '\0');
+    const uint32_t hash     = hashString(str, length);
+    ObjectString  *interned = FindInterned(str, length, hash);
+    if (interned != nullptr)
+    {
+        return interned;
+    }
+
+    ObjectString *newStringObj = Object::allocate<ObjectString>();
+    newStringObj->chars        = const_cast<char *>(str);  // never written through
+    newStringObj->length       = static_cast<decltype(ObjectString::length)>(length);
+    newStringObj->hash         = hash;
+    s_interned.insert(newStringObj, hash);
     return newStringObj;
 }
 
 bool ObjectString::compare(const ObjectString &a, const ObjectString &b)
 {
-    return a.length == b.length && (0 == memcmp(a.chars, b.chars, a.length));
+    ASSERT((&a == &b) == (a.length == b.length && (0 == memcmp(a.chars, b.chars, a.length))));
+    return &a == &b;  // interned
 }
 
-Result<void> ObjectFunction::serialize(std::ostream &o_stream) const
+Result<void> ObjectFunction::serialize(serde::BufferWriter &writer) const
 {
-    this->name->serialize(o_stream);
-    serde::SerializeAs<uint8_t>(o_stream, this->arity);
-    this->chunk.serialize(o_stream);
-    return Result<void>();
+    this->name->serialize(writer);
+    serde::SerializeAs<uint8_t>(writer, this->arity);
+    return this->chunk.serialize(writer);
 }
 
-Result<void> ObjectFunction::deserialize(std::istream &i_stream)
+Result<void> ObjectFunction::deserialize(serde::BufferReader &reader)
 {
-    auto stringRes = ObjectString::deserialize(i_stream);
+    GarbageCollector::ScopedPause gcPause;  // not rooted until handed to the VM
+
+    auto stringRes = ObjectString::deserialize(reader);
     if (!stringRes.isOk())
     {
         return stringRes.error();
     }
     this->name = stringRes.extract();
-    serde::DeserializeAs<uint8_t>(i_stream, this->arity);
-    this->chunk.deserialize(i_stream);
+    serde::DeserializeAs<uint8_t>(reader, this->arity);
+    return this->chunk.deserialize(reader);
+}
 
-    return Result<void>();
+Result<void> ObjectFunction::deserializeInPlace(const uint8_t *image, size_t size)
+{
+    serde::BufferReader reader(image, size, true);
+    auto                deserializeResult = deserialize(reader);
+    if (!deserializeResult.isOk())
+    {
+        return deserializeResult.error();
+    }
+    return this->chunk.validateGlobalSlots(this->chunk.getGlobalNames().size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t StringPool::add(const ObjectString &string)
+{
+    ASSERT(_chars == nullptr);
+    auto [offsetIt, inserted] = _offsets.try_emplace(&string, static_cast<uint32_t>(_bytes.size()));
+    if (inserted)
+    {
+        _bytes.insert(_bytes.end(), string.chars, string.chars + string.length);
+        _bytes.push_back('\0');
+    }
+    return offsetIt->second;
 }
 
+Result<ObjectString *> StringPool::get(uint32_t offset, uint32_t length) const
+{
+    const char    *chars = getChars();
+    const uint32_t size  = getSize();
+    if (offset >= size || length >= size - offset || chars[offset + length] != '\0')
+    {
+        return Error<>(format("Invalid string pool entry: %u+%u, pool size %u\n", offset, length, size));
+    }
+    return _inPlace ? ObjectString::CreateInPlace(chars + offset, length)
+                    : ObjectString::CreateByCopy(chars + offset, length);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 ObjectFunction *ObjectFunction::Create(const char *name)
 {
+    GarbageCollector::ScopedPause gcPause;  // the function isn't reachable while allocating its name
+
     ObjectFunction *function = Object::allocate<ObjectFunction>();
     function->arity          = 0;
     function->name           = ObjectString::CreateByCopy(name, strlen(name));
     new ((Chunk *)&function->chunk) Chunk(name);
     return function;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+ObjectNative *ObjectNative::Create(const char *name, NativeFn function, uint8_t arity)
+{
+    GarbageCollector::ScopedPause gcPause;  // the native isn't reachable while allocating its name
+
+    ObjectNative *native = Object::allocate<ObjectNative>();
+    native->function     = function;
+    native->name         = ObjectString::CreateByCopy(name, strlen(name));
+    native->arity        = arity;
+    return native;
+}
@@ -2,10 +2,14 @@
 
 #include "value.h"
 #include "chunk.h"
+#include "gc.h"
+#include "table.h"
 #include "utils/memory.h"
+#include "utils/slab_allocator.h"
 
 struct ObjectString;
 struct ObjectFunction;
+struct ObjectNative;
 
 struct Object
 {
@@ -15,6 +19,7 @@ struct Object
         Object         *obj;
         ObjectString   *string;
         ObjectFunction *function;
+        ObjectNative   *native;
     } as;
 #endif  // #if USING(DEBUG_BUILD)
 
@@ -22,26 +27,31 @@ struct Object
     {
         String,
         Function,
+        Native,
         //
         Undefined,
         COUNT = Undefined,
     };
-    Type               type = Type::Undefined;
+    Type               type     = Type::Undefined;
+    mutable bool       isMarked = false;  // reached in the current GC mark phase
     static const char *getTypeName(Type type);
 
-    Result<void>            serialize(std::ostream &o_stream) const;
-    static Result<Object *> deserialize(std::istream &i_stream);
+    Result<void>            serialize(serde::BufferWriter &writer, StringPool *pool = nullptr) const;
+    static Result<Object *> deserialize(serde::BufferReader &reader, const StringPool *pool = nullptr);
 
     template <typename ObjectT>
     static ObjectT *allocate(size_t flexibleSize = 0)
     {
-        static_assert(std::is_same_v<ObjectT, ObjectString> || std::is_same_v<ObjectT, ObjectFunction>,
+        static_assert(std::is_same_v<ObjectT, ObjectString> || std::is_same_v<ObjectT, ObjectFunction> ||
+                          std::is_same_v<ObjectT, ObjectNative>,
                       "ObjectT not supported");
 
+        GarbageCollector::onAllocate(sizeof(ObjectT) + flexibleSize);
+
         ObjectT *newObject = nullptr;
         if (std::is_same_v<ObjectString, ObjectT>)
         {
-            newObject       = ALLOCATE_FLEX(ObjectT, flexibleSize);
+            newObject       = static_cast<ObjectT *>(s_allocator.allocate(sizeof(ObjectT) + flexibleSize));
             newObject->type = ObjectT::Type::String;
 #if USING(DEBUG_BUILD)
             newObject->as.obj = newObject;
@@ -49,10 +59,18 @@ struct Object
         }
         else if (std::is_same_v<ObjectFunction, ObjectT>)
         {
-            newObject       = ALLOCATE_FLEX(ObjectT, flexibleSize);
+            newObject       = static_cast<ObjectT *>(s_allocator.allocate(sizeof(ObjectT) + flexibleSize));
             newObject->type = ObjectT::Type::Function;
 #if USING(DEBUG_BUILD)
             newObject->as.obj = newObject;
+#endif  // #if USING(DEBUG_BUILD)
+        }
+        else if (std::is_same_v<ObjectNative, ObjectT>)
+        {
+            newObject       = static_cast<ObjectT *>(s_allocator.allocate(sizeof(ObjectT) + flexibleSize));
+            newObject->type = ObjectT::Type::Native;
+#if USING(DEBUG_BUILD)
+            newObject->as.obj = newObject;
 #endif  // #if USING(DEBUG_BUILD)
         }
         else
@@ -63,6 +81,7 @@ struct Object
         ////////////////////////////////////////////////////////////////////////////////
         if (newObject)
         {
+            newObject->isMarked       = false;
             newObject->_allocatedNext = s_allocatedList;
             s_allocatedList           = newObject;
         }  ////////////////////////////////////////////////////////////////////////////////
@@ -92,35 +111,86 @@ struct Object
         return (ObjectFunction*)this;
     }
 
+    inline const ObjectNative *asNative() const
+    {
+        ASSERT(type == Type::Native);
+        return (ObjectNative *)this;
+    }
+
     static void FreeObjects();
+    static void PrintAllocatorStats() { s_allocator.printStats(); }
 
     static bool compare(const Object *a, const Object *b);
     Object* operator+(const Object& other) const;
 
    protected:
+    friend struct GarbageCollector;
+
     static void FreeObject(Object *obj);
 
-    Object        *_allocatedNext = nullptr;
-    static Object *s_allocatedList;
+    Object              *_allocatedNext = nullptr;
+    static Object       *s_allocatedList;
+    static SlabAllocator s_allocator;
 };
 
 void printObject(const Object &object);
 
 ///////////////////////////////////////////////////////////////////////////////////////
 
+// Strings are interned: equal contents share the same ObjectString, so equality is a pointer comparison
 struct ObjectString : public Object
 {
     char* chars = nullptr;
     uint32_t length = 0;
+    uint32_t hash = 0;
 
-    Result<void> serialize(std::ostream &o_stream) const;
-    static Result<ObjectString*> deserialize(std::istream &i_stream);
+    Result<void> serialize(serde::BufferWriter &writer, StringPool *pool = nullptr) const;
+    static Result<ObjectString*> deserialize(serde::BufferReader &reader, const StringPool *pool = nullptr);
 
     static ObjectString *Create();
     static ObjectString *CreateConcat(const char *str1, size_t len1, const char *str2, size_t len2);
     static ObjectString *CreateByCopy(const char *str, size_t length);
+    // chars aren't copied, they have to be NUL-terminated, immutable and outlive the string (i.e., a mapped image)
+    static ObjectString *CreateInPlace(const char *str, size_t length);
+
+    // chars stored right after the object, otherwise they are borrowed (see CreateInPlace)
+    bool hasInlineChars() const { return chars == reinterpret_cast<const char *>(this + 1); }
 
     static bool compare(const ObjectString &a, const ObjectString &b);
+
+    static void FreeInterned() { s_interned.clear(); }
+
+   private:
+    friend struct GarbageCollector;
+
+    static ObjectString *Allocate(size_t length, uint32_t hash);
+    static ObjectString *FindInterned(const char *str, size_t length, uint32_t hash);
+
+    static HashSet<ObjectString> s_interned;
+};
+
+// Strings of a chunk are serialized once, NUL-terminated, in its string pool and referenced by offset and length.
+// Deserializing from a pool used in place (a mapped .cloxbin) creates strings pointing into it instead of copies.
+struct StringPool
+{
+    StringPool() = default;
+    StringPool(const char *chars, uint32_t size, bool inPlace) : _chars(chars), _size(size), _inPlace(inPlace) {}
+
+    // offset of the string in the pool, added on first use
+    uint32_t add(const ObjectString &string);
+
+    Result<ObjectString *> get(uint32_t offset, uint32_t length) const;
+
+    const char *getChars() const { return _chars ? _chars : _bytes.data(); }
+    uint32_t    getSize() const { return _chars ? _size : static_cast<uint32_t>(_bytes.size()); }
+
+   private:
+    std::vector<char>                                  _bytes;  // written strings
+    std::unordered_map<const ObjectString *, uint32_t> _offsets;
+
+    const char *_chars   = nullptr;  // read strings
+    uint32_t    _size    = 0;
+    bool        _inPlace = false;
 };
 
 struct ObjectFunction : public Object
@@ -134,8 +204,24 @@ struct ObjectFunction : public Object
     ObjectFunction(const ObjectFunction&&) = delete;
     ObjectFunction operator=(ObjectFunction&&) = delete;
 
-    Result<void> serialize(std::ostream& o_stream) const;
-    Result<void> deserialize(std::istream& i_stream);
+    Result<void> serialize(serde::BufferWriter& writer) const;
+    // code and strings are used in place when the reader is persistent (see Chunk::deserialize)
+    Result<void> deserialize(serde::BufferReader& reader);
+    // whole serialized function used in place, i.e., a mapped .cloxbin (it has to outlive the function)
+    Result<void> deserializeInPlace(const uint8_t* image, size_t size);
 
     static ObjectFunction* Create(const char* name = "unnamed");
 };
+
+// Host function callable from scripts. Arguments are read in place from the VM stack (argument window of the call,
+// arity values). Returns false on failure, with the error message as a string in o_result.
+using NativeFn = bool (*)(const Value *args, Value *o_result);
+
+struct ObjectNative : public Object
+{
+    NativeFn      function = nullptr;
+    ObjectString *name     = nullptr;
+    uint8_t       arity    = 0;
+
+    static ObjectNative *Create(const char *name, NativeFn function, uint8_t arity);
+};
@@ -0,0 +1,349 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+struct Instruction
+{
+    codepos_t offset;   // in the original code
+    uint8_t   length;   // in the original code
+    OpCode    op;       // jumps are kept in their compact form, the encoding is picked when laying out the code
+    uint32_t  operand;  // non-jump operands
+    size_t    target;   // jumps: index of the instruction landed on
+    bool      removed;
+};
+
+bool isJump(OpCode op) { return op == OpCode::Jump || op == OpCode::JumpIfFalse || op == OpCode::JumpIfTrue; }
+
+bool isConditionalJump(OpCode op) { return op == OpCode::JumpIfFalse || op == OpCode::JumpIfTrue; }
+
+// pushes a value without any other effect, so pushing and popping right away can be dropped
+bool isPurePush(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::Constant:
+        case OpCode::ConstantLong:
+        case OpCode::Null:
+        case OpCode::True:
+        case OpCode::False:
+        case OpCode::LocalVarGet:
+        case OpCode::LocalVarGetLong: return true;
+        default: return false;
+    }
+}
+
+struct Program
+{
+    std::vector<Instruction> instructions;
+    std::vector<bool>        isTarget;
+
+    size_t size() const { return instructions.size(); }
+
+    bool decode(const Chunk &chunk);
+    void encode(Chunk &chunk) const;
+
+    // first instruction alive at or after index, which is where jumps to a removed instruction land
+    size_t resolve(size_t index) const
+    {
+        while (index < size() && instructions[index].removed)
+        {
+            ++index;
+        }
+        return index;
+    }
+
+    size_t next(size_t index) const { return resolve(index + 1); }
+
+    void remove(size_t index)
+    {
+        ASSERT(!instructions[index].removed);
+        instructions[index].removed = true;
+        if (isTarget[index])
+        {
+            isTarget[next(index)] = true;
+        }
+    }
+
+    void updateTargets()
+    {
+        isTarget.assign(size() + 1, false);
+        for (const Instruction &instruction : instructions)
+        {
+            if (!instruction.removed && isJump(instruction.op))
+            {
+                isTarget[resolve(instruction.target)] = true;
+            }
+        }
+    }
+
+    size_t threadJump(const Instruction &jump) const
+    {
+        size_t target = resolve(jump.target);
+        // bounded, i.e., empty infinite loops jump onto themselves
+        for (int hops = 0; hops < 16 && target < size(); ++hops)
+        {
+            const Instruction &landing = instructions[target];
+            if (landing.op == OpCode::Jump)
+            {
+                target = resolve(landing.target);
+            }
+            else if (isConditionalJump(jump.op) && landing.op == jump.op)
+            {  // the condition is still on the stack: same outcome
+                target = resolve(landing.target);
+            }
+            else if (isConditionalJump(jump.op) && isConditionalJump(landing.op))
+            {  // opposite outcome: falls through
+                target = next(target);
+            }
+            else
+            {
+                break;
+            }
+        }
+        return target;
+    }
+
+    bool optimizeRound()
+    {
+        bool changed = false;
+        updateTargets();
+        for (size_t i = resolve(0); i < size(); i = next(i))
+        {
+            Instruction &instruction = instructions[i];
+            if (isJump(instruction.op))
+            {
+                const size_t target = threadJump(instruction);
+                if (target != resolve(instruction.target))
+                {
+                    instruction.target = target;
+                    changed            = true;
+                }
+                if (target == next(i))
+                {  // conditional jumps don't pop either, so they are no-ops as well
+                    remove(i);
+                    changed = true;
+                    continue;
+                }
+            }
+
+            if (instruction.op == OpCode::Jump || instruction.op == OpCode::Return)
+            {  // unreachable until something jumps in
+                for (size_t dead = next(i); dead < size() && !isTarget[dead]; dead = next(dead))
+                {
+                    remove(dead);
+                    changed = true;
+                }
+                continue;
+            }
+
+            const size_t following = next(i);
+            if (following >= size() || isTarget[following])
+            {  // a pair can only be rewritten if nothing jumps in between
+                continue;
+            }
+            Instruction &nextInstruction = instructions[following];
+
+            if (nextInstruction.op == OpCode::Not)
+            {
+                OpCode fused = OpCode::Undefined;
+                switch (instruction.op)
+                {
+                    case OpCode::Equal: fused = OpCode::NotEqual; break;
+                    case OpCode::Greater: fused = OpCode::LessEqual; break;
+                    case OpCode::Less: fused = OpCode::GreaterEqual; break;
+                    default: break;
+                }
+                if (fused != OpCode::Undefined)
+                {
+                    instruction.op = fused;
+                    remove(following);
+                    changed = true;
+                    continue;
+                }
+            }
+
+            if (instruction.op == OpCode::Not && isConditionalJump(nextInstruction.op))
+            {  // the negated condition is only tested and popped on both paths
+                const size_t fallthrough = next(following);
+                const size_t target      = resolve(nextInstruction.target);
+                if (fallthrough < size() && target < size() && instructions[fallthrough].op == OpCode::Pop &&
+                    instructions[target].op == OpCode::Pop)
+                {
+                    nextInstruction.op =
+                        nextInstruction.op == OpCode::JumpIfFalse ? OpCode::JumpIfTrue : OpCode::JumpIfFalse;
+                    remove(i);
+                    changed = true;
+                    continue;
+                }
+            }
+
+            if (isPurePush(instruction.op) && nextInstruction.op == OpCode::Pop)
+            {
+                remove(i);
+                remove(following);
+                changed = true;
+                continue;
+            }
+        }
+        return changed;
+    }
+};
+
+
+bool Program::decode(const Chunk &chunk)
+{
+    const opcode_t *code     = chunk.getCode();
+    const codepos_t codeSize = chunk.getCodeSize();
+
+    std::vector<size_t> indexAtOffset(codeSize + 1, size_t(-1));
+    for (codepos_t offset = 0; offset < codeSize;)
+    {
+        const OpCode  op           = static_cast<OpCode>(code[offset]);
+        const uint8_t operandBytes = getOperandBytes(op);
+        if (offset + 1 + operandBytes > codeSize)
+        {
+            FAIL_MSG("Truncated instruction at %u", offset);
+            return false;
+        }
+        indexAtOffset[offset] = size();
+        instructions.push_back(Instruction{offset, static_cast<uint8_t>(1 + operandBytes), op, 0, 0, false});
+        if (!isJump(getShortOpCode(op)))
+        {
+            instructions.back().operand = readOperand(code + offset + 1, operandBytes);
+        }
+        offset += 1 + operandBytes;
+    }
+    indexAtOffset[codeSize] = size();
+
+    for (Instruction &instruction : instructions)
+    {
+        const OpCode op = getShortOpCode(instruction.op);
+        if (isJump(op))
+        {
+            const uint8_t jumpBytes = instruction.length - 1;
+            const int64_t target    = static_cast<int64_t>(instruction.offset) + instruction.length +
+                                   readJumpOffset(code + instruction.offset + 1, jumpBytes);
+            if (target < 0 || target > codeSize || indexAtOffset[target] == size_t(-1))
+            {
+                FAIL_MSG("Invalid jump target %lld at %u", static_cast<long long>(target), instruction.offset);
+                return false;
+            }
+            instruction.op     = op;
+            instruction.target = indexAtOffset[target];
+        }
+    }
+    return true;
+}
+
+void Program::encode(Chunk &chunk) const
+{
+    const codepos_t codeSize = chunk.getCodeSize();
+
+    // jumps start compact and are widened until every offset fits (widening only moves targets further away)
+    std::vector<bool>      isLong(size(), false);
+    std::vector<codepos_t> newOffsets(size() + 1);
+    auto getLength = [&](size_t i) -> uint8_t
+    {
+        if (isJump(instructions[i].op))
+        {
+            return 1 + (isLong[i] ? sizeof(jump_long_t) : sizeof(jump_t));
+        }
+        return 1 + getOperandBytes(instructions[i].op);
+    };
+    for (bool widened = true; widened;)
+    {
+        // removed instructions take no space, so their new offset is the one of the next instruction alive
+        codepos_t newOffset = 0;
+        for (size_t i = 0; i < size(); ++i)
+        {
+            newOffsets[i] = newOffset;
+            if (!instructions[i].removed)
+            {
+                newOffset += getLength(i);
+            }
+        }
+        newOffsets[size()] = newOffset;
+
+        widened = false;
+        for (size_t i = 0; i < size(); ++i)
+        {
+            const Instruction &instruction = instructions[i];
+            if (instruction.removed || !isJump(instruction.op) || isLong[i])
+            {
+                continue;
+            }
+            const int64_t jump = static_cast<int64_t>(newOffsets[instruction.target]) - (newOffsets[i] + getLength(i));
+            if (!fitsShortJump(jump))
+            {
+                isLong[i] = true;
+                widened   = true;
+            }
+        }
+    }
+
+    std::vector<opcode_t>  newCode(newOffsets[size()]);
+    std::vector<codepos_t> remap(codeSize + 1);
+    for (size_t i = 0; i < size(); ++i)
+    {
+        const Instruction &instruction = instructions[i];
+        const uint8_t      length      = getLength(i);
+        for (uint8_t byte = 0; byte < instruction.length; ++byte)
+        {
+            remap[instruction.offset + byte] =
+                instruction.removed ? newOffsets[i] : newOffsets[i] + std::min<uint8_t>(byte, length - 1);
+        }
+        if (instruction.removed)
+        {
+            continue;
+        }
+
+        opcode_t *out = newCode.data() + newOffsets[i];
+        if (isJump(instruction.op))
+        {
+            const int64_t jump = static_cast<int64_t>(newOffsets[instruction.target]) - (newOffsets[i] + length);
+            out[0]             = static_cast<opcode_t>(isLong[i] ? getLongOpCode(instruction.op) : instruction.op);
+            writeOperand(out + 1, length - 1, static_cast<uint32_t>(jump));
+        }
+        else
+        {
+            out[0] = static_cast<opcode_t>(instruction.op);
+            writeOperand(out + 1, length - 1, instruction.operand);
+        }
+    }
+    remap[codeSize] = newOffsets[size()];
+
+    chunk.rewriteCode(std::move(newCode), [&remap](codepos_t offset) { return remap[offset]; });
+}
+}  // namespace
+
+size_t peepholeOptimize(Chunk &chunk)
+{
+    const codepos_t codeSize = chunk.getCodeSize();
+
+    Program program;
+    if (!program.decode(chunk))
+    {
+        return 0;
+    }
+    while (program.optimizeRound())
+    {
+    }
+    program.encode(chunk);
+    return codeSize - chunk.getCodeSize();
+}
+
+size_t relaxJumps(Chunk &chunk)
+{
+    const codepos_t codeSize = chunk.getCodeSize();
+
+    Program program;
+    if (!program.decode(chunk))
+    {
+        return 0;
+    }
+    program.encode(chunk);
+    return codeSize - chunk.getCodeSize();
+}
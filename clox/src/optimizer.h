@@ -0,0 +1,19 @@
+#pragma once
+
+#include "chunk.h"
+#include "utils/common.h"
+
+// Peephole pass over a finished chunk, rewriting naive sequences emitted by the compiler:
+//  - fused comparisons:    Equal/Greater/Less; Not   -> NotEqual/LessEqual/GreaterEqual
+//  - negated branches:     Not; JumpIfFalse          -> JumpIfTrue (and vice versa), when both paths pop the condition
+//  - jump threading:       jumps landing on jumps go straight to the final target
+//  - redundant jumps:      jumps to the next instruction are dropped
+//  - unused values:        Constant/Null/True/False/LocalVarGet; Pop are dropped
+//  - dead code:            instructions after Jump/Return that no jump lands on are dropped
+// Jump offsets and lines are fixed up, jumps get the compact encoding when they fit (see relaxJumps).
+// Returns the number of bytes removed.
+size_t peepholeOptimize(Chunk &chunk);
+
+// Re-encodes the jumps with the compact encoding when their offset fits: the compiler reserves the long one for
+// forward jumps since their target isn't known yet. Returns the number of bytes removed.
+size_t relaxJumps(Chunk &chunk);
@@ -0,0 +1,436 @@
+#include "register_code.h"
+
+namespace reg
+{
+namespace
+{
+constexpr uint32_t kUnknown = UINT32_MAX;
+
+Op getRegisterOp(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::Add: return Op::Add;
+        case OpCode::Subtract: return Op::Subtract;
+        case OpCode::Multiply: return Op::Multiply;
+        case OpCode::Divide: return Op::Divide;
+        case OpCode::Equal: return Op::Equal;
+        case OpCode::NotEqual: return Op::NotEqual;
+        case OpCode::Greater: return Op::Greater;
+        case OpCode::Less: return Op::Less;
+        case OpCode::GreaterEqual: return Op::GreaterEqual;
+        case OpCode::LessEqual: return Op::LessEqual;
+        case OpCode::Negate: return Op::Negate;
+        case OpCode::Not: return Op::Not;
+        case OpCode::GlobalVarSet: return Op::GlobalVarSet;
+        case OpCode::GlobalVarDef: return Op::GlobalVarDef;
+        case OpCode::Assignment: return Op::Assignment;
+        case OpCode::Jump: return Op::Jump;
+        case OpCode::JumpIfFalse: return Op::JumpIfFalse;
+        case OpCode::JumpIfTrue: return Op::JumpIfTrue;
+        default: return Op::Undefined;
+    }
+}
+
+// operand stack of the bytecode at the instruction being translated
+struct Entry
+{
+    bool     inPlace;  // in the register of its stack slot, the RK operand holding it otherwise (not moved yet)
+    uint32_t operand;
+};
+
+struct Translator
+{
+    const Chunk          &chunk;
+    std::shared_ptr<Code> code = std::make_shared<Code>();
+
+    std::vector<Entry>                         stack;
+    codepos_t                                  offset      = 0;
+    uint32_t                                   lastWritten = kUnknown;  // instruction writing the top, retargetable
+    std::vector<uint32_t>                      targetDepths;            // stack depth at the jump targets
+    std::vector<uint32_t>                      targetInstructions;      // first instruction of the jump targets
+    std::vector<std::pair<uint32_t, codepos_t>> fixups;                 // jump instruction -> target
+    uint32_t                                   literals[3] = {kUnknown, kUnknown, kUnknown};
+
+    Translator(const Chunk &chunk, std::vector<uint32_t> depths) : chunk(chunk), targetDepths(std::move(depths)) {}
+
+    uint32_t getDepth() const { return static_cast<uint32_t>(stack.size()); }
+
+    uint32_t getOperand(uint32_t depth) const { return stack[depth].inPlace ? depth : stack[depth].operand; }
+    uint32_t getTop() const { return getOperand(getDepth() - 1); }
+
+    uint32_t emit(Op op, uint32_t a, uint32_t b = 0, uint32_t c = 0)
+    {
+        code->instructions.push_back(Instruction{op, a, b, c});
+        code->offsets.push_back(offset);
+        lastWritten = kUnknown;
+        return static_cast<uint32_t>(code->instructions.size()) - 1;
+    }
+
+    void push(Entry entry)
+    {
+        stack.push_back(entry);
+        code->frameSize = std::max(code->frameSize, getDepth());
+    }
+
+    // op writing the register of a new stack slot
+    void pushResult(Op op, uint32_t b, uint32_t c = 0)
+    {
+        const uint32_t instruction = emit(op, getDepth(), b, c);
+        push(Entry{true, 0});
+        lastWritten = instruction;
+    }
+
+    void materialize(uint32_t depth)
+    {
+        if (!stack[depth].inPlace)
+        {
+            emit(Op::Move, depth, stack[depth].operand);
+            stack[depth].inPlace = true;
+        }
+    }
+
+    // every value in its register, as expected at jumps, jump targets and calls
+    void flush()
+    {
+        for (uint32_t depth = 0; depth < getDepth(); ++depth)
+        {
+            materialize(depth);
+        }
+        lastWritten = kUnknown;
+    }
+
+    uint32_t getLiteral(const Value &value, size_t index)
+    {
+        if (literals[index] == kUnknown)
+        {
+            code->constants.push_back(value);
+            literals[index] = static_cast<uint32_t>(code->constants.size() - 1) | kConstantBit;
+        }
+        return literals[index];
+    }
+
+    // the local in register `local` gets the top of the stack
+    void setLocal(uint32_t local)
+    {
+        const uint32_t top         = getDepth() - 1;
+        bool           readsLocal  = false;
+        for (uint32_t depth = local + 1; depth < getDepth(); ++depth)
+        {
+            readsLocal |= !stack[depth].inPlace && stack[depth].operand == local;
+        }
+        // the instruction computing the value writes the local directly (i.e., `Add rLocal, rb, rc`)
+        if (!readsLocal && lastWritten == code->instructions.size() - 1 && stack[top].inPlace &&
+            code->instructions[lastWritten].a == top && top != local)
+        {
+            code->instructions[lastWritten].a = local;
+            stack[top]                        = Entry{false, local};
+            stack[local]                      = Entry{true, 0};
+            return;
+        }
+        // values read from the local before the assignment keep the previous one
+        for (uint32_t depth = local + 1; depth < top; ++depth)
+        {
+            if (!stack[depth].inPlace && stack[depth].operand == local)
+            {
+                materialize(depth);
+            }
+        }
+        const uint32_t value = getTop();
+        if (value != local)
+        {
+            emit(Op::Move, local, value);
+        }
+        stack[local] = Entry{true, 0};
+    }
+
+    bool setTargetDepth(codepos_t target)
+    {
+        if (targetDepths[target] == kUnknown)
+        {
+            targetDepths[target] = getDepth();
+        }
+        return targetDepths[target] == getDepth();
+    }
+
+    // deferred: a jump target only reached backwards was skipped, its depth is known once the pass is over
+    Result<void> translate(uint8_t arity, bool &deferred)
+    {
+        const opcode_t *bytecode = chunk.getCode();
+        const codepos_t codeSize = chunk.getCodeSize();
+
+        code->constants.assign(chunk.getConstants().cbegin(), chunk.getConstants().cend());
+        if (targetDepths.empty())
+        {
+            targetDepths.assign(codeSize + 1, kUnknown);
+        }
+        targetInstructions.assign(codeSize + 1, kUnknown);
+
+        // jump targets first, values are flushed into their registers at them
+        std::vector<bool> isTarget(codeSize + 1, false);
+        for (codepos_t pos = 0; pos < codeSize;)
+        {
+            const OpCode  op    = OpCode(bytecode[pos]);
+            const uint8_t bytes = getOperandBytes(op);
+            if (pos + 1 + bytes > codeSize)
+            {
+                return Error<>(format("Truncated instruction at %u", pos));
+            }
+            const OpCode generic = getShortOpCode(op);
+            if (generic == OpCode::Jump || generic == OpCode::JumpIfFalse || generic == OpCode::JumpIfTrue)
+            {
+                const int64_t target = static_cast<int64_t>(pos) + 1 + bytes + readJumpOffset(bytecode + pos + 1, bytes);
+                if (target < 0 || target > codeSize)
+                {
+                    return Error<>(format("Jump out of the code at %u", pos));
+                }
+                isTarget[static_cast<size_t>(target)] = true;
+            }
+            pos += 1 + bytes;
+        }
+
+        // callee and arguments
+        for (uint32_t i = 0; i <= arity; ++i)
+        {
+            push(Entry{true, 0});
+        }
+
+        bool reachable = true;
+        for (offset = 0; offset <= codeSize;)
+        {
+            if (isTarget[offset])
+            {
+                if (reachable)
+                {
+                    flush();
+                    if (!setTargetDepth(offset))
+                    {
+                        return Error<>(format("Stack depth differing at the jump target %u", offset));
+                    }
+                }
+                else
+                {
+                    // i.e., the Pop of the condition at the start of a do-while loop, skipped when entering it
+                    if (targetDepths[offset] == kUnknown)
+                    {
+                        deferred = true;
+                    }
+                    else
+                    {
+                        stack.assign(targetDepths[offset], Entry{true, 0});
+                    }
+                }
+                reachable = targetDepths[offset] != kUnknown;
+                if (reachable)
+                {
+                    targetInstructions[offset] = static_cast<uint32_t>(code->instructions.size());
+                    lastWritten                = kUnknown;
+                }
+            }
+            if (offset == codeSize)
+            {
+                break;
+            }
+
+            const OpCode    op      = OpCode(bytecode[offset]);
+            const uint8_t   bytes   = getOperandBytes(op);
+            const codepos_t next    = offset + 1 + bytes;
+            const uint32_t  operand = readOperand(bytecode + offset + 1, bytes);
+            const OpCode    generic = getShortOpCode(getGenericOpCode(op));
+            if (!reachable)
+            {  // dead code (i.e., after a return), up to the next jump target
+                offset = next;
+                continue;
+            }
+
+            // operands popped by the instruction
+            uint32_t popped = 0;
+            switch (generic)
+            {
+                case OpCode::Equal:
+                case OpCode::Greater:
+                case OpCode::Less:
+                case OpCode::NotEqual:
+                case OpCode::GreaterEqual:
+                case OpCode::LessEqual:
+                case OpCode::Add:
+                case OpCode::Subtract:
+                case OpCode::Multiply:
+                case OpCode::Divide: popped = 2; break;
+                case OpCode::Negate:
+                case OpCode::Not:
+                case OpCode::Print:
+                case OpCode::Pop:
+                case OpCode::GlobalVarDef:
+                case OpCode::GlobalVarSet:
+                case OpCode::GlobalSlotDef:
+                case OpCode::GlobalSlotSet:
+                case OpCode::LocalVarSet:
+                case OpCode::Assignment:
+                case OpCode::JumpIfFalse:
+                case OpCode::JumpIfTrue:
+                case OpCode::Return: popped = 1; break;
+                case OpCode::Call: popped = operand + 1; break;
+                default: break;
+            }
+            if (popped > getDepth())
+            {
+                return Error<>(format("Stack underflow at %u", offset));
+            }
+
+            switch (generic)
+            {
+                case OpCode::Constant: push(Entry{false, operand | kConstantBit}); break;
+                case OpCode::Null: push(Entry{false, getLiteral(Value::Create(Value::Null), 0)}); break;
+                case OpCode::True: push(Entry{false, getLiteral(Value::Create(true), 1)}); break;
+                case OpCode::False: push(Entry{false, getLiteral(Value::Create(false), 2)}); break;
+                case OpCode::Pop:
+                    stack.pop_back();
+                    lastWritten = kUnknown;
+                    break;
+
+                case OpCode::LocalVarGet:
+                    if (operand >= getDepth())
+                    {
+                        return Error<>(format("Local %u out of the frame at %u", operand, offset));
+                    }
+                    materialize(operand);
+                    push(Entry{false, operand});
+                    break;
+                case OpCode::LocalVarSet:
+                    if (operand >= getDepth())
+                    {
+                        return Error<>(format("Local %u out of the frame at %u", operand, offset));
+                    }
+                    setLocal(operand);
+                    break;
+
+                case OpCode::GlobalSlotGet: pushResult(Op::GlobalSlotGet, operand); break;
+                case OpCode::GlobalVarGet: pushResult(Op::GlobalVarGet, operand | kConstantBit); break;
+                case OpCode::GlobalSlotSet: emit(Op::GlobalSlotSet, operand, getTop()); break;
+                case OpCode::GlobalVarSet: emit(Op::GlobalVarSet, operand | kConstantBit, getTop()); break;
+                case OpCode::GlobalSlotDef:
+                    emit(Op::GlobalSlotDef, operand, getTop());
+                    stack.pop_back();
+                    break;
+                case OpCode::GlobalVarDef:
+                case OpCode::Assignment:
+                    emit(getRegisterOp(generic), operand | kConstantBit, getTop());
+                    stack.pop_back();
+                    break;
+
+                case OpCode::Equal:
+                case OpCode::Greater:
+                case OpCode::Less:
+                case OpCode::NotEqual:
+                case OpCode::GreaterEqual:
+                case OpCode::LessEqual:
+                case OpCode::Add:
+                case OpCode::Subtract:
+                case OpCode::Multiply:
+                case OpCode::Divide:
+                {
+                    const uint32_t b = getTop();
+                    stack.pop_back();
+                    const uint32_t a = getTop();
+                    stack.pop_back();
+                    pushResult(getRegisterOp(generic), a, b);
+                    break;
+                }
+                case OpCode::Negate:
+                case OpCode::Not:
+                {
+                    const uint32_t value = getTop();
+                    stack.pop_back();
+                    pushResult(getRegisterOp(generic), value);
+                    break;
+                }
+                case OpCode::Print:
+                    emit(Op::Print, 0, getTop());
+                    stack.pop_back();
+                    break;
+
+                case OpCode::Jump:
+                case OpCode::JumpIfFalse:
+                case OpCode::JumpIfTrue:
+                {
+                    const auto target = static_cast<codepos_t>(static_cast<int64_t>(next) +
+                                                               readJumpOffset(bytecode + offset + 1, bytes));
+                    flush();
+                    if (!setTargetDepth(target))
+                    {
+                        return Error<>(format("Stack depth differing at the jump target %u", target));
+                    }
+                    // the condition stays on the stack
+                    const uint32_t jump = emit(getRegisterOp(generic), 0, generic == OpCode::Jump ? 0 : getTop());
+                    fixups.emplace_back(jump, target);
+                    reachable = generic != OpCode::Jump;
+                    break;
+                }
+
+                case OpCode::Call:
+                {
+                    flush();
+                    const uint32_t callee = getDepth() - operand - 1;
+                    emit(Op::Call, callee, operand);
+                    stack.resize(callee);
+                    push(Entry{true, 0});  // result
+                    break;
+                }
+                case OpCode::Return:
+                    emit(Op::Return, 0, getTop());
+                    reachable = false;
+                    break;
+
+                case OpCode::Skip:
+                case OpCode::ScopeBegin:
+                case OpCode::ScopeEnd: break;
+
+                default: return Error<>(format("Unsupported instruction %s at %u", ::named_enum::name(op), offset));
+            }
+            offset = next;
+        }
+        emit(Op::Undefined, 0);
+        if (deferred)
+        {
+            return Result<void>();
+        }
+
+        for (const auto &[jump, target] : fixups)
+        {
+            if (targetInstructions[target] == kUnknown)
+            {
+                return Error<>(format("Jump not landing on an instruction at %u", code->offsets[jump]));
+            }
+            code->instructions[jump].a = targetInstructions[target];
+        }
+        return Result<void>();
+    }
+};
+}  // namespace
+
+Result<std::shared_ptr<Code>> build(const Chunk &chunk, uint8_t arity)
+{
+    // translated again while the previous pass learns the depth of targets only reached backwards
+    std::vector<uint32_t> targetDepths;
+    for (;;)
+    {
+        Translator translator(chunk, targetDepths);
+        bool       deferred        = false;
+        auto       translateResult = translator.translate(arity, deferred);
+        if (!translateResult.isOk())
+        {
+            return translateResult.error();
+        }
+        if (!deferred)
+        {
+            return translator.code;
+        }
+        if (translator.targetDepths == targetDepths)
+        {
+            return Error<>("Jump target only reached backwards");
+        }
+        targetDepths = std::move(translator.targetDepths);
+    }
+}
+}  // namespace reg
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "chunk.h"
+#include "utils/common.h"
+
+// Register form of the bytecode of a chunk, run by VirtualMachine::runRegisters. Translated once at load time from
+// the stack bytecode (which stays the serialized format) by simulating its operand stack: locals and constants are
+// read in place as operands and the stack temporaries become registers of the frame (register N = stack slot N), so
+// `a = b + c` with locals is a single `Add ra, rb, rc` instead of four instructions.
+
+// instructions of the register code, a: destination register unless noted, b/c: RK operands
+MAKE_NAMED_ENUM_CLASS_WITH_TYPE(RegisterOp, uint8_t,
+                                Move,  // a = b
+                                Add, Subtract, Multiply, Divide,
+                                Equal, NotEqual, Greater, Less, GreaterEqual, LessEqual,
+                                Negate, Not,
+                                Print,           // b
+                                GlobalSlotGet,   // b: slot
+                                GlobalSlotSet,   // a: slot
+                                GlobalSlotDef,   // a: slot
+                                GlobalVarGet,    // b: name constant
+                                GlobalVarSet,    // a: name constant
+                                GlobalVarDef,    // a: name constant
+                                Assignment,      // a: name constant
+                                Jump,            // a: target instruction
+                                JumpIfFalse,     // a: target instruction, b: condition
+                                JumpIfTrue,      // a: target instruction, b: condition
+                                Call,            // a: register of the callee followed by the arguments, b: count
+                                Return,          // b
+                                Undefined        // past the end of the code
+);
+
+namespace reg
+{
+using Op = RegisterOp;
+
+// RK operands: register of the frame, or constant when the bit is set
+constexpr uint32_t kConstantBit = 0x80000000u;
+
+struct Instruction
+{
+    Op       op;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+};
+
+struct Code
+{
+    std::vector<Instruction> instructions;  // ends with an Undefined one
+    std::vector<codepos_t>   offsets;       // bytecode offset by instruction, to locate runtime errors
+    std::vector<Value>       constants;     // the chunk ones, then the literals (null, true, false)
+    uint32_t                 frameSize = 0;  // registers used, including the callee and the arguments
+
+    codepos_t getOffset(const Instruction *instruction) const
+    {
+        return offsets[static_cast<size_t>(instruction - instructions.data())];
+    }
+};
+
+// arity: arguments found in the registers following the callee on entry. Fails on code the translation doesn't
+// support (i.e., the operand stack depth differing at a jump target).
+Result<std::shared_ptr<Code>> build(const Chunk &chunk, uint8_t arity);
+}  // namespace reg
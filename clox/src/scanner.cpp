@@ -90,6 +90,7 @@ Scanner::TokenResult_t Scanner::scanToken()
             break;
         case '\"': return string();
         case ';': return makeToken(TokenType::Semicolon);
+        case ',': return makeToken(TokenType::Comma);
         default:
             if (isDigit(c))
             {
@@ -259,6 +260,7 @@ TokenType Scanner::identifierType()
             ADD_KEYWORD(exit, Exit),
             ADD_KEYWORD(false, False),
             ADD_KEYWORD(for, For),
+            ADD_KEYWORD(fun, Func),
             ADD_KEYWORD(if, If),
 #if USING(LANG_EXT_MUT)
             ADD_KEYWORD(mut, Mut ),
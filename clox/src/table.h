@@ -0,0 +1,171 @@
+#pragma once
+
+#include "utils/common.h"
+#include "utils/memory.h"
+
+// FNV-1a, can be chained (seeded with a previous hash) to hash concatenations without materializing them
+inline uint32_t hashString(const char *str, size_t length, uint32_t hash = 2166136261u)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= static_cast<uint8_t>(str[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Open-addressing (linear probing) hash set of pointers with cached hashes, used for string interning: lookups
+// take the hash and a content comparison so no object needs to exist to find a match
+template <typename KeyT>
+struct HashSet
+{
+    HashSet() = default;
+    HashSet(const HashSet &)            = delete;
+    HashSet &operator=(const HashSet &) = delete;
+    ~HashSet() { clear(); }
+
+    template <typename EqualT>
+    KeyT *find(uint32_t hash, EqualT &&isEqual) const
+    {
+        if (_count == 0)
+        {
+            return nullptr;
+        }
+
+        for (uint32_t index = hash & (_capacity - 1);; index = (index + 1) & (_capacity - 1))
+        {
+            const Entry &entry = _entries[index];
+            if (entry.key == nullptr)
+            {
+                if (!entry.tombstone)
+                {
+                    return nullptr;
+                }
+            }
+            else if (entry.hash == hash && isEqual(*entry.key))
+            {
+                return entry.key;
+            }
+        }
+    }
+
+    // returns false if the key was already in the set
+    bool insert(KeyT *key, uint32_t hash)
+    {
+        if ((_count + 1) * 4 > _capacity * 3)
+        {
+            grow();
+        }
+
+        Entry &entry = findEntry(_entries, _capacity, key, hash);
+        if (entry.key == key)
+        {
+            return false;
+        }
+        if (!entry.tombstone)
+        {
+            ++_count;  // tombstones are already accounted for
+        }
+        entry = Entry{key, hash, false};
+        return true;
+    }
+
+    bool remove(KeyT *key, uint32_t hash)
+    {
+        if (_count == 0)
+        {
+            return false;
+        }
+
+        Entry &entry = findEntry(_entries, _capacity, key, hash);
+        if (entry.key != key)
+        {
+            return false;
+        }
+        entry = Entry{nullptr, 0, true};
+        return true;
+    }
+
+    // removes every key for which shouldRemove(key) is true, i.e., unreachable objects about to be freed
+    template <typename PredicateT>
+    void removeIf(PredicateT &&shouldRemove)
+    {
+        for (uint32_t i = 0; i < _capacity; ++i)
+        {
+            Entry &entry = _entries[i];
+            if (entry.key != nullptr && shouldRemove(*entry.key))
+            {
+                entry = Entry{nullptr, 0, true};
+            }
+        }
+    }
+
+    void clear()
+    {
+        DEALLOCATE_N(Entry, _entries, _capacity);
+        _entries  = nullptr;
+        _capacity = 0;
+        _count    = 0;
+    }
+
+   private:
+    struct Entry
+    {
+        KeyT    *key;
+        uint32_t hash;
+        bool     tombstone;
+    };
+
+    static Entry &findEntry(Entry *entries, uint32_t capacity, const KeyT *key, uint32_t hash)
+    {
+        Entry *tombstone = nullptr;
+        for (uint32_t index = hash & (capacity - 1);; index = (index + 1) & (capacity - 1))
+        {
+            Entry &entry = entries[index];
+            if (entry.key == key)
+            {
+                return entry;
+            }
+            if (entry.key == nullptr)
+            {
+                if (!entry.tombstone)
+                {
+                    return tombstone != nullptr ? *tombstone : entry;
+                }
+                if (tombstone == nullptr)
+                {
+                    tombstone = &entry;
+                }
+            }
+        }
+    }
+
+    void grow()
+    {
+        const uint32_t capacity = _capacity < 8 ? 8 : _capacity * 2;
+        Entry         *entries  = ALLOCATE_N(Entry, capacity);
+        for (uint32_t i = 0; i < capacity; ++i)
+        {
+            entries[i] = Entry{nullptr, 0, false};
+        }
+
+        _count = 0;  // tombstones are dropped
+        for (uint32_t i = 0; i < _capacity; ++i)
+        {
+            const Entry &entry = _entries[i];
+            if (entry.key != nullptr)
+            {
+                findEntry(entries, capacity, entry.key, entry.hash) = entry;
+                ++_count;
+            }
+        }
+
+        DEALLOCATE_N(Entry, _entries, _capacity);
+        _entries  = entries;
+        _capacity = capacity;
+    }
+
+    Entry   *_entries  = nullptr;
+    uint32_t _capacity = 0;
+    uint32_t _count    = 0;  // live entries + tombstones
+};
@@ -0,0 +1,101 @@
+#include "threaded_code.h"
+
+namespace threaded
+{
+namespace
+{
+bool isDropped(OpCode op) { return op == OpCode::Skip || op == OpCode::ScopeBegin || op == OpCode::ScopeEnd; }
+
+void setHandler(Cell &cell, OpCode op, [[maybe_unused]] const void *const *handlers)
+{
+#if USING(VM_COMPUTED_GOTO)
+    const size_t index = op <= OpCode::Call ? static_cast<size_t>(op) : kHandlerCount - 1;
+    cell.handler       = handlers[index];
+#else   // #if USING(VM_COMPUTED_GOTO)
+    cell.op = op;
+#endif  // #else // #if USING(VM_COMPUTED_GOTO)
+}
+}  // namespace
+
+Result<std::shared_ptr<Code>> build(const Chunk &chunk, const void *const *handlers)
+{
+    const opcode_t *code     = chunk.getCode();
+    const codepos_t codeSize = chunk.getCodeSize();
+
+    // cell of every code offset, dropped instructions (and jumps to them) go to the next cell
+    std::vector<uint32_t> cellIndices(codeSize + 1);
+    uint32_t              cellCount = 0;
+    for (codepos_t offset = 0; offset < codeSize;)
+    {
+        const OpCode    op   = OpCode(code[offset]);
+        const codepos_t next = offset + 1 + getOperandBytes(op);
+        if (next > codeSize)
+        {
+            return Error<>(format("Truncated instruction at %u", offset));
+        }
+        for (codepos_t pos = offset; pos < next; ++pos)
+        {
+            cellIndices[pos] = cellCount;
+        }
+        cellCount += isDropped(getShortOpCode(getGenericOpCode(op))) ? 0 : 1;
+        offset = next;
+    }
+    cellIndices[codeSize] = cellCount;
+
+    auto result = std::make_shared<Code>();
+    result->cells.resize(cellCount + 1);
+    result->offsets.resize(cellCount + 1);
+    for (codepos_t offset = 0; offset < codeSize;)
+    {
+        const OpCode    op      = OpCode(code[offset]);
+        const OpCode    generic = getShortOpCode(getGenericOpCode(op));
+        const uint8_t   bytes   = getOperandBytes(op);
+        const codepos_t next    = offset + 1 + bytes;
+        if (isDropped(generic))
+        {
+            offset = next;
+            continue;
+        }
+
+        const uint32_t cellIndex  = cellIndices[offset];
+        Cell          &cell       = result->cells[cellIndex];
+        result->offsets[cellIndex] = offset;
+        setHandler(cell, generic, handlers);
+        switch (generic)
+        {
+            case OpCode::Constant:
+            case OpCode::GlobalVarDef:
+            case OpCode::GlobalVarSet:
+            case OpCode::GlobalVarGet:
+            case OpCode::Assignment:
+            {
+                const uint32_t constant = readOperand(code + offset + 1, bytes);
+                if (constant >= chunk.getConstants().size())
+                {
+                    return Error<>(format("Constant out of range at %u", offset));
+                }
+                cell.operand.constant = &chunk.getConstants()[constant];
+                break;
+            }
+            case OpCode::Jump:
+            case OpCode::JumpIfFalse:
+            case OpCode::JumpIfTrue:
+            {
+                const int64_t target = static_cast<int64_t>(next) + readJumpOffset(code + offset + 1, bytes);
+                if (target < 0 || target > codeSize)
+                {
+                    return Error<>(format("Jump out of the code at %u", offset));
+                }
+                cell.operand.target = &result->cells[cellIndices[static_cast<codepos_t>(target)]];
+                break;
+            }
+            default: cell.operand.index = readOperand(code + offset + 1, bytes); break;
+        }
+        offset = next;
+    }
+    // past the last instruction, only reached by code not ending in Return
+    setHandler(result->cells[cellCount], OpCode::Undefined, handlers);
+    result->offsets[cellCount] = codeSize;
+    return result;
+}
+}  // namespace threaded
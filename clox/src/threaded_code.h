@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "chunk.h"
+#include "utils/common.h"
+
+// Pre-decoded (direct-threaded) form of the bytecode of a chunk, built once when VirtualMachine::runThreaded first
+// enters it: one cell per instruction with its handler and its operand already decoded, so dispatching is a single
+// indirect jump. *Long and quickened variants map to the generic instruction, debug-only markers (Skip, ScopeBegin,
+// ScopeEnd) are dropped. The bytecode stays the compact format written to disk.
+namespace threaded
+{
+struct Cell
+{
+#if USING(VM_COMPUTED_GOTO)
+    const void *handler;  // label in VirtualMachine::runThreaded
+#else   // #if USING(VM_COMPUTED_GOTO)
+    OpCode op;
+#endif  // #else // #if USING(VM_COMPUTED_GOTO)
+    union
+    {
+        uint32_t     index;     // local/global slot, argument count
+        const Value *constant;  // constants and names of the chunk
+        const Cell  *target;    // jumps
+    } operand;
+};
+
+struct Code
+{
+    std::vector<Cell>      cells;    // ends with a cell past the end of the code (Undefined)
+    std::vector<codepos_t> offsets;  // bytecode offset by cell, to locate runtime errors
+
+    codepos_t getOffset(const Cell *cell) const { return offsets[static_cast<size_t>(cell - cells.data())]; }
+};
+
+// handlers (computed gotos only): label per OpCode up to the last generic compact one (Call), then Undefined's
+constexpr size_t kHandlerCount = static_cast<size_t>(OpCode::Call) + 2;
+
+Result<std::shared_ptr<Code>> build(const Chunk &chunk, const void *const *handlers);
+}  // namespace threaded
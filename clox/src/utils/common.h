@@ -6,7 +6,6 @@
 #include <cstdint>
 #include <cstdio>
 #include <functional>
-#include <iostream>
 #include <memory>  // unique_ptr
 #include <string>
 #include <type_traits>
@@ -15,14 +14,21 @@
 #include "utils/assert.h"
 
 // compiler types
-using jump_t    = int16_t;
-using codepos_t = uint16_t;
-using opcode_t  = uint8_t;
+using jump_t      = int16_t;
+using jump_long_t = int32_t;  // *Long jumps
+using codepos_t   = uint32_t;
+using opcode_t    = uint8_t;
 
 namespace limits
 {
-constexpr size_t kMaxJumpLength = (1L << 16) - 1;
-}
+// indices (constants, globals, locals) past kMaxShortOperand are encoded by the *Long opcodes
+constexpr size_t kMaxShortOperand  = UINT8_MAX;
+constexpr size_t kLongOperandBytes = 3;
+constexpr size_t kMaxLongOperand   = (1u << (8 * kLongOperandBytes)) - 1;
+constexpr size_t kMaxLocals        = 1u << 12;
+constexpr size_t kMaxParameters    = UINT8_MAX;  // arguments are counted by a single byte operand
+constexpr size_t kMaxFrames        = 64;         // call depth
+}  // namespace limits
 
 #define ARRAY_COUNT(X) (sizeof(X) / sizeof(X[0]))
 
@@ -31,6 +37,7 @@ constexpr size_t kMaxJumpLength = (1L << 16) - 1;
 #define DEBUG_PRINT_CODE !USING(VM_BUILD) && USING(DEBUG_BUILD)
 #define DEBUG_TRACE_EXECUTION !USING(VM_BUILD)  // USING(DEBUG_BUILD)
 #define EXTENDED_ERROR_REPORT IN_USE
+#define DEBUG_STRESS_GC NOT_IN_USE  // collect garbage on every allocation
 
 #if USING(DEBUG_PRINT_CODE)
 namespace debug_print
@@ -0,0 +1,89 @@
+#include "utils/mapped_file.h"
+
+#include <cstdio>
+
+#if defined(LINUX_OS)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // #if defined(LINUX_OS)
+
+Result<void> MappedFile::open(const char *path)
+{
+    close();
+
+#if defined(LINUX_OS)
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return Result<void>::error_t(format("Failed to open file '%s' for reading", path));
+    }
+    ScopedCallback closeFd([fd] { ::close(fd); });
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0)
+    {
+        return Result<void>::error_t(format("Failed to read the size of '%s'", path));
+    }
+    if (fileStat.st_size == 0)
+    {  // nothing to map, an empty view
+        return Result<void>();
+    }
+
+    void *data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        return Result<void>::error_t(format("Failed to map file '%s'", path));
+    }
+    _data   = static_cast<const uint8_t *>(data);
+    _size   = static_cast<size_t>(fileStat.st_size);
+    _mapped = true;
+#else   // #if defined(LINUX_OS)
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return Result<void>::error_t(format("Failed to open file '%s' for reading", path));
+    }
+    ScopedCallback closeFile([file] { fclose(file); });
+
+    fseek(file, 0, SEEK_END);
+    const long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (fileSize <= 0)
+    {
+        return Result<void>();
+    }
+
+    uint8_t *data = static_cast<uint8_t *>(malloc(static_cast<size_t>(fileSize)));
+    if (data == nullptr || fread(data, 1, static_cast<size_t>(fileSize), file) != static_cast<size_t>(fileSize))
+    {
+        free(data);
+        return Result<void>::error_t(format("Failed reading file '%s'", path));
+    }
+    _data = data;
+    _size = static_cast<size_t>(fileSize);
+#endif  // #else   // #if defined(LINUX_OS)
+    return Result<void>();
+}
+
+void MappedFile::close()
+{
+    if (_data == nullptr)
+    {
+        return;
+    }
+#if defined(LINUX_OS)
+    if (_mapped)
+    {
+        munmap(const_cast<uint8_t *>(_data), _size);
+    }
+    else
+#endif  // #if defined(LINUX_OS)
+    {
+        free(const_cast<uint8_t *>(_data));
+    }
+    _data   = nullptr;
+    _size   = 0;
+    _mapped = false;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "utils/common.h"
+
+// View of a whole file mapped in memory: pages are only loaded when touched, so data used in place (i.e., bytecode and
+// strings of a .cloxbin) costs page faults instead of reads and copies. The mapping is private copy-on-write: writes
+// (i.e., quickened instructions) only copy the pages written and never reach the file.
+// Falls back to reading the file into memory where mapping isn't supported.
+struct MappedFile
+{
+    MappedFile() = default;
+    MappedFile(const MappedFile &)            = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    Result<void> open(const char *path);
+    void         close();
+
+    const uint8_t *getData() const { return _data; }
+    size_t         getSize() const { return _size; }
+
+   private:
+    const uint8_t *_data   = nullptr;
+    size_t         _size   = 0;
+    bool           _mapped = false;  // otherwise _data is heap allocated
+};
@@ -1,12 +1,13 @@
 #pragma once
 
-#include <iostream>
+#include <cstring>
+#include <vector>
 
 // serialization/deserialization
 namespace serde
 {
-using constants_len_t = uint8_t;
-using code_len_t      = uint16_t;
+using constants_len_t = uint32_t;
+using code_len_t      = uint32_t;
 using string_len_t    = uint8_t;
 using size_t          = uint32_t;
 
@@ -16,45 +17,145 @@ inline bool isLittleEndian()
     return *((uint8_t*)&test) == 0x04;
 }
 
+// Serialized bytes appended to a growable buffer
+struct BufferWriter
+{
+    void writeBytes(const void* data, std::size_t count)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        const std::size_t position = _bytes.size();
+        _bytes.resize(position + count);
+        memcpy(_bytes.data() + position, data, count);
+    }
+
+    const uint8_t* getData() const { return _bytes.data(); }
+    std::size_t    getSize() const { return _bytes.size(); }
+
+   private:
+    std::vector<uint8_t> _bytes;
+};
+
+// Bounds-checked reads over a memory buffer: reading past the end fails the reader (sticky) and reads zeros, so
+// callers check isOk() once per section instead of once per field
+struct BufferReader
+{
+    // persistent: the buffer outlives what is read from it, which can then point into it instead of copying. Code used
+    // in place gets quickened by the VM, so a persistent buffer has to be writable as well (see Chunk::quicken).
+    BufferReader(const uint8_t* data, std::size_t size, bool persistent = false)
+        : _data(data), _size(size), _persistent(persistent)
+    {
+    }
+
+    bool readBytes(void* o_data, std::size_t count)
+    {
+        const uint8_t* bytes = readInPlace(count);
+        if (bytes == nullptr)
+        {
+            memset(o_data, 0, count);
+            return false;
+        }
+        memcpy(o_data, bytes, count);
+        return true;
+    }
+
+    // skips count bytes, returning where they are (nullptr past the end)
+    const uint8_t* readInPlace(std::size_t count)
+    {
+        if (_failed || count > _size - _position)
+        {
+            _failed = true;
+            return nullptr;
+        }
+        const uint8_t* bytes = _data + _position;
+        _position += count;
+        return bytes;
+    }
+
+    bool        isOk() const { return !_failed; }
+    bool        isPersistent() const { return _persistent; }
+    std::size_t getPosition() const { return _position; }
+    std::size_t getRemaining() const { return _size - _position; }
+
+   private:
+    const uint8_t* _data       = nullptr;
+    std::size_t    _size       = 0;
+    std::size_t    _position   = 0;
+    bool           _persistent = false;
+    bool           _failed     = false;
+};
+
 template <typename T, size_t TSIZE = sizeof(T)>
-void Serialize(std::ostream& ostr, const T& i_value)
+void Serialize(BufferWriter& writer, const T& i_value)
 {
-    ostr.write((char*)&i_value, TSIZE);
-    ASSERT(ostr.good());
+    writer.writeBytes(&i_value, TSIZE);
 }
 template <typename AS_T, typename T, size_t TSIZE = sizeof(AS_T)>
-void SerializeAs(std::ostream& ostr, const T& i_value)
+void SerializeAs(BufferWriter& writer, const T& i_value)
 {
     AS_T temp = static_cast<AS_T>(i_value);
-    ostr.write((char*)&temp, TSIZE);
-    ASSERT(ostr.good());
+    writer.writeBytes(&temp, TSIZE);
 }
 template <typename T, typename COUNT_T = uint32_t>
-void SerializeN(std::ostream& ostr, const T* i_value, COUNT_T count)
+void SerializeN(BufferWriter& writer, const T* i_value, COUNT_T count)
 {
-    ostr.write((char*)i_value, static_cast<std::streamsize>(count * sizeof(T)));
-    ASSERT(ostr.good());
+    writer.writeBytes(i_value, static_cast<std::size_t>(count) * sizeof(T));
 }
 
 template <typename T, size_t TSIZE = sizeof(T)>
-void Deserialize(std::istream& istr, T& o_value)
+void Deserialize(BufferReader& reader, T& o_value)
 {
-    istr.read((char*)&o_value, TSIZE);
-    ASSERT(istr.good() && istr.gcount() == static_cast<std::streamsize>(TSIZE));
+    reader.readBytes(&o_value, TSIZE);
 }
 template <typename AS_T, typename T, size_t TSIZE = sizeof(AS_T)>
-void DeserializeAs(std::istream& istr, T& o_value)
+void DeserializeAs(BufferReader& reader, T& o_value)
 {
     AS_T temp;
-    istr.read((char*)&temp, TSIZE);
-    ASSERT(istr.good() && istr.gcount() == static_cast<std::streamsize>(TSIZE));
+    reader.readBytes(&temp, TSIZE);
     o_value = static_cast<T>(temp);
 }
 template <typename T, typename COUNT_T = uint32_t>
-void DeserializeN(std::istream& istr, T* o_value, COUNT_T count)
+void DeserializeN(BufferReader& reader, T* o_value, COUNT_T count)
+{
+    reader.readBytes(o_value, static_cast<std::size_t>(count) * sizeof(T));
+}
+
+// LEB128: 7 bits per byte, high bit set while more bytes follow
+inline void SerializeVarint(BufferWriter& writer, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        Serialize(writer, static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    Serialize(writer, static_cast<uint8_t>(value));
+}
+inline uint32_t DeserializeVarint(BufferReader& reader)
+{
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        uint8_t byte = 0;
+        Deserialize(reader, byte);
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            break;
+        }
+    }
+    return value;
+}
+
+// zig-zag keeps small negative deltas small
+inline uint32_t ZigZagEncode(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+inline int32_t ZigZagDecode(uint32_t value)
 {
-    istr.read((char*)o_value, static_cast<std::streamsize>(count * sizeof(T)));
-    ASSERT(istr.good() && istr.gcount() == static_cast<std::streamsize>(count));
+    return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
 }
 
-}  // namespace serde
\ No newline at end of file
+}  // namespace serde
@@ -0,0 +1,117 @@
+#include "utils/slab_allocator.h"
+
+#include "utils/memory.h"
+
+void *SlabAllocator::allocate(size_t size)
+{
+    if (size > kMaxSmallSize)
+    {
+        ++_stats.largeCount;
+        _stats.largeBytes += size;
+        return malloc(size);
+    }
+
+    const size_t      classIndex = getSizeClass(size);
+    SizeClass        &sizeClass  = _sizeClasses[classIndex];
+    Stats::SizeClass &stats      = _stats.sizeClasses[classIndex];
+    const size_t      blockSize  = getBlockSize(classIndex);
+
+    ++stats.blocksInUse;
+    stats.bytesRequested += size;
+
+    if (sizeClass.freeList != nullptr)
+    {
+        FreeBlock *block   = sizeClass.freeList;
+        sizeClass.freeList = block->next;
+        return block;
+    }
+
+    if (sizeClass.bump + blockSize > sizeClass.bumpEnd)
+    {
+        uint8_t *slab = ALLOCATE_N(uint8_t, kSlabSize);
+        if (slab == nullptr)
+        {
+            return nullptr;
+        }
+        _slabs.push_back(slab);
+        sizeClass.bump    = slab;
+        sizeClass.bumpEnd = slab + kSlabSize - (kSlabSize % blockSize);
+        ++stats.slabCount;
+    }
+
+    void *block = sizeClass.bump;
+    sizeClass.bump += blockSize;
+    ++stats.blocksCapacity;
+    return block;
+}
+
+void SlabAllocator::deallocate(void *ptr, size_t size)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    if (size > kMaxSmallSize)
+    {
+        ASSERT(_stats.largeCount > 0 && _stats.largeBytes >= size);
+        --_stats.largeCount;
+        _stats.largeBytes -= size;
+        free(ptr);
+        return;
+    }
+
+    const size_t      classIndex = getSizeClass(size);
+    SizeClass        &sizeClass  = _sizeClasses[classIndex];
+    Stats::SizeClass &stats      = _stats.sizeClasses[classIndex];
+    ASSERT(stats.blocksInUse > 0 && stats.bytesRequested >= size);
+    --stats.blocksInUse;
+    stats.bytesRequested -= size;
+
+    FreeBlock *block   = static_cast<FreeBlock *>(ptr);
+    block->next        = sizeClass.freeList;
+    sizeClass.freeList = block;
+}
+
+void SlabAllocator::releaseSlabs()
+{
+    freeSlabs();
+
+    for (size_t i = 0; i < kSizeClassCount; ++i)
+    {
+        ASSERT_MSG(_stats.sizeClasses[i].blocksInUse == 0, "Releasing slabs with %zu block(s) of %zu bytes in use",
+                   _stats.sizeClasses[i].blocksInUse, getBlockSize(i));
+        _sizeClasses[i]       = SizeClass{};
+        _stats.sizeClasses[i] = Stats::SizeClass{};
+    }
+}
+
+void SlabAllocator::freeSlabs()
+{
+    for (uint8_t *slab : _slabs)
+    {
+        DEALLOCATE_N(uint8_t, slab, kSlabSize);
+    }
+    _slabs.clear();
+}
+
+void SlabAllocator::printStats() const
+{
+    printf("== Slab allocator: %zu slab(s) of %zu KB, %zu large allocation(s) (%zu bytes) ==\n", _slabs.size(),
+           kSlabSize / 1024, _stats.largeCount, _stats.largeBytes);
+    for (size_t i = 0; i < kSizeClassCount; ++i)
+    {
+        const Stats::SizeClass &stats = _stats.sizeClasses[i];
+        if (stats.slabCount == 0)
+        {
+            continue;
+        }
+        const size_t blockBytes = stats.blocksInUse * getBlockSize(i);
+        // internal: rounding requests up to the block size, external: free blocks in the slabs
+        const double internal = blockBytes ? 100.0 * (blockBytes - stats.bytesRequested) / blockBytes : 0.0;
+        const double external =
+            100.0 * (stats.blocksCapacity - stats.blocksInUse) / (stats.slabCount * (kSlabSize / getBlockSize(i)));
+        printf("%6zu B: %4zu slab(s) %8zu/%-8zu block(s) in use, fragmentation internal %5.1f%% external %5.1f%%\n",
+               getBlockSize(i), stats.slabCount, stats.blocksInUse, stats.blocksCapacity, internal, external);
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+
+#include "utils/common.h"
+
+// Size-class allocator: small blocks are carved from 64KB slabs and recycled through per-class free lists, larger
+// ones fall back to malloc. The caller provides the size on deallocation (objects know their own size).
+struct SlabAllocator
+{
+    // size classes every 16 bytes (keeps blocks 16-byte aligned and rounding waste low)
+    static constexpr size_t kMinBlockSize   = 32;
+    static constexpr size_t kGranularity    = 16;
+    static constexpr size_t kMaxSmallSize   = 256;
+    static constexpr size_t kSizeClassCount = (kMaxSmallSize - kMinBlockSize) / kGranularity + 1;
+    static constexpr size_t kSlabSize       = 64 * 1024;
+
+    static constexpr size_t getBlockSize(size_t sizeClass) { return kMinBlockSize + sizeClass * kGranularity; }
+
+    struct Stats
+    {
+        struct SizeClass
+        {
+            size_t slabCount      = 0;
+            size_t blocksInUse    = 0;
+            size_t blocksCapacity = 0;  // carved from slabs so far, in use or free
+            size_t bytesRequested = 0;  // by the blocks in use
+        };
+        SizeClass sizeClasses[kSizeClassCount];
+        size_t    largeCount = 0;
+        size_t    largeBytes = 0;
+    };
+
+    SlabAllocator() = default;
+    SlabAllocator(const SlabAllocator &)            = delete;
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+    ~SlabAllocator() { freeSlabs(); }
+
+    void *allocate(size_t size);
+    void  deallocate(void *ptr, size_t size);
+
+    // frees the slabs, every block has to be deallocated already
+    void releaseSlabs();
+
+    const Stats &getStats() const { return _stats; }
+    void         printStats() const;
+
+   private:
+    void freeSlabs();
+
+    static size_t getSizeClass(size_t size)
+    {
+        ASSERT(size <= kMaxSmallSize);
+        return size <= kMinBlockSize ? 0 : (size - kMinBlockSize + kGranularity - 1) / kGranularity;
+    }
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    struct SizeClass
+    {
+        FreeBlock *freeList = nullptr;
+        uint8_t   *bump     = nullptr;  // uncarved part of the current slab
+        uint8_t   *bumpEnd  = nullptr;
+    };
+
+    SizeClass              _sizeClasses[kSizeClassCount];
+    std::vector<uint8_t *> _slabs;
+    Stats                  _stats;
+};
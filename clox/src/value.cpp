@@ -1,41 +1,66 @@
 #include "value.h"
 #include "object.h"
 #include "utils/serde.h"
+#include <cinttypes>
 #include <cstring>
 
-Result<void> Value::serialize(std::ostream &o_stream) const
+Result<void> Value::serialize(serde::BufferWriter &writer, StringPool *pool) const
 {
+    const Type type = getType();
     static_assert(sizeof(type) == 1, "Check enum type");
-    serde::Serialize(o_stream, type);
+    serde::Serialize(writer, type);
     switch (type)
     {
         case Type::Null: break;
-        case Type::Bool: serde::Serialize(o_stream, as.boolean); break;
-        case Type::Number: serde::Serialize(o_stream, as.number); break;
-        case Type::Integer: serde::Serialize(o_stream, as.integer); break;
-        case Type::Object: return as.object->serialize(o_stream); break;
+        case Type::Bool: serde::Serialize(writer, asBool()); break;
+        case Type::Number: serde::Serialize(writer, asNumber()); break;
+        case Type::Integer: serde::Serialize(writer, asInteger()); break;
+        case Type::Object: return asObject()->serialize(writer, pool); break;
         case Type::Undefined: break;
         default: FAIL_MSG("Unsupported type: %d\n", type);
     }
     return Result<void>();
 }
-Result<void> Value::deserialize(std::istream &i_stream)
+Result<void> Value::deserialize(serde::BufferReader &reader, const StringPool *pool)
 {
-    serde::Deserialize(i_stream, type);
+    Type type;
+    serde::Deserialize(reader, type);
     switch (type)
     {
-        case Type::Bool: serde::Deserialize(i_stream, as.boolean); break;
-        case Type::Null:
-        case Type::Undefined: break;
-        case Type::Number: serde::Deserialize(i_stream, as.number); break;
-        case Type::Integer: serde::Deserialize(i_stream, as.integer); break;
+        case Type::Bool:
+        {
+            bool value;
+            serde::Deserialize(reader, value);
+            *this = Create(value);
+            break;
+        }
+        case Type::Null: *this = Create(Null); break;
+        case Type::Undefined: *this = Create(); break;
+        case Type::Number:
+        {
+            double value;
+            serde::Deserialize(reader, value);
+            *this = Create(value);
+            break;
+        }
+        case Type::Integer:
+        {
+            int64_t value;
+            serde::Deserialize(reader, value);
+            if (!fitsInteger(value))
+            {
+                return Error<>(format("Integer constant out of range: %lld\n", static_cast<long long>(value)));
+            }
+            *this = Create(value);
+            break;
+        }
         case Type::Object:
         {
-            auto result = Object::deserialize(i_stream);
+            auto result = Object::deserialize(reader, pool);
             ASSERT(result.isOk());
             if (result.isOk())
             {
-                as.object = result.extract();
+                *this = Create(result.extract());
             }
             else
             {
@@ -62,136 +87,86 @@ const char *Value::getTypeName(Type type)
 }
 Value::operator bool() const
 {
-    ASSERT(type == Type::Bool);
-    return as.boolean;
+    ASSERT(is(Type::Bool));
+    return asBool();
 }
-Value::operator int() const
+Value::operator int64_t() const
 {
-    ASSERT(type == Type::Integer);
-    return as.integer;
+    ASSERT(is(Type::Integer));
+    return asInteger();
 }
 Value::operator double() const
 {
-    ASSERT(type == Type::Number);
-    return as.number;
+    ASSERT(is(Type::Number));
+    return asNumber();
 }
 Value::operator char *() const
 {
-    ASSERT(type == Type::Object && as.object->type == Object::Type::String);
-    if (as.object->type == Object::Type::String)
+    ASSERT(is(Type::Object) && asObject()->type == Object::Type::String);
+    if (asObject()->type == Object::Type::String)
     {
-        ObjectString *strObj = static_cast<ObjectString *>(as.object);
+        ObjectString *strObj = static_cast<ObjectString *>(asObject());
         return strObj->chars;
     }
     FAIL();
     return (char *)"Invalid ObjectString";
 }
 
-Value Value::Create() { return Value{.type = Type::Undefined}; }
-Value Value::Create(NullType)
-{
-    return Value{
-        .as{.integer = (int)0xDEADBEEF},
-        .type = Type::Null,
-    };
-}
-Value Value::Create(bool value)
-{
-    return Value{
-        .as{.boolean = value},
-        .type = Type::Bool,
-    };
-}
-Value Value::Create(int value)
-{
-    return Value{
-        .as{.integer = value},
-        .type = Type::Integer,
-    };
-}
-Value Value::Create(double value)
-{
-    return Value{
-        .as{.number = value},
-        .type = Type::Number,
-    };
-}
-
-Value Value::Create(Object* object) {
-    return Value{
-        .as{
-            .object = object,
-        },
-        .type = Type::Object,
-    };
-}
-
 Value Value::CreateConcat(const char *str1, size_t len1, const char *str2, size_t len2)
 {
-    return Value{
-        .as{
-            .object = ObjectString::CreateConcat(str1, len1, str2, len2),
-        },
-        .type = Type::Object,
-    };
-}
-Value Value::CreateByCopy(const char *str, size_t length)
-{
-    return Value{
-        .as{
-            .object = ObjectString::CreateByCopy(str, length),
-        },
-        .type = Type::Object,
-    };
+    return Create(ObjectString::CreateConcat(str1, len1, str2, len2));
 }
+Value Value::CreateByCopy(const char *str, size_t length) { return Create(ObjectString::CreateByCopy(str, length)); }
 
 Value Value::operator-() const
 {
-    switch (type)
+    int64_t result;
+    switch (getType())
     {
-        case Value::Type::Number: return Create(-as.number);
-        case Value::Type::Integer: return Create(-as.integer);
+        case Value::Type::Number: return Create(-asNumber());
+        case Value::Type::Integer:
+            return subtractInteger(0, asInteger(), &result) ? Create(result) : Create(-toDouble());
         default: ASSERT(false); return Create();
     }
 }
 
-Value Value::operator-(const Value &a)
-{
-    switch (a.type)
-    {
-        case Value::Type::Number: return Create(-a.as.number);
-        case Value::Type::Integer: return Create(-a.as.integer);
-        default: ASSERT(false); return Create();
-    }
-}
+Value Value::operator-(const Value &a) { return -a; }
 
 bool operator==(const Value &a, const Value &b)
 {
-    if (a.type != b.type)
+    if (a.isNumber() && b.isNumber() && a.getType() != b.getType())
+    {
+        return a.toDouble() == b.toDouble();
+    }
+    if (a.getType() != b.getType())
     {
         return false;
     }
-    switch (a.type)
+    switch (a.getType())
     {
-        case Value::Type::Bool: return a.as.boolean == b.as.boolean;
-        case Value::Type::Number: return a.as.number == b.as.number;
-        case Value::Type::Integer: return a.as.integer == b.as.integer;
-        case Value::Type::Object: return Object::compare(a.as.object, b.as.object);
+        case Value::Type::Bool: return a.asBool() == b.asBool();
+        case Value::Type::Number: return a.asNumber() == b.asNumber();
+        case Value::Type::Integer: return a.asInteger() == b.asInteger();
+        case Value::Type::Object: return Object::compare(a.asObject(), b.asObject());
         case Value::Type::Null: return true;
         default: ASSERT(false); return false;
     }
 }
 bool operator<(const Value &a, const Value &b)
 {
-    ASSERT(a.type == b.type);
-    switch (a.type)
+    if (a.isNumber() && b.isNumber() && a.getType() != b.getType())
     {
-        case Value::Type::Bool: return a.as.boolean < b.as.boolean;
-        case Value::Type::Number: return a.as.number < b.as.number;
-        case Value::Type::Integer: return a.as.integer < b.as.integer;
+        return a.toDouble() < b.toDouble();
+    }
+    ASSERT(a.getType() == b.getType());
+    switch (a.getType())
+    {
+        case Value::Type::Bool: return a.asBool() < b.asBool();
+        case Value::Type::Number: return a.asNumber() < b.asNumber();
+        case Value::Type::Integer: return a.asInteger() < b.asInteger();
         case Value::Type::Null: return false;
         case Value::Type::Object:
-            switch (a.as.object->type)
+            switch (a.asObject()->type)
             {
                 case Object::Type::String:
                 {
@@ -206,14 +181,18 @@ bool operator<(const Value &a, const Value &b)
 }
 bool operator>(const Value &a, const Value &b)
 {
-    ASSERT(a.type == b.type);
-    switch (a.type)
+    if (a.isNumber() && b.isNumber() && a.getType() != b.getType())
+    {
+        return a.toDouble() > b.toDouble();
+    }
+    ASSERT(a.getType() == b.getType());
+    switch (a.getType())
     {
-        case Value::Type::Bool: return a.as.boolean > b.as.boolean;
-        case Value::Type::Number: return a.as.number > b.as.number;
-        case Value::Type::Integer: return a.as.integer > b.as.integer;
+        case Value::Type::Bool: return a.asBool() > b.asBool();
+        case Value::Type::Number: return a.asNumber() > b.asNumber();
+        case Value::Type::Integer: return a.asInteger() > b.asInteger();
         case Value::Type::Object:
-            switch (a.as.object->type)
+            switch (a.asObject()->type)
             {
                 case Object::Type::String:
                 {
@@ -228,56 +207,58 @@ bool operator>(const Value &a, const Value &b)
     }
 }
 
-#define DECL_OPERATOR(OP)                                                                  \
-    Value operator OP(const Value &a, const Value &b)                                      \
-    {                                                                                      \
-        switch (a.type)                                                                    \
-        {                                                                                  \
-            case Value::Type::Number: return Value::Create(a.as.number OP b.as.number);    \
-            case Value::Type::Integer: return Value::Create(a.as.integer OP b.as.integer); \
-            default: ASSERT(false); return Value::Create();                                \
-        }                                                                                  \
+// numeric tower: Integer operands stay Integer unless the result doesn't fit (see addInteger...), any Number operand
+// makes it a Number
+#define DECL_OPERATOR(OP, INTEGER_OP)                                                            \
+    Value operator OP(const Value &a, const Value &b)                                            \
+    {                                                                                            \
+        if (a.is(Value::Type::Integer) && b.is(Value::Type::Integer))                            \
+        {                                                                                        \
+            int64_t result;                                                                      \
+            if (INTEGER_OP(a.asInteger(), b.asInteger(), &result))                               \
+            {                                                                                    \
+                return Value::Create(result);                                                    \
+            }                                                                                    \
+        }                                                                                        \
+        if (a.isNumber() && b.isNumber())                                                        \
+        {                                                                                        \
+            return Value::Create(a.toDouble() OP b.toDouble());                                  \
+        }                                                                                        \
+        ASSERT(false);                                                                           \
+        return Value::Create();                                                                  \
     }
-DECL_OPERATOR(-)
-DECL_OPERATOR(*)
-DECL_OPERATOR(/)
+DECL_OPERATOR(-, subtractInteger)
+DECL_OPERATOR(*, multiplyInteger)
+DECL_OPERATOR(/, divideInteger)
 #undef DECL_OPERATOR
 
 Value operator+(const Value&a, const Value &b)
 {
-    //ASSERT(a.type == b.type);
-    switch (a.type)
+    if (a.isNumber() && b.isNumber())
     {
-        case Value::Type::Number: 
-            if (b.is(Value::Type::Number))
-            {
-                return Value::Create(a.as.number + b.as.number);
-            }
-            break;
-        case Value::Type::Integer:
-            if (b.is(Value::Type::Integer))
-            {
-                return Value::Create(a.as.integer + b.as.integer);
-            }
-            break;
-        case Value::Type::Object:
+        int64_t result;
+        if (a.is(Value::Type::Integer) && b.is(Value::Type::Integer) &&
+            addInteger(a.asInteger(), b.asInteger(), &result))
         {
-            if (b.is(Value::Type::Object))
+            return Value::Create(result);
+        }
+        return Value::Create(a.toDouble() + b.toDouble());
+    }
+    if (a.is(Value::Type::Object))
+    {
+        if (b.is(Value::Type::Object))
+        {
+            auto result = *a.asObject() + *b.asObject();
+            if (result != nullptr)
             {
-                auto result = *a.as.object + *b.as.object;
-                if (result != nullptr)
-                {
-                    return Value::Create(result);
-                }
+                return Value::Create(result);
             }
-            return Value{};
-            break;
         }
-        default: FAIL();
+        return Value{};
     }
- 
-    FAIL_MSG("Undefined '%s' for Values of types: %s and %s", __FUNCTION__, Value::getTypeName(a.type),
-             Value::getTypeName(b.type));
+
+    FAIL_MSG("Undefined '%s' for Values of types: %s and %s", __FUNCTION__, Value::getTypeName(a.getType()),
+             Value::getTypeName(b.getType()));
     return Value{};
 }
 
@@ -301,27 +282,27 @@ Value operator+(const Value&a, const Value &b)
 
 void printValue(const Value &value)
 {
-    switch (value.type)
+    switch (value.getType())
     {
-        case Value::Type::Bool: printf("%s", value.as.boolean ? "true" : "false"); break;
+        case Value::Type::Bool: printf("%s", value.asBool() ? "true" : "false"); break;
         case Value::Type::Null: printf("%s", "null"); break;
-        case Value::Type::Number: printf("%.2f", value.as.number); break;
-        case Value::Type::Integer: printf("%d", value.as.integer); break;
-        case Value::Type::Object: printObject(*value.as.object); break;
+        case Value::Type::Number: printf("%.2f", value.asNumber()); break;
+        case Value::Type::Integer: printf("%" PRId64, value.asInteger()); break;
+        case Value::Type::Object: printObject(*value.asObject()); break;
         default: printf("UNDEF"); break;
     }
 }
 
 void printValueDebug(const Value &value)
 {
-    const bool isString = value.type == Value::Type::Object && value.as.object->type == Object::Type::String;
+    const bool isString = value.getType() == Value::Type::Object && value.asObject()->type == Object::Type::String;
     if (!isString)
     {
         printValue(value);
     }
     else
     {
-        auto        strObj     = *value.as.object->asString();
+        auto        strObj     = *value.asObject()->asString();
         const char *charPtr    = strObj.chars;
         const char *charPtrEnd = strObj.chars + strObj.length;
         while (charPtr != charPtrEnd)
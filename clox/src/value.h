@@ -2,18 +2,18 @@
 
 #include "utils/common.h"
 
+#include <bit>
+
 struct Object;
+struct StringPool;
+namespace serde
+{
+struct BufferReader;
+struct BufferWriter;
+}  // namespace serde
 
 struct Value
 {
-    union
-    {
-        bool    boolean;
-        double  number;
-        int     integer;
-        Object *object;
-    } as;
-
     enum class Type : uint8_t
     {
         Null,
@@ -24,31 +24,83 @@ struct Value
         Undefined,
         COUNT = Undefined
     };
-    Type               type = Type::Undefined;
     static const char *getTypeName(Type type);
 
     static constexpr struct NullType
     {
     } Null = NullType{};
 
-    Result<void> serialize(std::ostream &o_stream) const;
-    Result<void> deserialize(std::istream &i_stream);
+    // range of Type::Integer, results out of it are promoted to Type::Number (NaN-boxed integers only get 32 bits)
+#if USING(NAN_BOXING)
+    static constexpr int64_t kIntegerMin = INT32_MIN;
+    static constexpr int64_t kIntegerMax = INT32_MAX;
+#else   // #if USING(NAN_BOXING)
+    static constexpr int64_t kIntegerMin = INT64_MIN;
+    static constexpr int64_t kIntegerMax = INT64_MAX;
+#endif  // #else // #if USING(NAN_BOXING)
+    static constexpr bool fitsInteger(int64_t value) { return value >= kIntegerMin && value <= kIntegerMax; }
 
-    bool is(Type t) const { return t == type; }
+    // strings go through the pool when there is one (see StringPool)
+    Result<void> serialize(serde::BufferWriter &writer, StringPool *pool = nullptr) const;
+    Result<void> deserialize(serde::BufferReader &reader, const StringPool *pool = nullptr);
 
-    bool isNumber() const { return type == Type::Integer || type == Type::Number; }
+    Value() = default;
 
-    bool isFalsey() const { return type == Type::Null || (type == Type::Bool && as.boolean == false); }
+#if USING(NAN_BOXING)
+    Type getType() const
+    {
+        if ((_bits & kQuietNaN) != kQuietNaN)
+        {
+            return Type::Number;
+        }
+        if (_bits & kSignBit)
+        {
+            return Type::Object;
+        }
+        return static_cast<Type>(((_bits >> kTagShift) & kTagMask) - 1);
+    }
+
+    bool is(Type t) const
+    {
+        switch (t)
+        {
+            case Type::Number: return (_bits & kQuietNaN) != kQuietNaN;
+            case Type::Object: return (_bits & (kQuietNaN | kSignBit)) == (kQuietNaN | kSignBit);
+            default: return (_bits & ~kPayloadMask) == immediateBits(t);
+        }
+    }
+
+    bool    asBool() const { return (_bits & kPayloadMask) != 0; }
+    double  asNumber() const { return std::bit_cast<double>(_bits); }
+    int64_t asInteger() const { return static_cast<int32_t>(static_cast<uint32_t>(_bits)); }
+    Object *asObject() const { return reinterpret_cast<Object *>(static_cast<uintptr_t>(_bits & kPointerMask)); }
+#else   // #if USING(NAN_BOXING)
+    Type getType() const { return _type; }
+
+    bool is(Type t) const { return t == _type; }
+
+    bool    asBool() const { return _as.boolean; }
+    double  asNumber() const { return _as.number; }
+    int64_t asInteger() const { return _as.integer; }
+    Object *asObject() const { return _as.object; }
+#endif  // #else // #if USING(NAN_BOXING)
+
+    bool isNumber() const { return is(Type::Integer) || is(Type::Number); }
+    // numeric value of an Integer or a Number, promoted to double
+    double toDouble() const { return is(Type::Integer) ? static_cast<double>(asInteger()) : asNumber(); }
+
+    bool isFalsey() const { return is(Type::Null) || (is(Type::Bool) && asBool() == false); }
 
     explicit operator bool() const;
-    explicit operator int() const;
+    explicit operator int64_t() const;
     explicit operator double() const;
     explicit operator char *() const;
 
     static Value Create();
     static Value Create(NullType);
     static Value Create(bool value);
-    static Value Create(int value);
+    static Value Create(int64_t value);
+    static Value Create(int value) { return Create(static_cast<int64_t>(value)); }
     static Value Create(double value);
     // Object
     static Value Create(Object *object);
@@ -57,8 +109,158 @@ struct Value
 
     Value operator-() const;
     Value operator-(const Value &a);
+
+private:
+    friend struct ValueLayout;  // field offsets for the machine code of the JIT (see jit.cpp)
+
+#if USING(NAN_BOXING)
+    // Doubles are stored as-is, any other type lives in the payload of a quiet NaN (which arithmetic never produces):
+    //  - Object:     sign bit set, 48-bit pointer
+    //  - immediates: tag (Type + 1) at kTagShift, 32-bit payload for Bool/Integer (see kIntegerMin)
+    static constexpr uint64_t kSignBit     = 0x8000000000000000ull;
+    static constexpr uint64_t kQuietNaN    = 0x7ffc000000000000ull;
+    static constexpr uint64_t kPointerMask = 0x0000ffffffffffffull;
+    static constexpr uint64_t kPayloadMask = 0x00000000ffffffffull;
+    static constexpr int      kTagShift    = 32;
+    static constexpr uint64_t kTagMask     = 0x7;
+
+    static constexpr uint64_t immediateBits(Type t)
+    {
+        return kQuietNaN | (static_cast<uint64_t>(t) + 1) << kTagShift;
+    }
+
+    uint64_t _bits = immediateBits(Type::Undefined);
+#else   // #if USING(NAN_BOXING)
+    union
+    {
+        bool    boolean;
+        double  number;
+        int64_t integer;
+        Object *object;
+    } _as;
+    Type _type = Type::Undefined;
+#endif  // #else // #if USING(NAN_BOXING)
 };
+#if USING(NAN_BOXING)
+static_assert(sizeof(Value) == sizeof(uint64_t), "NaN-boxed Value must fit in 64 bits");
+#endif  // #if USING(NAN_BOXING)
+
+// inline, values are created on every VM instruction
+#if USING(NAN_BOXING)
+inline Value Value::Create() { return Value{}; }
+inline Value Value::Create(NullType)
+{
+    Value value;
+    value._bits = immediateBits(Type::Null);
+    return value;
+}
+inline Value Value::Create(bool boolean)
+{
+    Value value;
+    value._bits = immediateBits(Type::Bool) | (boolean ? 1 : 0);
+    return value;
+}
+inline Value Value::Create(int64_t integer)
+{
+    ASSERT(fitsInteger(integer));
+    Value value;
+    value._bits = immediateBits(Type::Integer) | static_cast<uint32_t>(integer);
+    return value;
+}
+inline Value Value::Create(double number)
+{
+    Value value;
+    value._bits = std::bit_cast<uint64_t>(number);
+    return value;
+}
+inline Value Value::Create(Object *object)
+{
+    ASSERT((reinterpret_cast<uintptr_t>(object) & ~kPointerMask) == 0);
+    Value value;
+    value._bits = kSignBit | kQuietNaN | static_cast<uint64_t>(reinterpret_cast<uintptr_t>(object));
+    return value;
+}
+#else   // #if USING(NAN_BOXING)
+inline Value Value::Create() { return Value{}; }
+inline Value Value::Create(NullType)
+{
+    Value value;
+    value._as.integer = (int)0xDEADBEEF;
+    value._type       = Type::Null;
+    return value;
+}
+inline Value Value::Create(bool boolean)
+{
+    Value value;
+    value._as.boolean = boolean;
+    value._type       = Type::Bool;
+    return value;
+}
+inline Value Value::Create(int64_t integer)
+{
+    Value value;
+    value._as.integer = integer;
+    value._type       = Type::Integer;
+    return value;
+}
+inline Value Value::Create(double number)
+{
+    Value value;
+    value._as.number = number;
+    value._type      = Type::Number;
+    return value;
+}
+inline Value Value::Create(Object *object)
+{
+    Value value;
+    value._as.object = object;
+    value._type      = Type::Object;
+    return value;
+}
+#endif  // #else // #if USING(NAN_BOXING)
 
+// integer arithmetic of the numeric tower: false when the result doesn't fit an Integer (promoted to double instead)
+inline bool addInteger(int64_t a, int64_t b, int64_t *o_result)
+{
+    if ((b > 0 && a > Value::kIntegerMax - b) || (b < 0 && a < Value::kIntegerMin - b))
+    {
+        return false;
+    }
+    *o_result = a + b;
+    return true;
+}
+inline bool subtractInteger(int64_t a, int64_t b, int64_t *o_result)
+{
+    if ((b < 0 && a > Value::kIntegerMax + b) || (b > 0 && a < Value::kIntegerMin + b))
+    {
+        return false;
+    }
+    *o_result = a - b;
+    return true;
+}
+inline bool multiplyInteger(int64_t a, int64_t b, int64_t *o_result)
+{
+    const bool overflows = a > 0 ? (b > 0 ? a > Value::kIntegerMax / b : b < Value::kIntegerMin / a)
+                                 : (b > 0 ? a < Value::kIntegerMin / b : a != 0 && b < Value::kIntegerMax / a);
+    if (overflows)
+    {
+        return false;
+    }
+    *o_result = a * b;
+    return true;
+}
+// exact quotients only, the others (and divisions by zero) are left to double division
+inline bool divideInteger(int64_t a, int64_t b, int64_t *o_result)
+{
+    if (b == 0 || (b == -1 && a == Value::kIntegerMin) || a % b != 0)
+    {
+        return false;
+    }
+    *o_result = a / b;
+    return true;
+}
+
+// numbers compare across Integer and Number
 bool operator==(const Value &a, const Value &b);
 bool operator<(const Value &a, const Value &b);
 bool operator>(const Value &a, const Value &b);
@@ -70,6 +272,103 @@ DECL_OPERATOR(*)
 DECL_OPERATOR(/)
 #undef DECL_OPERATOR
 
+// semantics of the arithmetic and comparison instructions, shared by every execution mode (the bytecode interpreter
+// with its quickened variants, the threaded and the register code): inline fast paths for Integer and Number
+// operands, the Value operators above otherwise
+enum class Arithmetic : uint8_t
+{
+    Add,
+    Subtract,
+    Multiply,
+    Divide
+};
+enum class Comparison : uint8_t
+{
+    Equal,
+    NotEqual,
+    Greater,
+    Less,
+    GreaterEqual,
+    LessEqual
+};
+
+template <Arithmetic OP>
+inline bool integerArithmetic(int64_t a, int64_t b, int64_t *o_result)
+{
+    switch (OP)
+    {
+        case Arithmetic::Add: return addInteger(a, b, o_result);
+        case Arithmetic::Subtract: return subtractInteger(a, b, o_result);
+        case Arithmetic::Multiply: return multiplyInteger(a, b, o_result);
+        case Arithmetic::Divide: return divideInteger(a, b, o_result);
+    }
+    return false;
+}
+template <Arithmetic OP>
+inline double numberArithmetic(double a, double b)
+{
+    switch (OP)
+    {
+        case Arithmetic::Add: return a + b;
+        case Arithmetic::Subtract: return a - b;
+        case Arithmetic::Multiply: return a * b;
+        case Arithmetic::Divide: return a / b;
+    }
+    return 0.0;
+}
+// Undefined for invalid operands (i.e., adding a string and a number)
+template <Arithmetic OP>
+inline Value arithmetic(const Value &a, const Value &b)
+{
+    int64_t result;
+    if (a.is(Value::Type::Integer) && b.is(Value::Type::Integer) &&
+        integerArithmetic<OP>(a.asInteger(), b.asInteger(), &result))
+    {
+        return Value::Create(result);
+    }
+    if (a.is(Value::Type::Number) && b.is(Value::Type::Number))
+    {
+        return Value::Create(numberArithmetic<OP>(a.asNumber(), b.asNumber()));
+    }
+    switch (OP)
+    {
+        case Arithmetic::Add: return a + b;
+        case Arithmetic::Subtract: return a - b;
+        case Arithmetic::Multiply: return a * b;
+        case Arithmetic::Divide: return a / b;
+    }
+    return Value::Create();
+}
+
+// integers, numbers or Values: the negated forms keep comparisons with NaN false
+template <Comparison OP, typename T>
+inline bool compare(const T &a, const T &b)
+{
+    switch (OP)
+    {
+        case Comparison::Equal: return a == b;
+        case Comparison::NotEqual: return !(a == b);
+        case Comparison::Greater: return a > b;
+        case Comparison::Less: return a < b;
+        case Comparison::GreaterEqual: return !(a < b);
+        case Comparison::LessEqual: return !(a > b);
+    }
+    return false;
+}
+template <Comparison OP>
+inline bool compareValues(const Value &a, const Value &b)
+{
+    if (a.is(Value::Type::Integer) && b.is(Value::Type::Integer))
+    {
+        return compare<OP>(a.asInteger(), b.asInteger());
+    }
+    if (a.is(Value::Type::Number) && b.is(Value::Type::Number))
+    {
+        return compare<OP>(a.asNumber(), b.asNumber());
+    }
+    return compare<OP>(a, b);
+}
+
 ////////////////////////////
 
 void printValue(const Value &value);
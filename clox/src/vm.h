@@ -3,15 +3,21 @@ https://craftinginterpreters.com/a-virtual-machine.html
 */
 #pragma once
 
+#include <array>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
 
+#include "bytecode_cache.h"
 #include "chunk.h"
 #include "object.h"
 #include "compiler.h"
 #include "debug.h"
 #include "environment.h"
+#include "jit.h"
+#include "natives.h"
+#include "register_code.h"
+#include "threaded_code.h"
 #include "utils/common.h"
 
 #if DEBUG_TRACE_EXECUTION
@@ -39,6 +45,43 @@ struct VirtualMachine
     struct Configuration
     {
         bool stepByStep = false;
+        bool profile    = false;  // per-OpCode execution counts, printed after each run
+        bool gcStats    = false;  // garbage collector/allocator stats, printed after each run
+        bool threaded   = false;  // runs pre-decoded code instead of the bytecode (see runThreaded), no JIT then
+        bool registers  = false;  // runs register code instead of the bytecode (see runRegisters), no JIT then
+
+        bool superinstructions = true;  // frequent sequences run as one instruction (see Chunk::fuseSuperinstructions)
+
+        bool     jit          = true;                    // hot chunks run as machine code (USING(JIT) builds only)
+        uint32_t jitThreshold = jit::kDefaultThreshold;  // calls and loop back-edges before compiling a chunk
+
+        const char *cacheDirectory = nullptr;  // scripts run from files are compiled once into it (see BytecodeCache)
+    };
+
+    // Execution policies: run() is instantiated once per policy, so the production loop carries no
+    // trace/debug/profiling checks. The policy is picked once per chunk in execute().
+    struct ExecutionPolicy
+    {
+        static constexpr bool kTrace      = false;
+        static constexpr bool kStepByStep = false;
+        static constexpr bool kProfile    = false;
+        static constexpr bool kJit        = USING(JIT);
+    };
+#if DEBUG_TRACE_EXECUTION
+    struct TracePolicy : ExecutionPolicy
+    {
+        static constexpr bool kTrace = true;
+        static constexpr bool kJit   = false;  // every instruction goes through the interpreter
+    };
+    struct StepDebugPolicy : TracePolicy
+    {
+        static constexpr bool kStepByStep = true;
+    };
+#endif  // #if DEBUG_TRACE_EXECUTION
+    struct ProfilePolicy : ExecutionPolicy
+    {
+        static constexpr bool kProfile = true;
+        static constexpr bool kJit     = false;  // every instruction goes through the interpreter
     };
 
     Configuration _configuration;
@@ -62,163 +105,426 @@ struct VirtualMachine
     {
         _configuration = configuration;
 
-        ASSERT(_environments.empty());
-        _environments.push_back(std::make_unique<Environment>());
-        _currrentEnvironment = _environments.back().get();
+        ASSERT(_environment.getVariableCount() == 0);
+
+        GarbageCollector::removeRoots(this);
+        GarbageCollector::addRoots(this, [this] { markRoots(); });
+
+        for (const natives::Definition &native : natives::getStandard())
+        {
+            defineNative(native.name, native.function, native.arity);
+        }
 
         return makeResult<result_t>(InterpretResult::Ok);
     }
 
     void init() { init(_configuration); }
 
+    // global visible to every script run afterwards, replacing any previous one with the same name
+    void defineNative(const char *name, NativeFn function, uint8_t arity)
+    {
+        ObjectNative *native = ObjectNative::Create(name, function, arity);
+        Value        *value  = findVariable(native->name);
+        if (value == nullptr)
+        {
+            value = addVariable(native->name);
+        }
+        *value = Value::Create(native);
+    }
+
     result_t finish()
     {
-        ASSERT(_environments.size() <= 1);
-        _environments.clear();
+        _environment.Reset();
+        _function   = nullptr;
+        _frameCount = 0;
 
+        GarbageCollector::removeRoots(this);
         Object::FreeObjects();
         return makeResult<result_t>(InterpretResult::Ok);
     }
 
+    template <typename PolicyT>
     result_t run()
     {
 #define READ_U8() (*_ip++)
+#define READ_U24() (_ip += 3, (uint32_t)((_ip[-3] << 16) | (_ip[-2] << 8) | _ip[-1]))
 #define READ_OFFSET16() (_ip += 2, (int16_t)((_ip[-2] << 8) | _ip[-1]))
-#define READ_CONSTANT() (_chunk->getConstants()[READ_U8()])
-#define READ_STRING() (READ_CONSTANT().as.object->asString()->chars)
-#define BINARY_OP(op)               \
-    do                              \
-    {                               \
-        const Value b = stackPop(); \
-        const Value a = stackPop(); \
-        stackPush(a op b);          \
+#define READ_OFFSET32() (_ip += 4, (int32_t)(((uint32_t)_ip[-4] << 24) | (_ip[-3] << 16) | (_ip[-2] << 8) | _ip[-1]))
+#define READ_CONSTANT() (_chunk->getConstants()[operand])
+#define READ_STRING() (READ_CONSTANT().asObject()->asString())
+// generic instructions, on any operands (see arithmetic and compareValues in value.h)
+#define BINARY_OP(OP)                                                                               \
+    do                                                                                              \
+    {                                                                                               \
+        const Value b = stackPop();                                                                 \
+        const Value a = stackPop();                                                                 \
+        stackPush(arithmetic<Arithmetic::OP>(a, b));                                                \
+    } while (false)
+#define COMPARISON_OP(OP)                                                                           \
+    do                                                                                              \
+    {                                                                                               \
+        const Value b = stackPop();                                                                 \
+        const Value a = stackPop();                                                                 \
+        stackPush(Value::Create(compareValues<Comparison::OP>(a, b)));                              \
+    } while (false)
+#define IS_STRING(VALUE) ((VALUE).is(Value::Type::Object) && (VALUE).asObject()->type == Object::Type::String)
+#define NUMBER_OPERANDS() (peek(0).is(Value::Type::Number) && peek(1).is(Value::Type::Number))
+#define INTEGER_OPERANDS() (peek(0).is(Value::Type::Integer) && peek(1).is(Value::Type::Integer))
+#define STRING_OPERANDS() (IS_STRING(peek(0)) && IS_STRING(peek(1)))
+// rewrites the instruction being executed (see Chunk::quicken), it is only executed as generic this time
+#define QUICKEN_IF(CONDITION, OP)                                                                   \
+    if (CONDITION)                                                                                  \
+    {                                                                                               \
+        _chunk->quicken(static_cast<codepos_t>(_ip - 1 - _chunk->getCode()), OpCode::OP);           \
+    }
+// both operands numbers or the generic instruction runs instead
+#define NUMBER_ARITHMETIC_OP(GENERIC, OP)                                                           \
+    do                                                                                              \
+    {                                                                                               \
+        if (!NUMBER_OPERANDS())                                                                     \
+        {                                                                                           \
+            goto GENERIC;                                                                           \
+        }                                                                                           \
+        const double x = _stackTop[-2].asNumber();                                                  \
+        const double y = _stackTop[-1].asNumber();                                                  \
+        --_stackTop;                                                                                \
+        _stackTop[-1] = Value::Create(numberArithmetic<Arithmetic::OP>(x, y));                      \
+    } while (false)
+#define NUMBER_COMPARISON_OP(GENERIC, OP)                                                           \
+    do                                                                                              \
+    {                                                                                               \
+        if (!NUMBER_OPERANDS())                                                                     \
+        {                                                                                           \
+            goto GENERIC;                                                                           \
+        }                                                                                           \
+        const double x = _stackTop[-2].asNumber();                                                  \
+        const double y = _stackTop[-1].asNumber();                                                  \
+        --_stackTop;                                                                                \
+        _stackTop[-1] = Value::Create(compare<Comparison::OP>(x, y));                               \
+    } while (false)
+// both operands integers or the generic instruction runs instead
+#define INTEGER_COMPARISON_OP(GENERIC, OP)                                                          \
+    do                                                                                              \
+    {                                                                                               \
+        if (!INTEGER_OPERANDS())                                                                    \
+        {                                                                                           \
+            goto GENERIC;                                                                           \
+        }                                                                                           \
+        const int64_t x = _stackTop[-2].asInteger();                                                \
+        const int64_t y = _stackTop[-1].asInteger();                                                \
+        --_stackTop;                                                                                \
+        _stackTop[-1] = Value::Create(compare<Comparison::OP>(x, y));                               \
+    } while (false)
+// both operands integers and a result fitting an Integer (see addInteger...), or the generic instruction promotes it
+#define INTEGER_ARITHMETIC_OP(GENERIC, OP)                                                          \
+    do                                                                                              \
+    {                                                                                               \
+        int64_t result;                                                                             \
+        if (!INTEGER_OPERANDS() ||                                                                  \
+            !integerArithmetic<Arithmetic::OP>(_stackTop[-2].asInteger(), _stackTop[-1].asInteger(), \
+                                               &result))                                            \
+        {                                                                                           \
+            goto GENERIC;                                                                           \
+        }                                                                                           \
+        --_stackTop;                                                                                \
+        _stackTop[-1] = Value::Create(result);                                                      \
+    } while (false)
+// LocalVarGet; <Y>; Less; JumpIfFalse superinstructions: both integers or both numbers, only the first instruction
+// runs otherwise. The condition stays on the stack for the Pop following on both paths.
+#define FUSED_LESS_JUMP_IF_FALSE(OP, Y)                                                             \
+    do                                                                                              \
+    {                                                                                               \
+        const Value &x = _slots[_ip[0]];                                                            \
+        const Value &y = (Y);                                                                       \
+        bool         less;                                                                          \
+        if (x.is(Value::Type::Integer) && y.is(Value::Type::Integer))                               \
+        {                                                                                           \
+            less = compare<Comparison::Less>(x.asInteger(), y.asInteger());                         \
+        }                                                                                           \
+        else if (x.is(Value::Type::Number) && y.is(Value::Type::Number))                            \
+        {                                                                                           \
+            less = compare<Comparison::Less>(x.asNumber(), y.asNumber());                           \
+        }                                                                                           \
+        else                                                                                        \
+        {                                                                                           \
+            operand = READ_U8();                                                                    \
+            goto localVarGet;                                                                       \
+        }                                                                                           \
+        stackPush(Value::Create(less));                                                             \
+        _ip += getSuperinstructionLength(OpCode::OP) - 1 - sizeof(jump_t);                          \
+        offset = READ_OFFSET16();                                                                   \
+        goto jumpIfFalse;                                                                           \
     } while (false)
 
+        // operands shared by the compact and *Long variants of an instruction
+        uint32_t operand = 0;
+        int32_t  offset  = 0;
+
 #if DEBUG_TRACE_EXECUTION
-        if (_compiler.getConfiguration().disassemble)
+        [[maybe_unused]] TraceState traceState;
+        if constexpr (PolicyT::kTrace)
         {
             printf("== VM ==\n");
+            traceState.linesAvailable = _chunk->getLineCount() > 0;
+            traceState.stepDebugging  = PolicyT::kStepByStep;
         }
-        const bool linesAvailable = _chunk->getLineCount() > 0;
-        uint16_t   scopeCount     = 0;
-        bool       stepDebugging  = _configuration.stepByStep;
+#define TRACE_INSTRUCTION()                   \
+    if constexpr (PolicyT::kTrace)            \
+    {                                         \
+        traceInstruction(traceState);         \
+    }                                         \
+    if constexpr (PolicyT::kProfile)          \
+    {                                         \
+        _profile.count(_ip);                  \
+    }
+#else  // #if DEBUG_TRACE_EXECUTION
+#define TRACE_INSTRUCTION()                   \
+    if constexpr (PolicyT::kProfile)          \
+    {                                         \
+        _profile.count(_ip);                  \
+    }
+#endif  // #else // #if DEBUG_TRACE_EXECUTION
+#if USING(JIT)
+// entry points to the machine code: start of a chunk, calls and loop back-edges (see runJit)
+#define JIT_ENTER()                           \
+    if constexpr (PolicyT::kJit)              \
+    {                                         \
+        if (_configuration.jit)               \
+        {                                     \
+            runJit();                         \
+        }                                     \
+    }
+#else  // #if USING(JIT)
+#define JIT_ENTER()
+#endif  // #else // #if USING(JIT)
+
+        JIT_ENTER();
+
+#if USING(VM_COMPUTED_GOTO)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"  // labels as values
+        // one handler per OpCode, following the declaration order in chunk.h
+        static void *const kHandlers[] = {
+            &&op_Return,              &&op_Constant,            &&op_Null,                &&op_True,
+            &&op_False,               &&op_Negate,              &&op_Not,                 &&op_Assignment,
+            &&op_Equal,               &&op_Greater,             &&op_Less,                &&op_NotEqual,
+            &&op_GreaterEqual,        &&op_LessEqual,           &&op_Add,                 &&op_Subtract,
+            &&op_Multiply,            &&op_Divide,              &&op_Print,               &&op_GlobalVarDef,
+            &&op_GlobalVarSet,        &&op_GlobalVarGet,        &&op_GlobalSlotDef,       &&op_GlobalSlotSet,
+            &&op_GlobalSlotGet,       &&op_LocalVarSet,         &&op_LocalVarGet,         &&op_Pop,
+            &&op_Skip,                &&op_Jump,                &&op_JumpIfFalse,         &&op_JumpIfTrue,
+            &&op_ScopeBegin,          &&op_ScopeEnd,            &&op_Call,                &&op_ConstantLong,
+            &&op_GlobalVarDefLong,    &&op_GlobalVarSetLong,    &&op_GlobalVarGetLong,    &&op_GlobalSlotDefLong,
+            &&op_GlobalSlotSetLong,   &&op_GlobalSlotGetLong,   &&op_LocalVarSetLong,     &&op_LocalVarGetLong,
+            &&op_JumpLong,            &&op_JumpIfFalseLong,     &&op_JumpIfTrueLong,      &&op_AddNumber,
+            &&op_AddString,           &&op_SubtractNumber,      &&op_MultiplyNumber,      &&op_DivideNumber,
+            &&op_EqualNumber,         &&op_NotEqualNumber,      &&op_GreaterNumber,       &&op_LessNumber,
+            &&op_GreaterEqualNumber,  &&op_LessEqualNumber,     &&op_AddInteger,          &&op_SubtractInteger,
+            &&op_MultiplyInteger,     &&op_EqualInteger,        &&op_NotEqualInteger,     &&op_GreaterInteger,
+            &&op_LessInteger,         &&op_GreaterEqualInteger, &&op_LessEqualInteger,
+            &&op_LocalVarGetConstantAdd,                &&op_LocalVarGetConstantLessJumpIfFalse,
+            &&op_LocalVarGetLocalVarGetLessJumpIfFalse, &&op_GlobalSlotSetPop,
+            &&op_LocalVarSetPop,                        &&op_PopJump,
+            &&op_Undefined,
+        };
+        static_assert(ARRAY_COUNT(kHandlers) == named_enum::size<OpCode>(), "Missing OpCode handlers");
+        // padded to every opcode_t value, so a byte past Undefined reaching the dispatch still lands on op_Undefined
+        static const auto kDispatchTable = []
+        {
+            std::array<void *, 1u << (8 * sizeof(opcode_t))> table;
+            table.fill(kHandlers[static_cast<size_t>(OpCode::Undefined)]);
+            std::copy(std::begin(kHandlers), std::end(kHandlers), table.begin());
+            return table;
+        }();
+
+#define VM_CASE(OP) op_##OP
+#define VM_NEXT()                               \
+    do                                          \
+    {                                           \
+        TRACE_INSTRUCTION();                    \
+        goto *kDispatchTable[READ_U8()];        \
+    } while (false)
+
+        VM_NEXT();
+        {
+            {
+#else   // #if USING(VM_COMPUTED_GOTO)
+#define VM_CASE(OP) case OpCode::OP
+#define VM_NEXT() break
+
         for (;;)
         {
-            if (_compiler.getConfiguration().disassemble)
+            TRACE_INSTRUCTION();
+            const OpCode instruction = OpCode(READ_U8());
+            switch (instruction)
             {
-                static bool sWasPrint = false;
-                if (sWasPrint)
-                {
-                    printf("\n");
-                    sWasPrint = false;
-                }
-                const char *padding = "          ";
-                // printf("%s#Env: %d\n", padding, (int)_environments.size());
-                printStack(padding);
-                printVariables(padding);
-                _chunk->printConstants(padding);
-                OpCode instruction = OpCode::Undefined;
-                disassembleInstruction(*_chunk, static_cast<uint16_t>(_ip - _chunk->getCode()), linesAvailable,
-                                       &scopeCount, &instruction);
-                if (instruction == OpCode::Print)
+#endif  // #else // #if USING(VM_COMPUTED_GOTO)
+                VM_CASE(Return):
                 {
-                    sWasPrint = true;
-                    printf("[output]");
+                    if (!popFrame(stackPop()))
+                    {
+                        return InterpretResult::Ok;
+                    }
+                    _ip = _frames[_frameCount - 1].ip;
+                    // not entering the machine code here: the caller usually runs a few instructions up to its next
+                    // call or return, costing more than interpreting them (i.e., recursive calls)
+                    VM_NEXT();
                 }
-                if (stepDebugging)
+                VM_CASE(Call):
                 {
-                    // todo : time machine (prev/next IP)
-                    // static std::vector<codepos_t> sTimeMachine;
-                    while (true)
+                    const uint8_t argCount      = READ_U8();
+                    _frames[_frameCount - 1].ip = _ip;
+                    const ObjectFunction *function;
+                    if (const char *error = prepareCall(_stackTop - argCount - 1, argCount, &function))
                     {
-                        const char c = read_char();
-                        if (c == 'n')
-                        {
-                            // sTimeMachine.push_back(_ip - _chunk->getCode());
-                            break;
-                        }
-                        // WIP - going back requires restoring previous state
-                        // else if (c == 'p')
-                        // {
-                        //     _ip = sTimeMachine.back() + _chunk->getCode();
-                        //     sTimeMachine.pop_back();
-                        //     break;
-                        // }
-                        else if (c == 'q')
-                        {
-                            stepDebugging = false;
-                            break;
-                        }
+                        return runtimeError("%s", error);
+                    }
+                    if (function == nullptr)
+                    {  // native result in place of the callee
+                        _stackTop -= argCount;
+                        VM_NEXT();
                     }
+                    _ip = _chunk->getCode();
+                    JIT_ENTER();
+                    VM_NEXT();
                 }
-            }
-#else   // #if DEBUG_TRACE_EXECUTION
-        for (;;)
-        {
-#endif  // #else // #if DEBUG_TRACE_EXECUTION
-            const OpCode instruction = OpCode(READ_U8());
-            switch (instruction)
-            {
-                case OpCode::Return: return InterpretResult::Ok;
-                case OpCode::Constant:
+                VM_CASE(ConstantLong):
+                    operand = READ_U24();
+                    goto constant;
+                VM_CASE(Constant):
+                    operand = READ_U8();
+                constant:
                 {
                     const Value constant = READ_CONSTANT();
                     stackPush(constant);
                 }
-                break;
+                VM_NEXT();
 
-                case OpCode::Null: stackPush(Value::Create(Value::Null)); break;
-                case OpCode::True: stackPush(Value::Create(true)); break;
-                case OpCode::False: stackPush(Value::Create(false)); break;
+                VM_CASE(Null): stackPush(Value::Create(Value::Null)); VM_NEXT();
+                VM_CASE(True): stackPush(Value::Create(true)); VM_NEXT();
+                VM_CASE(False): stackPush(Value::Create(false)); VM_NEXT();
 
-                case OpCode::Equal:
-                {
-                    const Value b = stackPop();
-                    const Value a = stackPop();
-                    stackPush(Value::Create(a == b));
-                }
-                break;
-                case OpCode::Greater:
-                {
-                    const Value b = stackPop();
-                    const Value a = stackPop();
-                    stackPush(Value::Create(a > b));
-                }
-                break;
-                case OpCode::Less:
-                {
-                    const Value b = stackPop();
-                    const Value a = stackPop();
-                    stackPush(Value::Create(a < b));
-                }
-                break;
+                // generic comparisons and arithmetic get quickened into a type-specialized variant from the operands
+                // seen on first execution, the variants fall back to the generic code when their type guard fails
+                VM_CASE(Equal):
+                    QUICKEN_IF(NUMBER_OPERANDS(), EqualNumber);
+                    QUICKEN_IF(INTEGER_OPERANDS(), EqualInteger);
+                equal:
+                    COMPARISON_OP(Equal);
+                    VM_NEXT();
+                VM_CASE(Greater):
+                    QUICKEN_IF(NUMBER_OPERANDS(), GreaterNumber);
+                    QUICKEN_IF(INTEGER_OPERANDS(), GreaterInteger);
+                greater:
+                    COMPARISON_OP(Greater);
+                    VM_NEXT();
+                VM_CASE(Less):
+                    QUICKEN_IF(NUMBER_OPERANDS(), LessNumber);
+                    QUICKEN_IF(INTEGER_OPERANDS(), LessInteger);
+                less:
+                    COMPARISON_OP(Less);
+                    VM_NEXT();
+                // fused <comparison>; Not
+                VM_CASE(NotEqual):
+                    QUICKEN_IF(NUMBER_OPERANDS(), NotEqualNumber);
+                    QUICKEN_IF(INTEGER_OPERANDS(), NotEqualInteger);
+                notEqual:
+                    COMPARISON_OP(NotEqual);
+                    VM_NEXT();
+                VM_CASE(GreaterEqual):
+                    QUICKEN_IF(NUMBER_OPERANDS(), GreaterEqualNumber);
+                    QUICKEN_IF(INTEGER_OPERANDS(), GreaterEqualInteger);
+                greaterEqual:
+                    COMPARISON_OP(GreaterEqual);
+                    VM_NEXT();
+                VM_CASE(LessEqual):
+                    QUICKEN_IF(NUMBER_OPERANDS(), LessEqualNumber);
+                    QUICKEN_IF(INTEGER_OPERANDS(), LessEqualInteger);
+                lessEqual:
+                    COMPARISON_OP(LessEqual);
+                    VM_NEXT();
 
-                case OpCode::Add:
+                VM_CASE(Add):
+                    QUICKEN_IF(NUMBER_OPERANDS(), AddNumber);
+                    QUICKEN_IF(INTEGER_OPERANDS(), AddInteger);
+                    QUICKEN_IF(STRING_OPERANDS(), AddString);
+                add:
                 {
-                    const Value b = stackPop();
-                    const Value a = stackPop();
-                    Value newValue = a + b;
-                    if (newValue.type != Value::Type::Undefined)
+                    // operands stay on the stack (rooted) while the result is allocated
+                    const Value &b        = peek(0);
+                    const Value &a        = peek(1);
+                    Value        newValue = arithmetic<Arithmetic::Add>(a, b);
+                    if (!newValue.is(Value::Type::Undefined))
                     {
+                        stackPop();
+                        stackPop();
                         stackPush(newValue);
                     }
                     else
                     {
                         FAIL_MSG("Invalid operands for 'Add'");
                         return runtimeError("Cannot add types %s + %s",
-                            a.type != Value::Type::Object ? a.getTypeName(a.type) : a.as.object->getTypeName(a.as.object->type),
-                            b.type != Value::Type::Object ? b.getTypeName(b.type) : b.as.object->getTypeName(b.as.object->type));
+                            !a.is(Value::Type::Object) ? a.getTypeName(a.getType()) : a.asObject()->getTypeName(a.asObject()->type),
+                            !b.is(Value::Type::Object) ? b.getTypeName(b.getType()) : b.asObject()->getTypeName(b.asObject()->type));
                     }
                 }
-                break;
+                VM_NEXT();
 
-                case OpCode::Divide: BINARY_OP(/); break;
-                case OpCode::Multiply: BINARY_OP(*); break;
-                case OpCode::Subtract: BINARY_OP(-); break;
-                case OpCode::Negate:
+                VM_CASE(Divide):
+                    QUICKEN_IF(NUMBER_OPERANDS(), DivideNumber);
+                divide:
+                    BINARY_OP(Divide);
+                    VM_NEXT();
+                VM_CASE(Multiply):
+                    QUICKEN_IF(NUMBER_OPERANDS(), MultiplyNumber);
+                    QUICKEN_IF(INTEGER_OPERANDS(), MultiplyInteger);
+                multiply:
+                    BINARY_OP(Multiply);
+                    VM_NEXT();
+                VM_CASE(Subtract):
+                    QUICKEN_IF(NUMBER_OPERANDS(), SubtractNumber);
+                    QUICKEN_IF(INTEGER_OPERANDS(), SubtractInteger);
+                subtract:
+                    BINARY_OP(Subtract);
+                    VM_NEXT();
+
+                VM_CASE(AddNumber): NUMBER_ARITHMETIC_OP(add, Add); VM_NEXT();
+                VM_CASE(SubtractNumber): NUMBER_ARITHMETIC_OP(subtract, Subtract); VM_NEXT();
+                VM_CASE(MultiplyNumber): NUMBER_ARITHMETIC_OP(multiply, Multiply); VM_NEXT();
+                VM_CASE(DivideNumber): NUMBER_ARITHMETIC_OP(divide, Divide); VM_NEXT();
+                VM_CASE(EqualNumber): NUMBER_COMPARISON_OP(equal, Equal); VM_NEXT();
+                VM_CASE(NotEqualNumber): NUMBER_COMPARISON_OP(notEqual, NotEqual); VM_NEXT();
+                VM_CASE(GreaterNumber): NUMBER_COMPARISON_OP(greater, Greater); VM_NEXT();
+                VM_CASE(LessNumber): NUMBER_COMPARISON_OP(less, Less); VM_NEXT();
+                VM_CASE(GreaterEqualNumber): NUMBER_COMPARISON_OP(greaterEqual, GreaterEqual); VM_NEXT();
+                VM_CASE(LessEqualNumber): NUMBER_COMPARISON_OP(lessEqual, LessEqual); VM_NEXT();
+                VM_CASE(AddInteger): INTEGER_ARITHMETIC_OP(add, Add); VM_NEXT();
+                VM_CASE(SubtractInteger): INTEGER_ARITHMETIC_OP(subtract, Subtract); VM_NEXT();
+                VM_CASE(MultiplyInteger): INTEGER_ARITHMETIC_OP(multiply, Multiply); VM_NEXT();
+                VM_CASE(EqualInteger): INTEGER_COMPARISON_OP(equal, Equal); VM_NEXT();
+                VM_CASE(NotEqualInteger): INTEGER_COMPARISON_OP(notEqual, NotEqual); VM_NEXT();
+                VM_CASE(GreaterInteger): INTEGER_COMPARISON_OP(greater, Greater); VM_NEXT();
+                VM_CASE(LessInteger): INTEGER_COMPARISON_OP(less, Less); VM_NEXT();
+                VM_CASE(GreaterEqualInteger): INTEGER_COMPARISON_OP(greaterEqual, GreaterEqual); VM_NEXT();
+                VM_CASE(LessEqualInteger): INTEGER_COMPARISON_OP(lessEqual, LessEqual); VM_NEXT();
+                VM_CASE(AddString):
+                {
+                    if (!STRING_OPERANDS())
+                    {
+                        goto add;
+                    }
+                    // operands stay on the stack (rooted) while the result is allocated
+                    const ObjectString *a      = peek(1).asObject()->asString();
+                    const ObjectString *b      = peek(0).asObject()->asString();
+                    Object             *result = ObjectString::CreateConcat(a->chars, a->length, b->chars, b->length);
+                    stackPop();
+                    _stackTop[-1] = Value::Create(result);
+                    VM_NEXT();
+                }
+                VM_CASE(Negate):
                 {
                     const Value &value = peek(0);
-                    if (value.type == Value::Type::Number || value.type == Value::Type::Integer)
+                    if (value.isNumber())
                     {
                         stackPop();
                         stackPush(-value);
@@ -228,29 +534,39 @@ struct VirtualMachine
                         return runtimeError("Operand must be a number");
                     }
                 }
-                break;
-                case OpCode::Not: stackPush(Value::Create(stackPop().isFalsey())); break;
-                case OpCode::Print:
+                VM_NEXT();
+                VM_CASE(Not): stackPush(Value::Create(stackPop().isFalsey())); VM_NEXT();
+                VM_CASE(Print):
                 {
                     printValue(stackPop());
-                    break;
+                    VM_NEXT();
                 }
-                case OpCode::Pop:
+                VM_CASE(Pop):
                 {
                     stackPop();
-                    break;
+                    VM_NEXT();
                 }
-                case OpCode::GlobalVarDef:
+                VM_CASE(GlobalVarDefLong):
+                    operand = READ_U24();
+                    goto globalVarDef;
+                VM_CASE(GlobalVarDef):
+                    operand = READ_U8();
+                globalVarDef:
                 {
-                    const char *varName = READ_STRING();
-                    Value      *value   = addVariable(varName);
-                    *value              = stackPop();  // null or expression :)
-                    break;
+                    const ObjectString *varName = READ_STRING();
+                    Value              *value   = addVariable(varName);
+                    *value                      = stackPop();  // null or expression :)
+                    VM_NEXT();
                 }
-                case OpCode::GlobalVarSet:
+                VM_CASE(GlobalVarSetLong):
+                    operand = READ_U24();
+                    goto globalVarSet;
+                VM_CASE(GlobalVarSet):
+                    operand = READ_U8();
+                globalVarSet:
                 {
-                    const char *varName = READ_STRING();
-                    Value      *value   = findVariable(varName);
+                    const ObjectString *varName = READ_STRING();
+                    Value              *value   = findVariable(varName);
                     if (value == nullptr)
                     {
                         if (_compiler.getConfiguration().allowDynamicVariables)
@@ -259,44 +575,105 @@ struct VirtualMachine
                         }
                         else
                         {
-                            return runtimeError("Trying to write to undeclared variable '%s'.", varName);
+                            return runtimeError("Trying to write to undeclared variable '%s'.", varName->chars);
                         }
                     }
                     *value = peek(0);
-                    break;
+                    VM_NEXT();
                 }
-                case OpCode::GlobalVarGet:
+                VM_CASE(GlobalVarGetLong):
+                    operand = READ_U24();
+                    goto globalVarGet;
+                VM_CASE(GlobalVarGet):
+                    operand = READ_U8();
+                globalVarGet:
                 {
-                    const char *varName = READ_STRING();
-                    Value      *value   = findVariable(varName);
+                    const ObjectString *varName = READ_STRING();
+                    Value              *value   = findVariable(varName);
                     if (value == nullptr)
                     {
-                        return runtimeError("Trying to read undeclared variable '%s'.", varName);
+                        return runtimeError("Trying to read undeclared variable '%s'.", varName->chars);
                     }
                     else if (value->is(Value::Type::Null))
                     {
-                        return runtimeError("Trying to read undefined variable '%s'.", varName);
+                        return runtimeError("Trying to read undefined variable '%s'.", varName->chars);
                     }
                     stackPush(*value);
-                    break;
+                    VM_NEXT();
                 }
-                case OpCode::LocalVarSet:
+                VM_CASE(GlobalSlotDefLong):
+                    operand = READ_U24();
+                    goto globalSlotDef;
+                VM_CASE(GlobalSlotDef):
+                    operand = READ_U8();
+                globalSlotDef:
                 {
-                    const uint8_t slot = READ_U8();
-                    _stack[slot]       = peek(0);
-                    break;
+                    _globals[operand] = stackPop();  // null or expression
+                    VM_NEXT();
                 }
-                case OpCode::LocalVarGet:
+                VM_CASE(GlobalSlotSetLong):
+                    operand = READ_U24();
+                    goto globalSlotSet;
+                VM_CASE(GlobalSlotSet):
+                    operand = READ_U8();
+                globalSlotSet:
                 {
-                    const uint8_t slot = READ_U8();
-                    stackPush(_stack[slot]);
-                    break;
+                    const uint32_t slot  = operand;
+                    Value         &value = _globals[slot];
+                    if (value.is(Value::Type::Undefined))
+                    {
+                        return runtimeError("Trying to write to undeclared variable '%s'.", getGlobalName(slot));
+                    }
+                    value = peek(0);
+                    VM_NEXT();
                 }
-                case OpCode::Assignment:
+                VM_CASE(GlobalSlotGetLong):
+                    operand = READ_U24();
+                    goto globalSlotGet;
+                VM_CASE(GlobalSlotGet):
+                    operand = READ_U8();
+                globalSlotGet:
                 {
-                    const Value rvalue   = stackPop();
-                    const char *varName  = READ_STRING();
-                    Value      *varValue = nullptr;
+                    const uint32_t slot  = operand;
+                    const Value   &value = _globals[slot];
+                    if (value.is(Value::Type::Undefined))
+                    {
+                        return runtimeError("Trying to read undeclared variable '%s'.", getGlobalName(slot));
+                    }
+                    else if (value.is(Value::Type::Null))
+                    {
+                        return runtimeError("Trying to read undefined variable '%s'.", getGlobalName(slot));
+                    }
+                    stackPush(value);
+                    VM_NEXT();
+                }
+                VM_CASE(LocalVarSetLong):
+                    operand = READ_U24();
+                    goto localVarSet;
+                VM_CASE(LocalVarSet):
+                    operand = READ_U8();
+                localVarSet:
+                {
+                    _slots[operand] = peek(0);
+                    VM_NEXT();
+                }
+                VM_CASE(LocalVarGetLong):
+                    operand = READ_U24();
+                    goto localVarGet;
+                VM_CASE(LocalVarGet):
+                    operand = READ_U8();
+                localVarGet:
+                {
+                    stackPush(_slots[operand]);
+                    VM_NEXT();
+                }
+                VM_CASE(Assignment):
+                {
+                    operand = READ_U8();
+
+                    const Value         rvalue   = stackPop();
+                    const ObjectString *varName  = READ_STRING();
+                    Value              *varValue = nullptr;
                     // check local variables
                     // ...
                     if (varValue == nullptr)
@@ -306,68 +683,811 @@ struct VirtualMachine
                     if (varValue == nullptr)
                     {  // allow dynamic creation ?
                         varValue = addVariable(varName);
-                        DEBUGPRINT_EX("Dynamic var(%s) created\n", varName);
+                        DEBUGPRINT_EX("Dynamic var(%s) created\n", varName->chars);
                     }
                     if (varValue != nullptr)
                     {
                         *varValue = rvalue;
 #if USING(DEBUG_BUILD)
-                        DEBUGPRINT_EX("var(%s)=%s\n", varName);
+                        DEBUGPRINT_EX("var(%s)=%s\n", varName->chars);
                         printValueDebug(rvalue);
 #endif  // #if USING(DEBUG_BUILD)
                     }
-                    break;
+                    VM_NEXT();
                 }
-                case OpCode::Skip: break;
+                VM_CASE(Skip): VM_NEXT();
 
-                case OpCode::Jump:
+                VM_CASE(JumpLong):
+                    offset = READ_OFFSET32();
+                    goto jump;
+                VM_CASE(Jump):
+                    offset = READ_OFFSET16();
+                jump:
                 {
-                    const int16_t offset = READ_OFFSET16();
                     _ip += offset;
-                    break;
+                    if (offset < 0)
+                    {
+                        JIT_ENTER();
+                    }
+                    VM_NEXT();
                 }
-                case OpCode::JumpIfFalse:
+                VM_CASE(JumpIfFalseLong):
+                    offset = READ_OFFSET32();
+                    goto jumpIfFalse;
+                VM_CASE(JumpIfFalse):
+                    offset = READ_OFFSET16();
+                jumpIfFalse:
                 {
-                    const int16_t offset = READ_OFFSET16();
                     if (peek(0).isFalsey())
                     {
                         _ip += offset;
+                        if (offset < 0)
+                        {
+                            JIT_ENTER();
+                        }
                     }
-                    break;
+                    VM_NEXT();
                 }
-                case OpCode::JumpIfTrue:
+                VM_CASE(JumpIfTrueLong):
+                    offset = READ_OFFSET32();
+                    goto jumpIfTrue;
+                VM_CASE(JumpIfTrue):
+                    offset = READ_OFFSET16();
+                jumpIfTrue:
                 {
-                    const int16_t offset = READ_OFFSET16();
                     if (!peek(0).isFalsey())
                     {
                         _ip += offset;
+                        if (offset < 0)
+                        {
+                            JIT_ENTER();
+                        }
                     }
-                    break;
+                    VM_NEXT();
                 }
-                case OpCode::ScopeBegin:
+                // superinstructions (see Chunk::fuseSuperinstructions) run their sequence with a single dispatch,
+                // from the operands of the instructions kept after them. When the operand types aren't the expected
+                // ones, only their first instruction runs and the next ones follow as usual.
+                VM_CASE(LocalVarGetConstantAdd):
                 {
-                    Environment *curEnv = _environments.back().get();
-                    _environments.push_back(std::make_unique<Environment>(curEnv));
-                    _currrentEnvironment = _environments.back().get();
-                    break;
+                    const Value &x = _slots[_ip[0]];
+                    const Value &y = _chunk->getConstants()[_ip[2]];
+                    int64_t      result;
+                    if (x.is(Value::Type::Integer) && y.is(Value::Type::Integer) &&
+                        integerArithmetic<Arithmetic::Add>(x.asInteger(), y.asInteger(), &result))
+                    {
+                        stackPush(Value::Create(result));
+                    }
+                    else if (x.is(Value::Type::Number) && y.is(Value::Type::Number))
+                    {
+                        stackPush(Value::Create(numberArithmetic<Arithmetic::Add>(x.asNumber(), y.asNumber())));
+                    }
+                    else
+                    {
+                        operand = READ_U8();
+                        goto localVarGet;
+                    }
+                    _ip += getSuperinstructionLength(OpCode::LocalVarGetConstantAdd) - 1;
+                    VM_NEXT();
                 }
-                case OpCode::ScopeEnd:
+                VM_CASE(LocalVarGetConstantLessJumpIfFalse):
+                    FUSED_LESS_JUMP_IF_FALSE(LocalVarGetConstantLessJumpIfFalse, _chunk->getConstants()[_ip[2]]);
+                VM_CASE(LocalVarGetLocalVarGetLessJumpIfFalse):
+                    FUSED_LESS_JUMP_IF_FALSE(LocalVarGetLocalVarGetLessJumpIfFalse, _slots[_ip[2]]);
+                VM_CASE(GlobalSlotSetPop):
                 {
-                    _currrentEnvironment = _environments.back()->_parentEnvironment;
-                    _environments.pop_back();
-                    break;
+                    Value &value = _globals[_ip[0]];
+                    if (value.is(Value::Type::Undefined))
+                    {  // reported by GlobalSlotSet
+                        operand = READ_U8();
+                        goto globalSlotSet;
+                    }
+                    value = stackPop();
+                    _ip += getSuperinstructionLength(OpCode::GlobalSlotSetPop) - 1;
+                    VM_NEXT();
                 }
-                case OpCode::Undefined:
+                VM_CASE(LocalVarSetPop):
+                    _slots[_ip[0]] = stackPop();
+                    _ip += getSuperinstructionLength(OpCode::LocalVarSetPop) - 1;
+                    VM_NEXT();
+                VM_CASE(PopJump):
+                    stackPop();
+                    _ip += getSuperinstructionLength(OpCode::PopJump) - 1 - sizeof(jump_t);
+                    offset = READ_OFFSET16();
+                    goto jump;
+
+                // scopes are resolved at compile time (locals live in stack slots), markers are only kept for debugging
+                VM_CASE(ScopeBegin): VM_NEXT();
+                VM_CASE(ScopeEnd): VM_NEXT();
+#if !USING(VM_COMPUTED_GOTO)
+                default:
+#endif  // #if !USING(VM_COMPUTED_GOTO)
+                VM_CASE(Undefined):
                     FAIL();
                     return makeResultError<result_t>(ErrorCode::RuntimeError,
-                                                     format("Undefined OpCode: %d", instruction));
+                                                     format("Undefined OpCode: %d", _ip[-1]));
             }
         }
+#if USING(VM_COMPUTED_GOTO)
+#pragma GCC diagnostic pop
+#endif  // #if USING(VM_COMPUTED_GOTO)
 #undef READ_U8
-#undef READ_U16
+#undef READ_U24
+#undef READ_OFFSET16
+#undef READ_OFFSET32
 #undef READ_CONSTANT
 #undef READ_STRING
 #undef BINARY_OP
+#undef COMPARISON_OP
+#undef IS_STRING
+#undef NUMBER_OPERANDS
+#undef INTEGER_OPERANDS
+#undef STRING_OPERANDS
+#undef QUICKEN_IF
+#undef NUMBER_ARITHMETIC_OP
+#undef NUMBER_COMPARISON_OP
+#undef INTEGER_COMPARISON_OP
+#undef INTEGER_ARITHMETIC_OP
+#undef FUSED_LESS_JUMP_IF_FALSE
+#undef TRACE_INSTRUCTION
+#undef JIT_ENTER
+#undef VM_CASE
+#undef VM_NEXT
+    }
+
+    // runs the pre-decoded form of the chunks (see threaded_code.h), production policy only: no quickening, no JIT
+    result_t runThreaded()
+    {
+// locates the instruction for runtimeError
+#define THREADED_ERROR(...) (_ip = _chunk->getCode() + code->getOffset(current) + 1, runtimeError(__VA_ARGS__))
+// shared semantics (see value.h), the result replaces the two operands
+#define THREADED_ARITHMETIC_OP(OP)                                                                  \
+    do                                                                                              \
+    {                                                                                               \
+        --_stackTop;                                                                                \
+        _stackTop[-1] = arithmetic<Arithmetic::OP>(_stackTop[-1], _stackTop[0]);                    \
+    } while (false)
+#define THREADED_COMPARISON_OP(OP)                                                                  \
+    do                                                                                              \
+    {                                                                                               \
+        --_stackTop;                                                                                \
+        _stackTop[-1] = Value::Create(compareValues<Comparison::OP>(_stackTop[-1], _stackTop[0]));  \
+    } while (false)
+
+        const threaded::Code *code = nullptr;
+        const threaded::Cell *cell = nullptr;  // next to execute
+        const threaded::Cell *current = nullptr;
+
+#if USING(VM_COMPUTED_GOTO)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"  // labels as values
+        // following the declaration order in chunk.h up to the generic compact opcodes, then Undefined
+        static void *const kHandlers[] = {
+            &&t_Return,        &&t_Constant,      &&t_Null,          &&t_True,          &&t_False,
+            &&t_Negate,        &&t_Not,           &&t_Assignment,    &&t_Equal,         &&t_Greater,
+            &&t_Less,          &&t_NotEqual,      &&t_GreaterEqual,  &&t_LessEqual,     &&t_Add,
+            &&t_Subtract,      &&t_Multiply,      &&t_Divide,        &&t_Print,         &&t_GlobalVarDef,
+            &&t_GlobalVarSet,  &&t_GlobalVarGet,  &&t_GlobalSlotDef, &&t_GlobalSlotSet, &&t_GlobalSlotGet,
+            &&t_LocalVarSet,   &&t_LocalVarGet,   &&t_Pop,           &&t_Undefined,     &&t_Jump,
+            &&t_JumpIfFalse,   &&t_JumpIfTrue,    &&t_Undefined,     &&t_Undefined,     &&t_Call,
+            &&t_Undefined,
+        };
+        static_assert(ARRAY_COUNT(kHandlers) == threaded::kHandlerCount, "Missing OpCode handlers");
+        const void *const *handlers = kHandlers;
+
+#define THREADED_CASE(OP) t_##OP
+#define THREADED_NEXT()                         \
+    do                                          \
+    {                                           \
+        current = cell++;                       \
+        goto *current->handler;                 \
+    } while (false)
+#else   // #if USING(VM_COMPUTED_GOTO)
+        const void *const *handlers = nullptr;
+
+#define THREADED_CASE(OP) case OpCode::OP
+#define THREADED_NEXT() break
+#endif  // #else // #if USING(VM_COMPUTED_GOTO)
+
+        // enters the running chunk, its code is built the first time
+#define THREADED_ENTER_CHUNK()                                                                      \
+    do                                                                                              \
+    {                                                                                               \
+        std::shared_ptr<threaded::Code> &chunkCode = _chunk->getThreadedCode();                     \
+        if (!chunkCode)                                                                             \
+        {                                                                                           \
+            auto buildResult = threaded::build(*_chunk, handlers);                                  \
+            if (!buildResult.isOk())                                                                \
+            {                                                                                       \
+                return makeResultError<result_t>(ErrorCode::RuntimeError, buildResult.error().message()); \
+            }                                                                                       \
+            chunkCode = buildResult.value();                                                        \
+        }                                                                                           \
+        code = chunkCode.get();                                                                     \
+        cell = code->cells.data();                                                                  \
+    } while (false)
+
+        THREADED_ENTER_CHUNK();
+
+#if USING(VM_COMPUTED_GOTO)
+        THREADED_NEXT();
+        {
+            {
+#else   // #if USING(VM_COMPUTED_GOTO)
+        for (;;)
+        {
+            current = cell++;
+            switch (current->op)
+            {
+#endif  // #else // #if USING(VM_COMPUTED_GOTO)
+                THREADED_CASE(Return):
+                {
+                    if (!popFrame(stackPop()))
+                    {
+                        return InterpretResult::Ok;
+                    }
+                    code = _chunk->getThreadedCode().get();
+                    cell = _frames[_frameCount - 1].cell;
+                    THREADED_NEXT();
+                }
+                THREADED_CASE(Call):
+                {
+                    const uint32_t argCount = current->operand.index;
+                    // the bytecode return address only locates the call for runtime errors
+                    CallFrame &caller = _frames[_frameCount - 1];
+                    caller.ip         = _chunk->getCode() + code->getOffset(current) + 1;
+                    caller.cell       = cell;
+                    const ObjectFunction *function;
+                    if (const char *error = prepareCall(_stackTop - argCount - 1, argCount, &function))
+                    {
+                        return THREADED_ERROR("%s", error);
+                    }
+                    if (function == nullptr)
+                    {  // native result in place of the callee
+                        _stackTop -= argCount;
+                        THREADED_NEXT();
+                    }
+                    THREADED_ENTER_CHUNK();
+                    THREADED_NEXT();
+                }
+                THREADED_CASE(Constant): stackPush(*current->operand.constant); THREADED_NEXT();
+                THREADED_CASE(Null): stackPush(Value::Create(Value::Null)); THREADED_NEXT();
+                THREADED_CASE(True): stackPush(Value::Create(true)); THREADED_NEXT();
+                THREADED_CASE(False): stackPush(Value::Create(false)); THREADED_NEXT();
+
+                THREADED_CASE(Equal): THREADED_COMPARISON_OP(Equal); THREADED_NEXT();
+                THREADED_CASE(Greater): THREADED_COMPARISON_OP(Greater); THREADED_NEXT();
+                THREADED_CASE(Less): THREADED_COMPARISON_OP(Less); THREADED_NEXT();
+                THREADED_CASE(NotEqual): THREADED_COMPARISON_OP(NotEqual); THREADED_NEXT();
+                THREADED_CASE(GreaterEqual): THREADED_COMPARISON_OP(GreaterEqual); THREADED_NEXT();
+                THREADED_CASE(LessEqual): THREADED_COMPARISON_OP(LessEqual); THREADED_NEXT();
+
+                THREADED_CASE(Add):
+                {
+                    // operands stay on the stack (rooted) while the result is allocated
+                    const Value &b        = peek(0);
+                    const Value &a        = peek(1);
+                    Value        newValue = arithmetic<Arithmetic::Add>(a, b);
+                    if (newValue.is(Value::Type::Undefined))
+                    {
+                        return THREADED_ERROR("Cannot add types %s + %s",
+                            !a.is(Value::Type::Object) ? a.getTypeName(a.getType()) : a.asObject()->getTypeName(a.asObject()->type),
+                            !b.is(Value::Type::Object) ? b.getTypeName(b.getType()) : b.asObject()->getTypeName(b.asObject()->type));
+                    }
+                    --_stackTop;
+                    _stackTop[-1] = newValue;
+                    THREADED_NEXT();
+                }
+                THREADED_CASE(Subtract): THREADED_ARITHMETIC_OP(Subtract); THREADED_NEXT();
+                THREADED_CASE(Multiply): THREADED_ARITHMETIC_OP(Multiply); THREADED_NEXT();
+                THREADED_CASE(Divide): THREADED_ARITHMETIC_OP(Divide); THREADED_NEXT();
+                THREADED_CASE(Negate):
+                {
+                    if (!peek(0).isNumber())
+                    {
+                        return THREADED_ERROR("Operand must be a number");
+                    }
+                    _stackTop[-1] = -_stackTop[-1];
+                    THREADED_NEXT();
+                }
+                THREADED_CASE(Not): _stackTop[-1] = Value::Create(_stackTop[-1].isFalsey()); THREADED_NEXT();
+                THREADED_CASE(Print): printValue(stackPop()); THREADED_NEXT();
+                THREADED_CASE(Pop): stackPop(); THREADED_NEXT();
+
+                THREADED_CASE(GlobalVarDef):
+                {
+                    *addVariable(current->operand.constant->asObject()->asString()) = stackPop();
+                    THREADED_NEXT();
+                }
+                THREADED_CASE(GlobalVarSet):
+                {
+                    const ObjectString *varName = current->operand.constant->asObject()->asString();
+                    Value              *value   = findVariable(varName);
+                    if (value == nullptr)
+                    {
+                        if (!_compiler.getConfiguration().allowDynamicVariables)
+                        {
+                            return THREADED_ERROR("Trying to write to undeclared variable '%s'.", varName->chars);
+                        }
+                        value = addVariable(varName);
+                    }
+                    *value = peek(0);
+                    THREADED_NEXT();
+                }
+                THREADED_CASE(GlobalVarGet):
+                {
+                    const ObjectString *varName = current->operand.constant->asObject()->asString();
+                    const Value        *value   = findVariable(varName);
+                    if (value == nullptr)
+                    {
+                        return THREADED_ERROR("Trying to read undeclared variable '%s'.", varName->chars);
+                    }
+                    else if (value->is(Value::Type::Null))
+                    {
+                        return THREADED_ERROR("Trying to read undefined variable '%s'.", varName->chars);
+                    }
+                    stackPush(*value);
+                    THREADED_NEXT();
+                }
+                THREADED_CASE(GlobalSlotDef): _globals[current->operand.index] = stackPop(); THREADED_NEXT();
+                THREADED_CASE(GlobalSlotSet):
+                {
+                    Value &value = _globals[current->operand.index];
+                    if (value.is(Value::Type::Undefined))
+                    {
+                        return THREADED_ERROR("Trying to write to undeclared variable '%s'.",
+                                              getGlobalName(current->operand.index));
+                    }
+                    value = peek(0);
+                    THREADED_NEXT();
+                }
+                THREADED_CASE(GlobalSlotGet):
+                {
+                    const Value &value = _globals[current->operand.index];
+                    if (value.is(Value::Type::Undefined))
+                    {
+                        return THREADED_ERROR("Trying to read undeclared variable '%s'.",
+                                              getGlobalName(current->operand.index));
+                    }
+                    else if (value.is(Value::Type::Null))
+                    {
+                        return THREADED_ERROR("Trying to read undefined variable '%s'.",
+                                              getGlobalName(current->operand.index));
+                    }
+                    stackPush(value);
+                    THREADED_NEXT();
+                }
+                THREADED_CASE(LocalVarSet): _slots[current->operand.index] = peek(0); THREADED_NEXT();
+                THREADED_CASE(LocalVarGet): stackPush(_slots[current->operand.index]); THREADED_NEXT();
+                THREADED_CASE(Assignment):
+                {
+                    const Value         rvalue   = stackPop();
+                    const ObjectString *varName  = current->operand.constant->asObject()->asString();
+                    Value              *varValue = findVariable(varName);
+                    if (varValue == nullptr)
+                    {  // allow dynamic creation ?
+                        varValue = addVariable(varName);
+                    }
+                    *varValue = rvalue;
+                    THREADED_NEXT();
+                }
+
+                THREADED_CASE(Jump): cell = current->operand.target; THREADED_NEXT();
+                THREADED_CASE(JumpIfFalse):
+                {
+                    if (peek(0).isFalsey())
+                    {
+                        cell = current->operand.target;
+                    }
+                    THREADED_NEXT();
+                }
+                THREADED_CASE(JumpIfTrue):
+                {
+                    if (!peek(0).isFalsey())
+                    {
+                        cell = current->operand.target;
+                    }
+                    THREADED_NEXT();
+                }
+#if !USING(VM_COMPUTED_GOTO)
+                default:
+#endif  // #if !USING(VM_COMPUTED_GOTO)
+                THREADED_CASE(Undefined):
+                    FAIL();
+                    return makeResultError<result_t>(ErrorCode::RuntimeError,
+                                                     format("Undefined OpCode at %u", code->getOffset(current)));
+            }
+        }
+#if USING(VM_COMPUTED_GOTO)
+#pragma GCC diagnostic pop
+#endif  // #if USING(VM_COMPUTED_GOTO)
+#undef THREADED_ERROR
+#undef THREADED_ARITHMETIC_OP
+#undef THREADED_COMPARISON_OP
+#undef THREADED_CASE
+#undef THREADED_NEXT
+#undef THREADED_ENTER_CHUNK
+    }
+
+    // runs the register form of the chunks (see register_code.h), production policy only: no quickening, no JIT.
+    // The frame of the running function spans its registers (the stack top is past them, so the collector marks them).
+    result_t runRegisters()
+    {
+// the instruction being executed, pc already points to the next one
+#define INSTRUCTION() (pc[-1])
+#define RK(OPERAND)                                                                                 \
+    ((OPERAND) & reg::kConstantBit ? &code->constants[(OPERAND) & ~reg::kConstantBit] : &_slots[OPERAND])
+// locates the instruction for runtimeError
+#define REGISTER_ERROR(...) (_ip = _chunk->getCode() + code->getOffset(pc - 1) + 1, runtimeError(__VA_ARGS__))
+// shared semantics (see value.h) on registers or constants, the result goes to register a
+#define REGISTER_ARITHMETIC_OP(OP)                                                                  \
+    do                                                                                              \
+    {                                                                                               \
+        const Value &x          = *RK(INSTRUCTION().b);                                             \
+        const Value &y          = *RK(INSTRUCTION().c);                                             \
+        _slots[INSTRUCTION().a] = arithmetic<Arithmetic::OP>(x, y);                                 \
+    } while (false)
+#define REGISTER_COMPARISON_OP(OP)                                                                  \
+    do                                                                                              \
+    {                                                                                               \
+        const Value &x          = *RK(INSTRUCTION().b);                                             \
+        const Value &y          = *RK(INSTRUCTION().c);                                             \
+        _slots[INSTRUCTION().a] = Value::Create(compareValues<Comparison::OP>(x, y));               \
+    } while (false)
+
+        const reg::Code        *code = _chunk->getRegisterCode().get();
+        const reg::Instruction *pc   = code->instructions.data();  // next to execute
+
+        // registers past the arguments start as null, stale values could point to collected objects
+        _stackTop = _slots + code->frameSize;
+        std::fill(_slots + 1, _stackTop, Value::Create(Value::Null));
+
+#if USING(VM_COMPUTED_GOTO)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"  // labels as values
+        // following the declaration order in register_code.h
+        static void *const kHandlers[] = {
+            &&r_Move,          &&r_Add,           &&r_Subtract,      &&r_Multiply,      &&r_Divide,
+            &&r_Equal,         &&r_NotEqual,      &&r_Greater,       &&r_Less,          &&r_GreaterEqual,
+            &&r_LessEqual,     &&r_Negate,        &&r_Not,           &&r_Print,         &&r_GlobalSlotGet,
+            &&r_GlobalSlotSet, &&r_GlobalSlotDef, &&r_GlobalVarGet,  &&r_GlobalVarSet,  &&r_GlobalVarDef,
+            &&r_Assignment,    &&r_Jump,          &&r_JumpIfFalse,   &&r_JumpIfTrue,    &&r_Call,
+            &&r_Return,        &&r_Undefined,
+        };
+        static_assert(ARRAY_COUNT(kHandlers) == named_enum::size<reg::Op>(), "Missing register Op handlers");
+
+#define REGISTER_CASE(OP) r_##OP
+#define REGISTER_NEXT()                                   \
+    do                                                    \
+    {                                                     \
+        goto *kHandlers[static_cast<size_t>((pc++)->op)]; \
+    } while (false)
+
+        REGISTER_NEXT();
+        {
+            {
+#else   // #if USING(VM_COMPUTED_GOTO)
+#define REGISTER_CASE(OP) case reg::Op::OP
+#define REGISTER_NEXT() break
+
+        for (;;)
+        {
+            switch ((pc++)->op)
+            {
+#endif  // #else // #if USING(VM_COMPUTED_GOTO)
+                REGISTER_CASE(Move): _slots[INSTRUCTION().a] = *RK(INSTRUCTION().b); REGISTER_NEXT();
+
+                REGISTER_CASE(Add):
+                {
+                    // operands are in registers or constants (rooted) while the result is allocated
+                    const Value &x        = *RK(INSTRUCTION().b);
+                    const Value &y        = *RK(INSTRUCTION().c);
+                    const Value  newValue = arithmetic<Arithmetic::Add>(x, y);
+                    if (newValue.is(Value::Type::Undefined))
+                    {
+                        return REGISTER_ERROR("Cannot add types %s + %s",
+                            !x.is(Value::Type::Object) ? x.getTypeName(x.getType()) : x.asObject()->getTypeName(x.asObject()->type),
+                            !y.is(Value::Type::Object) ? y.getTypeName(y.getType()) : y.asObject()->getTypeName(y.asObject()->type));
+                    }
+                    _slots[INSTRUCTION().a] = newValue;
+                    REGISTER_NEXT();
+                }
+                REGISTER_CASE(Subtract): REGISTER_ARITHMETIC_OP(Subtract); REGISTER_NEXT();
+                REGISTER_CASE(Multiply): REGISTER_ARITHMETIC_OP(Multiply); REGISTER_NEXT();
+                REGISTER_CASE(Divide): REGISTER_ARITHMETIC_OP(Divide); REGISTER_NEXT();
+
+                REGISTER_CASE(Equal): REGISTER_COMPARISON_OP(Equal); REGISTER_NEXT();
+                REGISTER_CASE(NotEqual): REGISTER_COMPARISON_OP(NotEqual); REGISTER_NEXT();
+                REGISTER_CASE(Greater): REGISTER_COMPARISON_OP(Greater); REGISTER_NEXT();
+                REGISTER_CASE(Less): REGISTER_COMPARISON_OP(Less); REGISTER_NEXT();
+                REGISTER_CASE(GreaterEqual): REGISTER_COMPARISON_OP(GreaterEqual); REGISTER_NEXT();
+                REGISTER_CASE(LessEqual): REGISTER_COMPARISON_OP(LessEqual); REGISTER_NEXT();
+
+                REGISTER_CASE(Negate):
+                {
+                    const Value &value = *RK(INSTRUCTION().b);
+                    if (!value.isNumber())
+                    {
+                        return REGISTER_ERROR("Operand must be a number");
+                    }
+                    _slots[INSTRUCTION().a] = -value;
+                    REGISTER_NEXT();
+                }
+                REGISTER_CASE(Not): _slots[INSTRUCTION().a] = Value::Create(RK(INSTRUCTION().b)->isFalsey()); REGISTER_NEXT();
+                REGISTER_CASE(Print): printValue(*RK(INSTRUCTION().b)); REGISTER_NEXT();
+
+                REGISTER_CASE(GlobalSlotGet):
+                {
+                    const Value &value = _globals[INSTRUCTION().b];
+                    if (value.is(Value::Type::Undefined))
+                    {
+                        return REGISTER_ERROR("Trying to read undeclared variable '%s'.", getGlobalName(INSTRUCTION().b));
+                    }
+                    else if (value.is(Value::Type::Null))
+                    {
+                        return REGISTER_ERROR("Trying to read undefined variable '%s'.", getGlobalName(INSTRUCTION().b));
+                    }
+                    _slots[INSTRUCTION().a] = value;
+                    REGISTER_NEXT();
+                }
+                REGISTER_CASE(GlobalSlotSet):
+                {
+                    Value &value = _globals[INSTRUCTION().a];
+                    if (value.is(Value::Type::Undefined))
+                    {
+                        return REGISTER_ERROR("Trying to write to undeclared variable '%s'.",
+                                              getGlobalName(INSTRUCTION().a));
+                    }
+                    value = *RK(INSTRUCTION().b);
+                    REGISTER_NEXT();
+                }
+                REGISTER_CASE(GlobalSlotDef): _globals[INSTRUCTION().a] = *RK(INSTRUCTION().b); REGISTER_NEXT();
+                REGISTER_CASE(GlobalVarGet):
+                {
+                    const ObjectString *varName = RK(INSTRUCTION().b)->asObject()->asString();
+                    const Value        *value   = findVariable(varName);
+                    if (value == nullptr)
+                    {
+                        return REGISTER_ERROR("Trying to read undeclared variable '%s'.", varName->chars);
+                    }
+                    else if (value->is(Value::Type::Null))
+                    {
+                        return REGISTER_ERROR("Trying to read undefined variable '%s'.", varName->chars);
+                    }
+                    _slots[INSTRUCTION().a] = *value;
+                    REGISTER_NEXT();
+                }
+                REGISTER_CASE(GlobalVarSet):
+                {
+                    const ObjectString *varName = RK(INSTRUCTION().a)->asObject()->asString();
+                    Value              *value   = findVariable(varName);
+                    if (value == nullptr)
+                    {
+                        if (!_compiler.getConfiguration().allowDynamicVariables)
+                        {
+                            return REGISTER_ERROR("Trying to write to undeclared variable '%s'.", varName->chars);
+                        }
+                        value = addVariable(varName);
+                    }
+                    *value = *RK(INSTRUCTION().b);
+                    REGISTER_NEXT();
+                }
+                REGISTER_CASE(GlobalVarDef):
+                {
+                    *addVariable(RK(INSTRUCTION().a)->asObject()->asString()) = *RK(INSTRUCTION().b);
+                    REGISTER_NEXT();
+                }
+                REGISTER_CASE(Assignment):
+                {
+                    const ObjectString *varName  = RK(INSTRUCTION().a)->asObject()->asString();
+                    Value              *varValue = findVariable(varName);
+                    if (varValue == nullptr)
+                    {  // allow dynamic creation ?
+                        varValue = addVariable(varName);
+                    }
+                    *varValue = *RK(INSTRUCTION().b);
+                    REGISTER_NEXT();
+                }
+
+                REGISTER_CASE(Jump): pc = &code->instructions[INSTRUCTION().a]; REGISTER_NEXT();
+                REGISTER_CASE(JumpIfFalse):
+                {
+                    if (RK(INSTRUCTION().b)->isFalsey())
+                    {
+                        pc = &code->instructions[INSTRUCTION().a];
+                    }
+                    REGISTER_NEXT();
+                }
+                REGISTER_CASE(JumpIfTrue):
+                {
+                    if (!RK(INSTRUCTION().b)->isFalsey())
+                    {
+                        pc = &code->instructions[INSTRUCTION().a];
+                    }
+                    REGISTER_NEXT();
+                }
+
+                REGISTER_CASE(Call):
+                {
+                    const uint32_t argCount = INSTRUCTION().b;
+                    // the bytecode return address only locates the call for runtime errors
+                    CallFrame &caller = _frames[_frameCount - 1];
+                    caller.ip         = _chunk->getCode() + code->getOffset(pc - 1) + 1;
+                    caller.pc         = pc;
+                    const ObjectFunction *function;
+                    if (const char *error = prepareCall(&_slots[INSTRUCTION().a], argCount, &function))
+                    {
+                        return REGISTER_ERROR("%s", error);
+                    }
+                    if (function == nullptr)
+                    {  // native result in the callee register
+                        REGISTER_NEXT();
+                    }
+                    code = _chunk->getRegisterCode().get();
+                    if (code == nullptr)
+                    {
+                        auto calleeCode = getRegisterCode(*function);
+                        if (!calleeCode.isOk())
+                        {
+                            return makeResultError<result_t>(ErrorCode::RuntimeError, calleeCode.error().message());
+                        }
+                        code = calleeCode.value();
+                    }
+                    pc        = code->instructions.data();
+                    _stackTop = _slots + code->frameSize;
+                    std::fill(_slots + 1 + argCount, _stackTop, Value::Create(Value::Null));
+                    REGISTER_NEXT();
+                }
+                REGISTER_CASE(Return):
+                {
+                    if (!popFrame(*RK(INSTRUCTION().b)))
+                    {
+                        return InterpretResult::Ok;
+                    }
+                    code      = _chunk->getRegisterCode().get();
+                    pc        = _frames[_frameCount - 1].pc;
+                    _stackTop = _slots + code->frameSize;
+                    REGISTER_NEXT();
+                }
+#if !USING(VM_COMPUTED_GOTO)
+                default:
+#endif  // #if !USING(VM_COMPUTED_GOTO)
+                REGISTER_CASE(Undefined):
+                    FAIL();
+                    return makeResultError<result_t>(ErrorCode::RuntimeError,
+                                                     format("Undefined OpCode at %u", code->getOffset(pc - 1)));
+            }
+        }
+#if USING(VM_COMPUTED_GOTO)
+#pragma GCC diagnostic pop
+#endif  // #if USING(VM_COMPUTED_GOTO)
+#undef INSTRUCTION
+#undef RK
+#undef REGISTER_ERROR
+#undef REGISTER_ARITHMETIC_OP
+#undef REGISTER_COMPARISON_OP
+#undef REGISTER_CASE
+#undef REGISTER_NEXT
+    }
+
+    // checks and frame setup of a call, shared by every execution mode: callee then arguments from `callee` on. A
+    // native runs on the arguments in place and its result replaces the callee (null *o_function), a function gets
+    // its frame pushed and becomes the running one (the caller's return address is up to the mode). The error message
+    // of an invalid call is returned, nullptr otherwise (no Result: it allocates, on every call)
+    const char *prepareCall(Value *callee, uint32_t argCount, const ObjectFunction **o_function)
+    {
+        *o_function = nullptr;
+        if (!callee->is(Value::Type::Object))
+        {
+            return "Can only call functions.";
+        }
+        if (callee->asObject()->type == Object::Type::Native)
+        {
+            const ObjectNative *native = callee->asObject()->asNative();
+            if (argCount != native->arity)
+            {
+                snprintf(_callError, sizeof(_callError), "Expected %u arguments but got %u.", native->arity, argCount);
+                return _callError;
+            }
+            Value result = Value::Create(Value::Null);
+            if (!native->function(callee + 1, &result))
+            {
+                return result.asObject()->asString()->chars;
+            }
+            *callee = result;
+            return nullptr;
+        }
+        if (callee->asObject()->type != Object::Type::Function)
+        {
+            return "Can only call functions.";
+        }
+        const ObjectFunction *function = callee->asObject()->asFunction();
+        if (argCount != function->arity)
+        {
+            snprintf(_callError, sizeof(_callError), "Expected %u arguments but got %u.", function->arity, argCount);
+            return _callError;
+        }
+        if (_frameCount == limits::kMaxFrames || stackSize() > STACK_SIZE - kFrameStackReserve)
+        {
+            return "Stack overflow.";
+        }
+        CallFrame &frame = _frames[_frameCount++];
+        frame.function   = function;
+        frame.slots      = callee;
+        _chunk           = &function->chunk;
+        _slots           = frame.slots;
+        *o_function      = function;
+        return nullptr;
+    }
+
+    // the result of the running function replaces its callee and the caller becomes the running one again (false
+    // once the script itself returns), the stack modes drop the callee's window past the result
+    bool popFrame(const Value &result)
+    {
+        if (--_frameCount == 0)
+        {
+            stackReset();
+            return false;
+        }
+        _slots[0]              = result;
+        _stackTop              = _slots + 1;
+        const CallFrame &frame = _frames[_frameCount - 1];
+        _chunk                 = &frame.function->chunk;
+        _slots                 = frame.slots;
+        return true;
+    }
+
+    // register form of a function, translated on its first call (frames too large for the stack reserve fail)
+    Result<const reg::Code *> getRegisterCode(const ObjectFunction &function)
+    {
+        std::shared_ptr<reg::Code> &code = function.chunk.getRegisterCode();
+        if (!code)
+        {
+            auto buildResult = reg::build(function.chunk, function.arity);
+            if (!buildResult.isOk())
+            {
+                return buildResult.error();
+            }
+            if (buildResult.value()->frameSize > kFrameStackReserve)
+            {
+                return Error<>(format("Frame of '%s' too large for registers", function.name->chars));
+            }
+            code = buildResult.value();
+        }
+        return code.get();
+    }
+
+    // the script and the functions in its constants (recursively)
+    void fuseSuperinstructions(const ObjectFunction &function)
+    {
+        function.chunk.fuseSuperinstructions();
+        const Chunk::ValueArray &constants = function.chunk.getConstants();
+        for (const Value *constant = constants.cbegin(); constant != constants.cend(); ++constant)
+        {
+            if (constant->is(Value::Type::Object) && constant->asObject()->type == Object::Type::Function)
+            {
+                fuseSuperinstructions(*constant->asObject()->asFunction());
+            }
+        }
+    }
+
+    // the script and the functions in its constants (recursively) translate into register code
+    bool buildRegisterCode(const ObjectFunction &function)
+    {
+        if (!getRegisterCode(function).isOk())
+        {
+            return false;
+        }
+        const Chunk::ValueArray &constants = function.chunk.getConstants();
+        for (const Value *constant = constants.cbegin(); constant != constants.cend(); ++constant)
+        {
+            if (constant->is(Value::Type::Object) && constant->asObject()->type == Object::Type::Function &&
+                !buildRegisterCode(*constant->asObject()->asFunction()))
+            {
+                return false;
+            }
+        }
+        return true;
     }
 
     result_t interpret(const char *source, const char *sourcePath,
@@ -384,12 +1504,7 @@ struct VirtualMachine
             return makeResultError<result_t>(ErrorCode::CompileError, result.error().message());
         }
         const ObjectFunction *function = result.value();
-        _chunk                    = &function->chunk;
-        _ip                       = function->chunk.getCode();
-
-        result_t runResult = run();
-
-        return runResult;
+        return execute(*function);
     }
 
     result_t runFromSource(const char *sourceCode, Optional<Compiler::Configuration> optConfiguration = none_t)
@@ -406,16 +1521,42 @@ struct VirtualMachine
         }
         char *buffer = source.value().get();
 
-        return interpret(buffer, path, optConfiguration);
-    }
+        if (_configuration.cacheDirectory == nullptr)
+        {
+            return interpret(buffer, path, optConfiguration);
+        }
 
-    result_t runFromByteCode(const Chunk &bytecode)
-    {
-        _chunk = &bytecode;
-        _ip    = bytecode.getCode();
-        return run();
+        if (optConfiguration.hasValue())
+        {
+            _compiler.setConfiguration(optConfiguration.value());
+        }
+        const Compiler::Configuration &compilerConfig = _compiler.getConfiguration();
+
+        // misses (or stale entries) are compiled and stored, failing to store only loses the caching
+        const BytecodeCache cache(_configuration.cacheDirectory);
+        const std::string   entryPath = cache.getEntryPath(buffer, strlen(buffer), compilerConfig);
+        auto                cached    = cache.load(entryPath, path);
+        if (cached.isOk())
+        {
+            if (compilerConfig.disassemble)
+            {
+                disassemble(cached.value()->chunk, "code");
+            }
+            return execute(*cached.value());
+        }
+
+        Compiler::result_t result = _compiler.compile(buffer, path);
+        if (!result.isOk())
+        {
+            return makeResultError<result_t>(ErrorCode::CompileError, result.error().message());
+        }
+        const ObjectFunction *function = result.value();
+        cache.store(entryPath, *function);
+        return execute(*function);
     }
 
+    result_t runFromByteCode(const ObjectFunction &function) { return execute(function); }
+
     result_t repl(Optional<Compiler::Configuration> optConfiguration = none_t)
     {
         Compiler::Configuration compilerConfig =
@@ -564,10 +1705,116 @@ struct VirtualMachine
     }
 
    protected:  // Interpreter
+    result_t execute(const ObjectFunction &function)
+    {
+        if (_configuration.gcStats)
+        {
+            result_t result = executeFunction(function);
+            GarbageCollector::printStats();
+            Object::PrintAllocatorStats();
+            return result;
+        }
+        return executeFunction(function);
+    }
+
+    result_t executeFunction(const ObjectFunction &function)
+    {
+        const Chunk &chunk = function.chunk;
+        _function          = &function;
+        _globals.assign(chunk.getGlobalNames().size(), Value::Create());
+        // globals defined by the host (natives) are bound to the slots the compiler resolved their names to
+        const Chunk::ValueArray &globalNames = chunk.getGlobalNames();
+        for (size_t slot = 0; slot < globalNames.size(); ++slot)
+        {
+            if (const Value *value = findVariable(globalNames[slot].asObject()->asString()))
+            {
+                _globals[slot] = *value;
+            }
+        }
+
+        // the script is called like any other function, with no arguments
+        stackReset();
+        stackPush(Value::Create(const_cast<ObjectFunction *>(&function)));
+        CallFrame &frame = _frames[0];
+        frame.function   = &function;
+        frame.slots      = _stack;
+        _frameCount      = 1;
+        _chunk           = &chunk;
+        _ip              = chunk.getCode();
+        _slots           = frame.slots;
+
+#if DEBUG_TRACE_EXECUTION
+        if (_configuration.stepByStep)
+        {
+            return run<StepDebugPolicy>();
+        }
+        if (_compiler.getConfiguration().disassemble)
+        {
+            return run<TracePolicy>();
+        }
+#endif  // #if DEBUG_TRACE_EXECUTION
+        if (_configuration.superinstructions)
+        {
+            fuseSuperinstructions(function);
+        }
+        if (_configuration.profile)
+        {
+            _profile.reset();
+            result_t result = run<ProfilePolicy>();
+            printProfile();
+            return result;
+        }
+        if (_configuration.threaded)
+        {
+            return runThreaded();
+        }
+        if (_configuration.registers)
+        {
+            if (buildRegisterCode(function))
+            {
+                return runRegisters();
+            }
+            DEBUGPRINT_EX("'%s' not translatable into register code, running its bytecode\n", chunk.getSourcePath());
+        }
+        return run<ExecutionPolicy>();
+    }
+
+#if USING(JIT)
+    // the chunk being executed gets hotter, once compiled its machine code runs from _ip up to an instruction it
+    // leaves to the interpreter (chunks failing to compile stay interpreted)
+    void runJit()
+    {
+        Chunk::JitState &state = _chunk->getJitState();
+        if (!state.code)
+        {
+            if (state.failed || ++state.hotness <= _configuration.jitThreshold)
+            {
+                return;
+            }
+            auto compileResult = jit::compile(*_chunk, _globals.size());
+            if (!compileResult.isOk())
+            {
+                DEBUGPRINT_EX("JIT failed on '%s': %s\n", _chunk->getSourcePath(), compileResult.error().message().c_str());
+                state.failed = true;
+                return;
+            }
+            state.code        = compileResult.value();
+            state.globalCount = _globals.size();
+        }
+        else if (_globals.size() < state.globalCount)
+        {  // compiled for a larger globals table (i.e., a function kept from a previous script)
+            return;
+        }
+        jit::Frame      frame{&_stackTop, _slots, _globals.data(), nullptr};
+        const codepos_t resume = jit::run(*state.code, frame, static_cast<codepos_t>(_ip - _chunk->getCode()));
+        _ip                    = _chunk->getCode() + resume;
+    }
+#endif  // #if USING(JIT)
+
     const Value &peek(uint32_t distance) const
     {
         ASSERT(distance < stackSize());
-        const Value &value = *(_stackTop - 1 + distance);
+        const Value &value = *(_stackTop - 1 - distance);
         return value;
     }
 
@@ -579,19 +1826,33 @@ struct VirtualMachine
         vsnprintf(message, sizeof(message), format, args);
         va_end(args);
 
+        const char  *sourcePath  = _function->chunk.getSourcePath();
         const Chunk *chunk       = this->_chunk;
         const auto   instruction = static_cast<codepos_t>(this->_ip - chunk->getCode() - 1);
         const size_t line        = chunk->getLine(instruction);
-        char         outputMessage[512];
-        snprintf(outputMessage, sizeof(outputMessage), "[%s:%zu] Runtime error: %s\n", chunk->getSourcePath(), line,
-                 message);
+        char         outputMessage[2048];
+        int          length = snprintf(outputMessage, sizeof(outputMessage), "[%s:%zu] Runtime error: %s\n", sourcePath,
+                                       line, message);
+        // callers, innermost first (the script itself is the outermost frame)
+        for (size_t i = _frameCount - 1; i > 0 && length < static_cast<int>(sizeof(outputMessage)); --i)
+        {
+            const CallFrame &caller = _frames[i - 1];
+            const auto callPos = static_cast<codepos_t>(caller.ip - caller.function->chunk.getCode() - 1);
+            length += snprintf(outputMessage + length, sizeof(outputMessage) - length, "\t[%s:%zu] in %s\n",
+                               sourcePath, caller.function->chunk.getLine(callPos),
+                               i > 1 ? caller.function->name->chars : "script");
+        }
         FAIL_MSG(outputMessage);
         stackReset();
+        _frameCount = 0;
         return makeResultError<result_t>(result_t::error_t::code_t::RuntimeError, outputMessage);
     }
 
    protected:  // Stack
-    static constexpr size_t STACK_SIZE = 1024;
+    // a call needs room for the locals and temporaries of the callee
+    static constexpr size_t kFrameStackReserve = limits::kMaxLocals + 1024;
+    static constexpr size_t kFrameStackSize    = limits::kMaxShortOperand + 1;  // typical frame
+    static constexpr size_t STACK_SIZE         = limits::kMaxFrames * kFrameStackSize + kFrameStackReserve;
     Value                   _stack[STACK_SIZE];
     Value                  *_stackTop = &_stack[0];
 
@@ -626,7 +1887,189 @@ struct VirtualMachine
         ASSERT(_stackTop >= _stack);
         return static_cast<size_t>(_stackTop - _stack);
     }
+    struct Profile
+    {
+        static constexpr size_t kOpCount = named_enum::size<OpCode>();
+
+        uint64_t opCounts[kOpCount] = {};
+        // sequences of generic instructions following each other in the code (the ones a superinstruction can fuse),
+        // indexed by their opcodes in base kOpCount
+        std::vector<uint64_t> bigramCounts;
+        std::vector<uint64_t> trigramCounts;
+        const opcode_t       *fallthrough = nullptr;  // instruction following the previous one in the code
+        size_t                previous[2] = {};       // last opcodes of the current sequence, [1] the latest
+        uint8_t               sequenceLength = 0;
+        // next instruction of the sequence of the last superinstruction, dispatched when it falls back
+        const opcode_t *fallbackNext = nullptr;
+        const opcode_t *fusedEnd     = nullptr;
+
+        void reset()
+        {
+            *this = Profile{};
+            bigramCounts.assign(kOpCount * kOpCount, 0);
+            trigramCounts.assign(kOpCount * kOpCount * kOpCount, 0);
+        }
+
+        void count(const opcode_t *ip)
+        {
+            const OpCode    op   = OpCode(*ip);
+            const opcode_t *next = ip + 1 + getOperandBytes(op);
+            ++opCounts[*ip];
+
+            // the instructions a superinstruction falls back to were counted in its sequence already
+            if (ip == fallbackNext)
+            {
+                fallbackNext = next < fusedEnd ? next : nullptr;
+                return;
+            }
+            fallbackNext = nullptr;
+
+            // taken jumps, calls and returns start a new sequence. A superinstruction is counted as the generic
+            // instructions it runs, so the n-grams don't depend on the set already fused.
+            addToSequence(op, ip == fallthrough);
+            const uint8_t superinstructionLength = getSuperinstructionLength(op);
+            if (superinstructionLength == 0)
+            {
+                fallthrough = next;
+                return;
+            }
+            fusedEnd = ip + superinstructionLength;
+            for (const opcode_t *component = next; component < fusedEnd;
+                 component += 1 + getOperandBytes(OpCode(*component)))
+            {
+                addToSequence(OpCode(*component), true);
+            }
+            fallthrough  = fusedEnd;
+            fallbackNext = next;
+        }
+
+        void addToSequence(OpCode op, bool continued)
+        {
+            const size_t key = static_cast<size_t>(getShortOpCode(getGenericOpCode(op)));
+            sequenceLength   = continued ? sequenceLength : 0;
+            if (sequenceLength >= 1)
+            {
+                ++bigramCounts[previous[1] * kOpCount + key];
+            }
+            if (sequenceLength >= 2)
+            {
+                ++trigramCounts[(previous[0] * kOpCount + previous[1]) * kOpCount + key];
+            }
+            previous[0]    = previous[1];
+            previous[1]    = key;
+            sequenceLength = std::min<uint8_t>(sequenceLength + 1, 2);
+        }
+    };
+    Profile _profile;
+
+    void printProfile() const
+    {
+        uint64_t total = 0;
+        for (uint64_t count : _profile.opCounts)
+        {
+            total += count;
+        }
+        printf("\n== VM profile: %llu instruction(s) ==\n", (unsigned long long)total);
+        for (size_t op = 0; op < ARRAY_COUNT(_profile.opCounts); ++op)
+        {
+            const uint64_t count = _profile.opCounts[op];
+            if (count > 0)
+            {
+                printf("%-40s %12llu %6.2f%%\n", named_enum::name(OpCode(op)), (unsigned long long)count,
+                       100.0 * double(count) / double(total));
+            }
+        }
+        printNGrams("bigrams", _profile.bigramCounts, 2, total);
+        printNGrams("trigrams", _profile.trigramCounts, 3, total);
+    }
+
+    // most frequent sequences first, candidates for superinstructions
+    static void printNGrams(const char *title, const std::vector<uint64_t> &counts, size_t length, uint64_t total)
+    {
+        constexpr size_t kMaxPrinted = 16;
+
+        std::vector<size_t> ngrams;
+        for (size_t ngram = 0; ngram < counts.size(); ++ngram)
+        {
+            if (counts[ngram] > 0)
+            {
+                ngrams.push_back(ngram);
+            }
+        }
+        const size_t printed = std::min(ngrams.size(), kMaxPrinted);
+        std::partial_sort(ngrams.begin(), ngrams.begin() + printed, ngrams.end(),
+                          [&counts](size_t a, size_t b) { return counts[a] > counts[b]; });
+
+        printf("\n== VM profile: %s ==\n", title);
+        for (size_t i = 0; i < printed; ++i)
+        {
+            std::string name;
+            for (size_t position = length, ngram = ngrams[i]; position-- > 0; ngram /= Profile::kOpCount)
+            {
+                const char *op = named_enum::name(OpCode(ngram % Profile::kOpCount));
+                name.insert(0, std::string(position > 0 ? ", " : "") + op);
+            }
+            printf("%-64s %12llu %6.2f%%\n", name.c_str(), (unsigned long long)counts[ngrams[i]],
+                   100.0 * double(counts[ngrams[i]]) / double(total));
+        }
+    }
+
 #if DEBUG_TRACE_EXECUTION
+    struct TraceState
+    {
+        bool     linesAvailable = false;
+        uint16_t scopeCount     = 0;
+        bool     stepDebugging  = false;
+    };
+
+    void traceInstruction(TraceState &state)
+    {
+        static bool sWasPrint = false;
+        if (sWasPrint)
+        {
+            printf("\n");
+            sWasPrint = false;
+        }
+        const char *padding = "          ";
+        printStack(padding);
+        printVariables(padding);
+        _chunk->printConstants(padding);
+        OpCode instruction = OpCode::Undefined;
+        disassembleInstruction(*_chunk, static_cast<codepos_t>(_ip - _chunk->getCode()), state.linesAvailable,
+                               &state.scopeCount, &instruction);
+        if (instruction == OpCode::Print)
+        {
+            sWasPrint = true;
+            printf("[output]");
+        }
+        if (state.stepDebugging)
+        {
+            // todo : time machine (prev/next IP)
+            // static std::vector<codepos_t> sTimeMachine;
+            while (true)
+            {
+                const char c = read_char();
+                if (c == 'n')
+                {
+                    // sTimeMachine.push_back(_ip - _chunk->getCode());
+                    break;
+                }
+                // WIP - going back requires restoring previous state
+                // else if (c == 'p')
+                // {
+                //     _ip = sTimeMachine.back() + _chunk->getCode();
+                //     sTimeMachine.pop_back();
+                //     break;
+                // }
+                else if (c == 'q')
+                {
+                    state.stepDebugging = false;
+                    break;
+                }
+            }
+        }
+    }
+
     void printStack(const char *padding = "") const
     {
         if (_stack == _stackTop)
@@ -647,47 +2090,87 @@ struct VirtualMachine
 
     void printVariables(const char *padding = "") const
     {
-        ASSERT(_currrentEnvironment);
-        if (_currrentEnvironment->getVariableCount() > 0)
+        if (!_globals.empty())
+        {
+            printf("%s", padding);
+            printf("Globals ");
+            for (size_t slot = 0; slot < _globals.size(); ++slot)
+            {
+                printf("%s=[", getGlobalName(slot));
+                printValueDebug(_globals[slot]);
+                printf("]");
+            }
+            printf("\n");
+        }
+        if (_environment.getVariableCount() > 0)
         {
             printf("%s", padding);
             printf("Variables ");
-            _currrentEnvironment->print();
+            _environment.print();
         }
     }
 #endif  // #if DEBUG_TRACE_EXECUTION
 
+   protected:  // Call frames
+    struct CallFrame
+    {
+        const ObjectFunction *function;
+        const uint8_t        *ip;     // return address, only up to date for the callers of the running function
+        const threaded::Cell *cell;   // return address in the pre-decoded code (runThreaded only)
+        const reg::Instruction *pc;   // return address in the register code (runRegisters only)
+        Value                *slots;  // callee then arguments and locals, addressed by the local slots
+    };
+
+    // fixed capacity, calls allocate nothing
+    CallFrame _frames[limits::kMaxFrames];
+    size_t    _frameCount = 0;
+    char      _callError[64];  // formatted message of an invalid call (see prepareCall)
+
    protected:  // STATE
+    const ObjectFunction *_function = nullptr;  // script being executed
+    // running function, cached from the top frame
     const Chunk   *_chunk = nullptr;
     const uint8_t *_ip    = nullptr;
+    Value         *_slots = nullptr;
 
-    Value *addVariable(const char *name)
+    void markRoots() const
+    {
+        GarbageCollector::markObject(_function);
+        for (const Value *slot = _stack; slot < _stackTop; ++slot)
+        {
+            GarbageCollector::markValue(*slot);
+        }
+        for (const Value &global : _globals)
+        {
+            GarbageCollector::markValue(global);
+        }
+        _environment.markVariables();
+    }
+
+    Value *addVariable(const ObjectString *name)
     {
-        ASSERT(_currrentEnvironment);
 #if USING(DEBUG_TRACE_EXECUTION)
         if (_compiler.getConfiguration().debugPrintVariables)
         {
-            _currrentEnvironment->print();
+            _environment.print();
         }
 #endif  // #if USING(DEBUG_TRACE_EXECUTION)
 
-        return _currrentEnvironment->addVariable(name);
+        return _environment.addVariable(name);
     }
 
-    bool removeVariable(const char *name)
-    {
-        ASSERT(_currrentEnvironment);
-        return _currrentEnvironment->removeVariable(name);
-    }
+    bool removeVariable(const ObjectString *name) { return _environment.removeVariable(name); }
+
+    Value *findVariable(const ObjectString *name) { return _environment.findVariable(name); }
 
-    Value *findVariable(const char *name)
+    const char *getGlobalName(size_t slot) const
     {
-        ASSERT(_currrentEnvironment);
-        return _currrentEnvironment->findVariable(name);
+        return _function->chunk.getGlobalNames()[slot].asObject()->asString()->chars;
     }
 
-    std::vector<std::unique_ptr<Environment>> _environments;
-    Environment                              *_currrentEnvironment = nullptr;
+    std::vector<Value> _globals;  // module globals table, indexed by the slots resolved by the compiler
+
+    Environment _environment;  // globals looked up by name (dynamic variables/REPL)
 
     Compiler _compiler;
 };
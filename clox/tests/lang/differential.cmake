@@ -0,0 +1,19 @@
+# Runs SCRIPT through CLOXC with the plain bytecode interpreter (no JIT, no superinstructions) and again with ARGS (an
+# execution tier), failing if the output (stdout, stderr or exit code) differs
+# usage: cmake -DCLOXC=<cloxc> -DSCRIPT=<file.clox> "-DARGS=<args>" -P differential.cmake
+separate_arguments(tier_args UNIX_COMMAND "${ARGS}")
+execute_process(COMMAND ${CLOXC} -jit 0 -superinstructions 0 ${SCRIPT}
+    RESULT_VARIABLE interpreted_result OUTPUT_VARIABLE interpreted_output ERROR_VARIABLE interpreted_error)
+execute_process(COMMAND ${CLOXC} ${tier_args} ${SCRIPT}
+    RESULT_VARIABLE tier_result OUTPUT_VARIABLE tier_output ERROR_VARIABLE tier_error)
+
+if(NOT interpreted_result STREQUAL tier_result)
+    message(FATAL_ERROR "${SCRIPT}: exit code ${interpreted_result} (interpreter) != ${tier_result} (${ARGS})")
+endif()
+if(NOT interpreted_output STREQUAL tier_output)
+    message(FATAL_ERROR "${SCRIPT}: output differs\n[interpreter]\n${interpreted_output}\n[${ARGS}]\n${tier_output}")
+endif()
+if(NOT interpreted_error STREQUAL tier_error)
+    message(FATAL_ERROR "${SCRIPT}: errors differ\n[interpreter]\n${interpreted_error}\n[${ARGS}]\n${tier_error}")
+endif()
+message(STATUS "${SCRIPT}: same behaviour with ${ARGS}")